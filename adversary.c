@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "bench_harness.h"
+#include "workload.h"
+
+
+/*****            constants            *****/
+
+static const unsigned DEFAULT_OPS         = 1000;
+static const size_t   DEFAULT_POOL_SIZE   = 64 << 10;
+static const size_t   DEFAULT_MAX_SIZE    = 1024;
+static const unsigned DEFAULT_POPULATION  = 48;
+static const unsigned DEFAULT_GENERATIONS = 60;
+
+static const unsigned TOURNAMENT_SIZE     = 3;
+static const unsigned ELITES              = 2;
+static const double   CROSSOVER_RATE      = 0.9;
+
+
+/*****        type declarations        *****/
+
+typedef enum _objective { OBJ_GAPS, OBJ_FRAGMENTATION, OBJ_LATENCY } objective;
+
+static const char *OBJECTIVE_NAMES[] = { "gaps", "frag", "latency" };
+
+/*
+ * A candidate is a fixed-length list of genes, each decoded into one op:
+ * an allocation of `size` bytes, or the free of the live allocation at
+ * position `pick` (modulo the live count). Decoding happens while the ops
+ * run against a fresh pool, so allocations that fail never become live,
+ * and the decoded op list replays identically.
+ */
+typedef struct _gene {
+    unsigned char is_free;
+    unsigned short size;
+    unsigned short pick;
+} gene_t;
+
+typedef struct _candidate {
+    gene_t *genes;
+    double score;
+} candidate_t;
+
+typedef struct _search {
+    alloc_policy policy;
+    objective obj;
+    unsigned num_ops;
+    size_t pool_size;
+    size_t max_size;
+    bench_rng_t rng;
+    unsigned long evaluations;
+} search_t;
+
+typedef struct _outcome {
+    double score;
+    unsigned peak_gaps;
+    double peak_stranded;       // (free bytes - largest gap) / total size
+    unsigned long long max_op_ns;
+    unsigned long failed_allocs;
+} outcome_t;
+
+
+/*****         helper routines         *****/
+
+static void random_gene(search_t *s, gene_t *g) {
+    g->is_free = (unsigned char) (bench_rng_next(&s->rng) & 1);
+    g->size = (unsigned short) bench_rng_range(&s->rng, 1, s->max_size);
+    g->pick = (unsigned short) bench_rng_next(&s->rng);
+}
+
+static void stranded_free(pool_pt pool, double *peak) {
+    pool_segment_iter_t iter;
+    pool_segment_t gap;
+    size_t largest = 0, free_bytes = 0;
+
+    mem_segment_iter_init(pool, &iter, 1, 0);
+    while (mem_segment_iter_next(&iter, &gap)) {
+        free_bytes += gap.size;
+        if (gap.size > largest) largest = gap.size;
+    }
+
+    double stranded = (double) (free_bytes - largest) / pool->total_size;
+    if (stranded > *peak) *peak = stranded;
+}
+
+/* runs the genes against a fresh pool; fills ops (num_ops entries) if given */
+static outcome_t evaluate(search_t *s, const gene_t *genes, wl_op_pt ops) {
+    outcome_t out;
+    memset(&out, 0, sizeof(out));
+    s->evaluations++;
+
+    pool_pt pool = mem_pool_open(s->pool_size, s->policy);
+    alloc_t *records = calloc(s->num_ops, sizeof(alloc_t));
+    unsigned *live = calloc(s->num_ops, sizeof(unsigned));
+    if (pool == NULL || records == NULL || live == NULL) {
+        free(records);
+        free(live);
+        if (pool) mem_pool_close(pool);
+        return out;
+    }
+    unsigned num_live = 0;
+
+    for (unsigned i = 0; i < s->num_ops; ++i) {
+        const gene_t *g = &genes[i];
+        wl_op_t op;
+        unsigned long long t0, t1;
+
+        if (g->is_free && num_live > 0) {
+            unsigned at = g->pick % num_live;
+            op.kind = WL_FREE;
+            op.id = live[at];
+            op.size = 0;
+            live[at] = live[--num_live];
+            t0 = bench_now_ns();
+            mem_del_alloc(pool, &records[op.id]);
+            t1 = bench_now_ns();
+            records[op.id].mem = NULL;
+        } else {
+            // ids are op indices, so they never collide
+            op.kind = WL_ALLOC;
+            op.id = i;
+            op.size = g->size;
+            t0 = bench_now_ns();
+            alloc_pt alloc = mem_new_alloc(pool, op.size);
+            t1 = bench_now_ns();
+            if (alloc) {
+                records[i] = *alloc;
+                live[num_live++] = i;
+            } else {
+                out.failed_allocs++;
+            }
+        }
+        if (ops) ops[i] = op;
+
+        if (t1 - t0 > out.max_op_ns) out.max_op_ns = t1 - t0;
+        if (pool->num_gaps > out.peak_gaps) out.peak_gaps = pool->num_gaps;
+        // the final re-run (ops != NULL) reports every metric
+        if (s->obj == OBJ_FRAGMENTATION || ops != NULL)
+            stranded_free(pool, &out.peak_stranded);
+    }
+
+    for (unsigned i = 0; i < num_live; ++i)
+        mem_del_alloc(pool, &records[live[i]]);
+    mem_pool_close(pool);
+    free(records);
+    free(live);
+
+    switch (s->obj) {
+        case OBJ_GAPS:          out.score = out.peak_gaps; break;
+        case OBJ_FRAGMENTATION: out.score = out.peak_stranded; break;
+        case OBJ_LATENCY:       out.score = (double) out.max_op_ns; break;
+    }
+    return out;
+}
+
+static const candidate_t *tournament(search_t *s, const candidate_t *pop, unsigned size) {
+    const candidate_t *best = &pop[bench_rng_range(&s->rng, 0, size - 1)];
+    for (unsigned i = 1; i < TOURNAMENT_SIZE; ++i) {
+        const candidate_t *c = &pop[bench_rng_range(&s->rng, 0, size - 1)];
+        if (c->score > best->score) best = c;
+    }
+    return best;
+}
+
+static int by_score_desc(const void *a, const void *b) {
+    double x = ((const candidate_t *) a)->score, y = ((const candidate_t *) b)->score;
+    return (x < y) - (x > y);
+}
+
+
+/*****              search             *****/
+
+/*
+ * Genetic search: tournament selection, one-point crossover and per-gene
+ * mutation, keeping the best ELITES candidates unchanged. With
+ * random_only every candidate is drawn afresh instead.
+ */
+static void search(search_t *s, unsigned population, unsigned generations, int random_only,
+                   gene_t *best_genes, double *best_score) {
+    size_t genome = s->num_ops * sizeof(gene_t);
+    candidate_t *pop = calloc(population, sizeof(candidate_t));
+    candidate_t *next = calloc(population, sizeof(candidate_t));
+    for (unsigned i = 0; i < population; ++i) {
+        pop[i].genes = malloc(genome);
+        next[i].genes = malloc(genome);
+        for (unsigned g = 0; g < s->num_ops; ++g)
+            random_gene(s, &pop[i].genes[g]);
+        pop[i].score = evaluate(s, pop[i].genes, NULL).score;
+    }
+    qsort(pop, population, sizeof(candidate_t), by_score_desc);
+    *best_score = pop[0].score;
+    memcpy(best_genes, pop[0].genes, genome);
+
+    for (unsigned gen = 0; gen < generations; ++gen) {
+        for (unsigned i = 0; i < population; ++i) {
+            gene_t *child = next[i].genes;
+            if (random_only) {
+                for (unsigned g = 0; g < s->num_ops; ++g)
+                    random_gene(s, &child[g]);
+            } else if (i < ELITES) {
+                memcpy(child, pop[i].genes, genome);
+                next[i].score = pop[i].score;
+                continue;
+            } else {
+                const candidate_t *a = tournament(s, pop, population);
+                const candidate_t *b = tournament(s, pop, population);
+                unsigned cut = (bench_rng_unit(&s->rng) < CROSSOVER_RATE)
+                               ? (unsigned) bench_rng_range(&s->rng, 0, s->num_ops)
+                               : s->num_ops;
+                memcpy(child, a->genes, cut * sizeof(gene_t));
+                memcpy(child + cut, b->genes + cut, (s->num_ops - cut) * sizeof(gene_t));
+                // on average two mutations per child
+                for (unsigned g = 0; g < s->num_ops; ++g)
+                    if (bench_rng_range(&s->rng, 0, s->num_ops - 1) < 2)
+                        random_gene(s, &child[g]);
+            }
+            next[i].score = evaluate(s, child, NULL).score;
+        }
+
+        candidate_t *tmp = pop;
+        pop = next;
+        next = tmp;
+        qsort(pop, population, sizeof(candidate_t), by_score_desc);
+        if (pop[0].score > *best_score) {
+            *best_score = pop[0].score;
+            memcpy(best_genes, pop[0].genes, genome);
+        }
+        INFO("generation %u: best %g, generation best %g\n", gen + 1, *best_score, pop[0].score);
+    }
+
+    for (unsigned i = 0; i < population; ++i) {
+        free(pop[i].genes);
+        free(next[i].genes);
+    }
+    free(pop);
+    free(next);
+}
+
+
+/*****              main               *****/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --policy first|best          policy under attack (default best)\n"
+            "  --objective gaps|frag|latency\n"
+            "                               peak num_gaps, peak stranded free memory\n"
+            "                               ((free - largest gap) / pool size), or worst op latency\n"
+            "  --search ga|random           genetic or pure random search (default ga)\n"
+            "  --ops N                      ops per candidate sequence\n"
+            "  --pool-size BYTES --max-size BYTES\n"
+            "  --population N --generations N --seed N\n"
+            "  --out FILE                   where to save the worst sequence found\n"
+            "the saved trace replays with: mem_pool_workload --replay FILE\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    search_t s;
+    memset(&s, 0, sizeof(s));
+    s.policy = BEST_FIT;
+    s.obj = OBJ_GAPS;
+    s.num_ops = DEFAULT_OPS;
+    s.pool_size = DEFAULT_POOL_SIZE;
+    s.max_size = DEFAULT_MAX_SIZE;
+    unsigned population = DEFAULT_POPULATION;
+    unsigned generations = DEFAULT_GENERATIONS;
+    unsigned long long seed = 1;
+    int random_only = 0;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[++i] : NULL;
+        int ok = val != NULL;
+
+        if (!ok) ;
+        else if (strcmp(arg, "--policy") == 0) {
+            if      (strcmp(val, "first") == 0) s.policy = FIRST_FIT;
+            else if (strcmp(val, "best") == 0)  s.policy = BEST_FIT;
+            else ok = 0;
+        } else if (strcmp(arg, "--objective") == 0) {
+            ok = 0;
+            for (unsigned o = 0; o < COUNT_OF(OBJECTIVE_NAMES); ++o) {
+                if (strcmp(val, OBJECTIVE_NAMES[o]) == 0) {
+                    s.obj = (objective) o;
+                    ok = 1;
+                }
+            }
+        } else if (strcmp(arg, "--search") == 0) {
+            if      (strcmp(val, "ga") == 0)     random_only = 0;
+            else if (strcmp(val, "random") == 0) random_only = 1;
+            else ok = 0;
+        }
+        else if (strcmp(arg, "--ops") == 0)         s.num_ops = (unsigned) strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--pool-size") == 0)   s.pool_size = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--max-size") == 0)    s.max_size = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--population") == 0)  population = (unsigned) strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--generations") == 0) generations = (unsigned) strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--seed") == 0)        seed = strtoull(val, NULL, 10);
+        else if (strcmp(arg, "--out") == 0)         out_path = val;
+        else ok = 0;
+
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (s.num_ops == 0 || population <= ELITES || s.max_size == 0 || s.max_size > 65535) {
+        usage(argv[0]);
+        return 1;
+    }
+    bench_rng_seed(&s.rng, seed);
+
+    gene_t *best = malloc(s.num_ops * sizeof(gene_t));
+    wl_op_t *ops = calloc(s.num_ops, sizeof(wl_op_t));
+    if (best == NULL || ops == NULL || mem_init() != ALLOC_OK)
+        return 1;
+
+    double best_score = 0;
+    search(&s, population, generations, random_only, best, &best_score);
+
+    // re-run the winner to decode its ops and collect every metric
+    outcome_t result = evaluate(&s, best, ops);
+
+    char default_path[128];
+    if (out_path == NULL) {
+        snprintf(default_path, sizeof(default_path), "adversary_%s_%s.trace",
+                 s.policy == FIRST_FIT ? "ff" : "bf", OBJECTIVE_NAMES[s.obj]);
+        out_path = default_path;
+    }
+    FILE *out = fopen(out_path, "w");
+    if (out == NULL) {
+        perror(out_path);
+    } else {
+        fprintf(out, "# mem_pool_adversary --policy %s --objective %s --search %s --seed %llu\n",
+                s.policy == FIRST_FIT ? "first" : "best", OBJECTIVE_NAMES[s.obj],
+                random_only ? "random" : "ga", seed);
+        fprintf(out, "# policy %s\n", bench_policy_name(s.policy));
+        fprintf(out, "# pool_size %lu\n", (unsigned long) s.pool_size);
+        fprintf(out, "# score %g (peak_gaps %u, peak_stranded %.4f, failed_allocs %lu)\n",
+                best_score, result.peak_gaps, result.peak_stranded, result.failed_allocs);
+        workload_trace_write(out, ops, s.num_ops);
+        fclose(out);
+    }
+
+    bench_json_open(stdout, "mem_pool_adversary");
+    bench_result_t summary = {
+            "adversary", "mem_pool", bench_policy_name(s.policy), OBJECTIVE_NAMES[s.obj], 0, 0, 0
+    };
+    bench_report_begin(&summary);
+    bench_field_str("search", random_only ? "random" : "ga");
+    bench_field_u64("evaluations", s.evaluations);
+    bench_field_u64("ops", s.num_ops);
+    bench_field_u64("pool_size", s.pool_size);
+    bench_field_f64("best_score", best_score);
+    bench_field_u64("peak_gaps", result.peak_gaps);
+    bench_field_f64("peak_stranded", result.peak_stranded);
+    bench_field_u64("max_op_ns", result.max_op_ns);
+    bench_field_u64("failed_allocs", result.failed_allocs);
+    bench_field_str("trace", out_path);
+    bench_report_end();
+    bench_json_close();
+
+    mem_free();
+    free(best);
+    free(ops);
+    return 0;
+}
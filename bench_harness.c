@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench_harness.h"
+#include "perf_counters.h"
+
+
+/*****            constants            *****/
+
+const alloc_policy BENCH_POLICIES[]   = { FIRST_FIT, BEST_FIT };
+const unsigned     BENCH_NUM_POLICIES = sizeof(BENCH_POLICIES) / sizeof(BENCH_POLICIES[0]);
+
+static const double BENCH_PI             = 3.14159265358979323846;
+
+static const size_t SIZE_FIXED_BYTES     = 64;
+static const size_t SIZE_UNIFORM_MIN     = 16;
+static const size_t SIZE_UNIFORM_MAX     = 1024;
+static const double SIZE_LOGNORMAL_MEDIAN = 128.0;
+static const double SIZE_LOGNORMAL_SIGMA  = 1.0;
+static const size_t SIZE_LOGNORMAL_MIN   = 8;
+static const size_t SIZE_LOGNORMAL_MAX   = 65536;
+
+
+/*****         static variables        *****/
+
+static FILE *json_out = NULL;
+static unsigned json_num_results = 0;
+static unsigned json_num_fields = 0;
+
+static perf_counters_t counters;
+static int counters_enabled = 0;
+static perf_sample_t pending_sample;
+static int pending_valid = 0;
+
+
+/*****              timing             *****/
+
+unsigned long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+unsigned bench_counters_init(int enable) {
+    counters_enabled = enable && perf_counters_open(&counters) > 0;
+    if (enable && !counters_enabled)
+        perf_counters_close(&counters);
+    return counters_enabled ? counters.num_available : 0;
+}
+
+void bench_counters_shutdown(void) {
+    if (counters_enabled)
+        perf_counters_close(&counters);
+    counters_enabled = 0;
+    pending_valid = 0;
+}
+
+unsigned long long bench_start(void) {
+    pending_valid = 0;
+    if (counters_enabled)
+        perf_counters_start(&counters);
+    return bench_now_ns();
+}
+
+unsigned long long bench_stop(unsigned long long start) {
+    unsigned long long elapsed = bench_now_ns() - start;
+    if (counters_enabled) {
+        perf_counters_stop(&counters, &pending_sample);
+        pending_valid = 1;
+    }
+    return elapsed;
+}
+
+const char *bench_policy_name(alloc_policy policy) {
+    switch (policy) {
+        case FIRST_FIT: return "FIRST_FIT";
+        case BEST_FIT:  return "BEST_FIT";
+    }
+    return "unknown";
+}
+
+
+/*****        random generation        *****/
+
+void bench_rng_seed(bench_rng_pt rng, uint64_t seed) {
+    // xorshift state must not be zero
+    rng->state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+uint64_t bench_rng_next(bench_rng_pt rng) {
+    // xorshift64*
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+uint64_t bench_rng_range(bench_rng_pt rng, uint64_t lo, uint64_t hi) {
+    return lo + bench_rng_next(rng) % (hi - lo + 1);
+}
+
+double bench_rng_unit(bench_rng_pt rng) {
+    // 53 random bits, shifted off zero
+    return ((double) (bench_rng_next(rng) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+double bench_rng_normal(bench_rng_pt rng) {
+    // Box-Muller, one of the pair is enough here
+    double u1 = bench_rng_unit(rng);
+    double u2 = bench_rng_unit(rng);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * BENCH_PI * u2);
+}
+
+void bench_shuffle(bench_rng_pt rng, unsigned *items, unsigned num_items) {
+    for (unsigned i = num_items; i > 1; --i) {
+        unsigned j = (unsigned) bench_rng_range(rng, 0, i - 1);
+        unsigned tmp = items[i - 1];
+        items[i - 1] = items[j];
+        items[j] = tmp;
+    }
+}
+
+size_t bench_draw_size(bench_rng_pt rng, size_dist dist) {
+    switch (dist) {
+        case SIZE_FIXED:
+            return SIZE_FIXED_BYTES;
+        case SIZE_UNIFORM:
+            return (size_t) bench_rng_range(rng, SIZE_UNIFORM_MIN, SIZE_UNIFORM_MAX);
+        case SIZE_LOGNORMAL: {
+            double size = SIZE_LOGNORMAL_MEDIAN * exp(SIZE_LOGNORMAL_SIGMA * bench_rng_normal(rng));
+            if (size < SIZE_LOGNORMAL_MIN) return SIZE_LOGNORMAL_MIN;
+            if (size > SIZE_LOGNORMAL_MAX) return SIZE_LOGNORMAL_MAX;
+            return (size_t) size;
+        }
+    }
+    return SIZE_FIXED_BYTES;
+}
+
+const char *bench_size_dist_name(size_dist dist) {
+    switch (dist) {
+        case SIZE_FIXED:     return "fixed";
+        case SIZE_UNIFORM:   return "uniform";
+        case SIZE_LOGNORMAL: return "lognormal";
+    }
+    return "unknown";
+}
+
+
+/*****            statistics           *****/
+
+static int compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+void bench_sort_u64(unsigned long long *values, size_t num_values) {
+    qsort(values, num_values, sizeof(unsigned long long), compare_u64);
+}
+
+unsigned long long bench_percentile(const unsigned long long *sorted, size_t num_values, double pct) {
+    if (num_values == 0)
+        return 0;
+    size_t ix = (size_t) (pct / 100.0 * (num_values - 1) + 0.5);
+    return sorted[ix < num_values ? ix : num_values - 1];
+}
+
+double bench_fit_exponent(const double *x, const double *y, unsigned num_points) {
+    // least-squares line through (log x, log y)
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    unsigned n = 0;
+    for (unsigned i = 0; i < num_points; ++i) {
+        if (x[i] <= 0 || y[i] <= 0)
+            continue;
+        double lx = log(x[i]), ly = log(y[i]);
+        sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly;
+        n++;
+    }
+    double den = n * sxx - sx * sx;
+    if (n < 2 || den == 0)
+        return NAN;
+    return (n * sxy - sx * sy) / den;
+}
+
+
+/*****           JSON output           *****/
+
+void bench_json_open(FILE *out, const char *suite) {
+    json_out = out;
+    json_num_results = 0;
+    fprintf(json_out, "{\n  \"suite\": \"%s\",\n  \"perf_counters\": [", suite);
+    for (unsigned e = 0, n = 0; counters_enabled && e < PERF_NUM_EVENTS; ++e) {
+        if (counters.fds[e] >= 0)
+            fprintf(json_out, "%s\"%s\"", n++ ? ", " : "", perf_event_name((perf_event_id) e));
+    }
+    fprintf(json_out, "],\n  \"results\": [");
+}
+
+void bench_json_close(void) {
+    fprintf(json_out, "\n  ]\n}\n");
+    fflush(json_out);
+    json_out = NULL;
+}
+
+void bench_report_begin(const bench_result_t *result) {
+    fprintf(json_out, "%s\n    {", json_num_results ? "," : "");
+    json_num_results++;
+    json_num_fields = 0;
+
+    if (result->name)      bench_field_str("name", result->name);
+    if (result->allocator) bench_field_str("allocator", result->allocator);
+    if (result->policy)    bench_field_str("policy", result->policy);
+    if (result->workload)  bench_field_str("workload", result->workload);
+    if (result->ops) {
+        bench_field_u64("param", result->param);
+        bench_field_u64("ops", result->ops);
+        bench_field_u64("elapsed_ns", result->elapsed_ns);
+        bench_field_f64("ns_per_op", (double) result->elapsed_ns / result->ops);
+        bench_field_f64("ops_per_sec", result->elapsed_ns
+                                       ? 1e9 * result->ops / result->elapsed_ns
+                                       : 0.0);
+    }
+
+    // counters of the last timed region, normalized per operation
+    if (pending_valid && result->ops) {
+        char key[64];
+        for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e) {
+            if (!pending_sample.valid[e])
+                continue;
+            snprintf(key, sizeof(key), "%s_per_op", perf_event_name((perf_event_id) e));
+            bench_field_f64(key, (double) pending_sample.values[e] / result->ops);
+        }
+        if (pending_sample.valid[PERF_CYCLES] && pending_sample.valid[PERF_INSTRUCTIONS]
+            && pending_sample.values[PERF_CYCLES])
+            bench_field_f64("ipc", (double) pending_sample.values[PERF_INSTRUCTIONS] /
+                                   pending_sample.values[PERF_CYCLES]);
+    }
+    pending_valid = 0;
+}
+
+void bench_field_str(const char *key, const char *value) {
+    fprintf(json_out, "%s\"%s\": \"%s\"", json_num_fields++ ? ", " : "", key, value);
+}
+
+void bench_field_u64(const char *key, unsigned long long value) {
+    fprintf(json_out, "%s\"%s\": %llu", json_num_fields++ ? ", " : "", key, value);
+}
+
+void bench_field_f64(const char *key, double value) {
+    // JSON has no NaN/Inf
+    if (isfinite(value))
+        fprintf(json_out, "%s\"%s\": %.6g", json_num_fields++ ? ", " : "", key, value);
+    else
+        fprintf(json_out, "%s\"%s\": null", json_num_fields++ ? ", " : "", key);
+}
+
+void bench_report_end(void) {
+    fprintf(json_out, "}");
+}
+
+void bench_report(const bench_result_t *result) {
+    bench_report_begin(result);
+    bench_report_end();
+}
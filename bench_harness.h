@@ -0,0 +1,137 @@
+//
+// Shared infrastructure for the mem_pool benchmarks:
+// timing, a seeded PRNG, allocation size distributions
+// and the JSON result writer.
+//
+
+#ifndef DENVER_OS_PA_C_BENCH_HARNESS_H
+#define DENVER_OS_PA_C_BENCH_HARNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mem_pool.h"
+
+/* macros */
+
+#define INFO(...)                                     \
+                            fprintf(stderr, "[ bench  ] ");  \
+                            fprintf(stderr, __VA_ARGS__);
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+/* type declarations */
+
+typedef struct _bench_rng {
+    uint64_t state;
+} bench_rng_t, *bench_rng_pt;
+
+typedef enum _size_dist { SIZE_FIXED, SIZE_UNIFORM, SIZE_LOGNORMAL } size_dist;
+
+typedef struct _bench_result {
+    const char *name;           // benchmark family, e.g. "alloc_free"
+    const char *allocator;      // "mem_pool" or "malloc"
+    const char *policy;         // alloc_policy name, "none" for malloc
+    const char *workload;       // size distribution or scenario name
+    unsigned long long param;   // size or scale parameter of the run
+    unsigned long long ops;     // operations timed
+    unsigned long long elapsed_ns;
+} bench_result_t, *bench_result_pt;
+
+/* constants */
+
+extern const alloc_policy BENCH_POLICIES[];
+extern const unsigned     BENCH_NUM_POLICIES;
+
+/* function declarations */
+
+unsigned long long
+bench_now_ns(void);
+
+/*
+ * Timed regions: bench_start() returns the start time and enables the
+ * hardware counters, if any; bench_stop() returns the elapsed time and
+ * keeps the counter readings for the next bench_report(), which emits
+ * them per operation.
+ */
+unsigned
+bench_counters_init(int enable);    // returns the number of usable counters
+
+void
+bench_counters_shutdown(void);
+
+unsigned long long
+bench_start(void);
+
+unsigned long long
+bench_stop(unsigned long long start);
+
+const char *
+bench_policy_name(alloc_policy policy);
+
+void
+bench_rng_seed(bench_rng_pt rng, uint64_t seed);
+
+uint64_t
+bench_rng_next(bench_rng_pt rng);
+
+uint64_t
+bench_rng_range(bench_rng_pt rng, uint64_t lo, uint64_t hi); // inclusive
+
+double
+bench_rng_unit(bench_rng_pt rng); // in (0, 1)
+
+double
+bench_rng_normal(bench_rng_pt rng);
+
+void
+bench_shuffle(bench_rng_pt rng, unsigned *items, unsigned num_items);
+
+size_t
+bench_draw_size(bench_rng_pt rng, size_dist dist);
+
+const char *
+bench_size_dist_name(size_dist dist);
+
+void
+bench_sort_u64(unsigned long long *values, size_t num_values);
+
+unsigned long long
+bench_percentile(const unsigned long long *sorted, size_t num_values, double pct);
+
+double
+bench_fit_exponent(const double *x, const double *y, unsigned num_points); // slope of log y over log x
+
+/*
+ * JSON output: one document per run,
+ *   {"suite": "...", "results": [ {...}, ... ]}
+ * bench_report() writes a complete result; bench_report_begin()
+ * leaves the object open for extra bench_field_*() calls, which
+ * must be followed by bench_report_end().
+ */
+void
+bench_json_open(FILE *out, const char *suite);
+
+void
+bench_json_close(void);
+
+void
+bench_report(const bench_result_t *result);
+
+void
+bench_report_begin(const bench_result_t *result);
+
+void
+bench_field_str(const char *key, const char *value);
+
+void
+bench_field_u64(const char *key, unsigned long long value);
+
+void
+bench_field_f64(const char *key, double value);
+
+void
+bench_report_end(void);
+
+#endif //DENVER_OS_PA_C_BENCH_HARNESS_H
@@ -0,0 +1,7 @@
+#include "bench_suite.h"
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    return run_bench_suite(argc, argv);
+}
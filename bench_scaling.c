@@ -0,0 +1,207 @@
+#include <stdlib.h>
+
+#include "mem_pool.h"
+#include "bench_harness.h"
+#include "bench_suite.h"
+
+
+/*****            constants            *****/
+
+static const size_t   SCALING_CELL_SIZE   = 16;    // checkerboard allocation and gap size
+static const size_t   SCALING_PROBE_SIZE  = 64;    // larger than any cell, fits only the tail
+static const unsigned SCALING_SAMPLES     = 500;   // timed operations per scale and op
+
+static const char *SCALING_OPS[]          = { "mem_new_alloc", "mem_del_alloc", "mem_inspect_pool" };
+#define SCALING_NUM_OPS 3
+#define SCALING_MAX_POINTS 16
+
+
+/*
+ * Complexity scaling.
+ *
+ * For every scale n = 10, 100, ... max_scale a pool is built with the
+ * checkerboard pattern of test_pool_stresstest: 2n cell-sized allocations,
+ * every other one freed, so the pool holds n live allocations and n gaps.
+ * Behind them is a tail gap of 2 probes, which is the only gap the probe
+ * fits in, so every probe allocation has to get past all n cell gaps
+ * (split path) and its deletion merges back into the tail (merge path).
+ *
+ * Each op is timed individually. Per scale the median, p99 and mean
+ * latency are reported, and after the last scale the growth exponent k
+ * of latency ~ n^k is fitted to the medians.
+ *
+ * Building the pool is itself made of the operations being measured, so
+ * with linear scans it costs O(n^2). When the build time of the next scale,
+ * extrapolated from the last two, exceeds the budget, the remaining scales
+ * are reported as skipped.
+ */
+
+typedef struct _scaling_point {
+    double scale;
+    double median_ns[SCALING_NUM_OPS];
+} scaling_point_t;
+
+static pool_pt build_checkerboard(alloc_policy policy, unsigned long gaps, alloc_t **records_out) {
+    unsigned long cells = 2 * gaps;
+    pool_pt pool = mem_pool_open(cells * SCALING_CELL_SIZE + 2 * SCALING_PROBE_SIZE, policy);
+    alloc_t *records = calloc(cells, sizeof(alloc_t));
+    if (pool == NULL || records == NULL) {
+        free(records);
+        if (pool) mem_pool_close(pool);
+        return NULL;
+    }
+
+    for (unsigned long i = 0; i < cells; ++i) {
+        alloc_pt alloc = mem_new_alloc(pool, SCALING_CELL_SIZE);
+        if (alloc == NULL) {
+            INFO("scaling: build failed at cell %lu of %lu\n", i, cells);
+            for (unsigned long j = 0; j < i; ++j)
+                mem_del_alloc(pool, &records[j]);
+            mem_pool_close(pool);
+            free(records);
+            return NULL;
+        }
+        records[i] = *alloc;
+    }
+    for (unsigned long i = 1; i < cells; i += 2) {
+        mem_del_alloc(pool, &records[i]);
+        records[i].mem = NULL;
+    }
+
+    *records_out = records;
+    return pool;
+}
+
+static void teardown_checkerboard(pool_pt pool, alloc_t *records, unsigned long gaps) {
+    for (unsigned long i = 0; i < 2 * gaps; i += 2)
+        mem_del_alloc(pool, &records[i]);
+    mem_pool_close(pool);
+    free(records);
+}
+
+static void report_latency(const char *op, alloc_policy policy, unsigned long scale,
+                           unsigned long long *samples, unsigned num_samples,
+                           unsigned long long build_ns) {
+    unsigned long long total = 0;
+    for (unsigned i = 0; i < num_samples; ++i)
+        total += samples[i];
+    bench_sort_u64(samples, num_samples);
+
+    bench_result_t result = {
+            "scaling", "mem_pool", bench_policy_name(policy), op,
+            scale, num_samples, total
+    };
+    bench_report_begin(&result);
+    bench_field_u64("p50_ns", bench_percentile(samples, num_samples, 50));
+    bench_field_u64("p99_ns", bench_percentile(samples, num_samples, 99));
+    bench_field_u64("max_ns", samples[num_samples - 1]);
+    bench_field_u64("build_ns", build_ns);
+    bench_report_end();
+}
+
+static void scaling_policy(const bench_options_t *opts, alloc_policy policy) {
+    unsigned samples_per_op = bench_scaled(opts, SCALING_SAMPLES);
+    unsigned long long *samples = calloc(samples_per_op, sizeof(unsigned long long));
+    scaling_point_t points[SCALING_MAX_POINTS];
+    unsigned num_points = 0;
+    unsigned long long prev_build_ns = 0, last_build_ns = 0;
+    unsigned long long budget_ns = (unsigned long long) (opts->budget_sec * 1e9);
+
+    if (samples == NULL)
+        return;
+
+    for (unsigned long scale = 10; scale <= opts->max_scale && num_points < SCALING_MAX_POINTS; scale *= 10) {
+        // extrapolate the build time from the growth between the last two scales
+        if (prev_build_ns && last_build_ns) {
+            double growth = (double) last_build_ns / prev_build_ns;
+            if (last_build_ns * growth > budget_ns) {
+                bench_result_t result = { "scaling", "mem_pool", bench_policy_name(policy), "skipped", 0, 0, 0 };
+                bench_report_begin(&result);
+                bench_field_u64("param", scale);
+                bench_field_f64("predicted_build_sec", last_build_ns * growth / 1e9);
+                bench_report_end();
+                INFO("scaling: %s skipping %lu gaps and above (over budget)\n", bench_policy_name(policy), scale);
+                break;
+            }
+        }
+
+        alloc_t *records = NULL;
+        unsigned long long start = bench_now_ns();
+        pool_pt pool = build_checkerboard(policy, scale, &records);
+        unsigned long long build_ns = bench_now_ns() - start;
+        if (pool == NULL)
+            break;
+        prev_build_ns = last_build_ns;
+        last_build_ns = build_ns;
+
+        scaling_point_t *point = &points[num_points++];
+        point->scale = scale;
+
+        // new and del are measured in pairs, so the pool returns to the same state
+        unsigned long long *del_samples = calloc(samples_per_op, sizeof(unsigned long long));
+        unsigned num_samples = 0;
+        if (del_samples) {
+            for (; num_samples < samples_per_op; ++num_samples) {
+                unsigned long long t0 = bench_now_ns();
+                alloc_pt alloc = mem_new_alloc(pool, SCALING_PROBE_SIZE);
+                unsigned long long t1 = bench_now_ns();
+                if (alloc == NULL)
+                    break;
+                alloc_t record = *alloc;
+                unsigned long long t2 = bench_now_ns();
+                mem_del_alloc(pool, &record);
+                unsigned long long t3 = bench_now_ns();
+                samples[num_samples] = t1 - t0;
+                del_samples[num_samples] = t3 - t2;
+            }
+        }
+        if (num_samples) {
+            report_latency(SCALING_OPS[0], policy, scale, samples, num_samples, build_ns);
+            point->median_ns[0] = (double) bench_percentile(samples, num_samples, 50);
+            report_latency(SCALING_OPS[1], policy, scale, del_samples, num_samples, build_ns);
+            point->median_ns[1] = (double) bench_percentile(del_samples, num_samples, 50);
+        } else {
+            point->median_ns[0] = point->median_ns[1] = 0;
+        }
+        free(del_samples);
+
+        // inspection cost grows with n by design; keep its sample count inside the budget
+        unsigned inspect_samples = samples_per_op;
+        for (num_samples = 0; num_samples < inspect_samples; ++num_samples) {
+            pool_segment_pt segs = NULL;
+            unsigned num_segs = 0;
+            unsigned long long t0 = bench_now_ns();
+            mem_inspect_pool(pool, &segs, &num_segs);
+            unsigned long long t1 = bench_now_ns();
+            free(segs);
+            samples[num_samples] = t1 - t0;
+            if (num_samples == 0 && samples[0] * inspect_samples > budget_ns)
+                inspect_samples = (unsigned) (budget_ns / (samples[0] ? samples[0] : 1)) + 1;
+        }
+        report_latency(SCALING_OPS[2], policy, scale, samples, num_samples, build_ns);
+        point->median_ns[2] = (double) bench_percentile(samples, num_samples, 50);
+
+        teardown_checkerboard(pool, records, scale);
+    }
+
+    double x[SCALING_MAX_POINTS], y[SCALING_MAX_POINTS];
+    for (unsigned op = 0; op < SCALING_NUM_OPS; ++op) {
+        for (unsigned p = 0; p < num_points; ++p) {
+            x[p] = points[p].scale;
+            y[p] = points[p].median_ns[op];
+        }
+        bench_result_t result = { "scaling_fit", "mem_pool", bench_policy_name(policy), SCALING_OPS[op], 0, 0, 0 };
+        bench_report_begin(&result);
+        bench_field_u64("points", num_points);
+        bench_field_u64("max_scale", num_points ? (unsigned long long) points[num_points - 1].scale : 0);
+        bench_field_f64("exponent", bench_fit_exponent(x, y, num_points));
+        bench_report_end();
+    }
+
+    free(samples);
+}
+
+void bench_scaling(const bench_options_t *opts) {
+    for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p)
+        scaling_policy(opts, BENCH_POLICIES[p]);
+}
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "bench_harness.h"
+#include "bench_suite.h"
+
+
+/*****            constants            *****/
+
+static const unsigned ALLOC_FREE_LIVE     = 256;       // allocations per round
+static const unsigned ALLOC_FREE_ROUNDS   = 200;
+static const size_t   ALLOC_FREE_POOL     = 32 << 20;  // fits 256 x max lognormal size
+
+static const size_t   OPEN_CLOSE_SIZES[]  = { 4 << 10, 1 << 20, 16 << 20 };
+static const unsigned OPEN_CLOSE_ITERS[]  = { 20000,   2000,    200 };
+static const unsigned CHURN_LIVE_POOLS[]  = { 16, 256, 4096 };
+static const unsigned CHURN_ITERS         = 50000;
+static const size_t   CHURN_POOL_SIZE     = 4 << 10;
+
+static const unsigned INSPECT_SEGMENTS[]  = { 16, 256, 4096 };
+static const unsigned INSPECT_CALLS       = 20000;     // divided by segments / 16
+static const size_t   INSPECT_ALLOC_SIZE  = 64;
+
+static const size_dist SIZE_DISTS[]       = { SIZE_FIXED, SIZE_UNIFORM, SIZE_LOGNORMAL };
+
+
+/*****         helper routines         *****/
+
+unsigned bench_scaled(const bench_options_t *opts, unsigned count) {
+    unsigned n = count / opts->scale_div;
+    return n ? n : 1;
+}
+
+int bench_selected(const bench_options_t *opts, const char *name) {
+    return opts->filter == NULL || strstr(name, opts->filter) != NULL;
+}
+
+
+/*******************************************/
+/***       1. ALLOC/FREE THROUGHPUT      ***/
+/*******************************************/
+
+/*
+ * Every round allocates ALLOC_FREE_LIVE blocks with sizes drawn from
+ * the distribution, then frees them in shuffled order. Sizes and free
+ * order are generated up front so that every allocator replays exactly
+ * the same sequence.
+ *
+ * NOTE: the alloc_pt returned by mem_new_alloc points into the node heap,
+ * which moves when the heap is resized, so the benchmark keeps a copy of
+ * the allocation record and hands that back to mem_del_alloc.
+ */
+
+static void bench_alloc_free_pool(size_dist dist, alloc_policy policy,
+                                  const size_t *sizes, const unsigned *order, unsigned rounds) {
+    alloc_t *records = calloc(ALLOC_FREE_LIVE, sizeof(alloc_t));
+    pool_pt pool = mem_pool_open(ALLOC_FREE_POOL, policy);
+    if (records == NULL || pool == NULL) {
+        INFO("alloc_free: setup failed for %s\n", bench_policy_name(policy));
+        free(records);
+        if (pool) mem_pool_close(pool);
+        return;
+    }
+
+    unsigned long long ops = 0;
+    unsigned long long start = bench_start();
+    for (unsigned r = 0; r < rounds; ++r) {
+        const size_t *round_sizes = sizes + (size_t) r * ALLOC_FREE_LIVE;
+        const unsigned *round_order = order + (size_t) r * ALLOC_FREE_LIVE;
+        for (unsigned i = 0; i < ALLOC_FREE_LIVE; ++i) {
+            alloc_pt alloc = mem_new_alloc(pool, round_sizes[i]);
+            if (alloc == NULL) {
+                records[i].mem = NULL;
+                continue;
+            }
+            records[i] = *alloc;
+            ops++;
+        }
+        for (unsigned i = 0; i < ALLOC_FREE_LIVE; ++i) {
+            alloc_pt record = &records[round_order[i]];
+            if (record->mem == NULL)
+                continue;
+            mem_del_alloc(pool, record);
+            ops++;
+        }
+    }
+    unsigned long long elapsed = bench_stop(start);
+
+    bench_result_t result = {
+            "alloc_free", "mem_pool", bench_policy_name(policy), bench_size_dist_name(dist),
+            ALLOC_FREE_LIVE, ops, elapsed
+    };
+    bench_report(&result);
+
+    mem_pool_close(pool);
+    free(records);
+}
+
+static void bench_alloc_free_malloc(size_dist dist,
+                                    const size_t *sizes, const unsigned *order, unsigned rounds) {
+    void **blocks = calloc(ALLOC_FREE_LIVE, sizeof(void *));
+    if (blocks == NULL)
+        return;
+
+    unsigned long long ops = 0;
+    unsigned long long start = bench_start();
+    for (unsigned r = 0; r < rounds; ++r) {
+        const size_t *round_sizes = sizes + (size_t) r * ALLOC_FREE_LIVE;
+        const unsigned *round_order = order + (size_t) r * ALLOC_FREE_LIVE;
+        for (unsigned i = 0; i < ALLOC_FREE_LIVE; ++i) {
+            blocks[i] = malloc(round_sizes[i]);
+            ops++;
+        }
+        for (unsigned i = 0; i < ALLOC_FREE_LIVE; ++i) {
+            free(blocks[round_order[i]]);
+            ops++;
+        }
+    }
+    unsigned long long elapsed = bench_stop(start);
+
+    bench_result_t result = {
+            "alloc_free", "malloc", "none", bench_size_dist_name(dist),
+            ALLOC_FREE_LIVE, ops, elapsed
+    };
+    bench_report(&result);
+
+    free(blocks);
+}
+
+static void bench_alloc_free(const bench_options_t *opts) {
+    unsigned rounds = bench_scaled(opts, ALLOC_FREE_ROUNDS);
+    size_t total = (size_t) rounds * ALLOC_FREE_LIVE;
+    size_t *sizes = calloc(total, sizeof(size_t));
+    unsigned *order = calloc(total, sizeof(unsigned));
+    if (sizes == NULL || order == NULL) {
+        free(sizes);
+        free(order);
+        return;
+    }
+
+    for (unsigned d = 0; d < COUNT_OF(SIZE_DISTS); ++d) {
+        bench_rng_t rng;
+        bench_rng_seed(&rng, BENCH_SEED + d);
+        for (size_t i = 0; i < total; ++i)
+            sizes[i] = bench_draw_size(&rng, SIZE_DISTS[d]);
+        for (unsigned r = 0; r < rounds; ++r) {
+            unsigned *round_order = order + (size_t) r * ALLOC_FREE_LIVE;
+            for (unsigned i = 0; i < ALLOC_FREE_LIVE; ++i)
+                round_order[i] = i;
+            bench_shuffle(&rng, round_order, ALLOC_FREE_LIVE);
+        }
+
+        for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p)
+            bench_alloc_free_pool(SIZE_DISTS[d], BENCH_POLICIES[p], sizes, order, rounds);
+        bench_alloc_free_malloc(SIZE_DISTS[d], sizes, order, rounds);
+    }
+
+    free(sizes);
+    free(order);
+}
+
+
+/*******************************************/
+/***        2. POOL OPEN/CLOSE COST      ***/
+/*******************************************/
+
+/*
+ * Short-lived pools among long-lived ones: `live` pools stay open, and
+ * every iteration closes a random one and opens its replacement, so
+ * the cost of a close against a large pool store shows up.
+ */
+
+static void bench_open_close_churn(const bench_options_t *opts) {
+    unsigned iters = bench_scaled(opts, CHURN_ITERS);
+
+    for (unsigned l = 0; l < COUNT_OF(CHURN_LIVE_POOLS); ++l) {
+        unsigned live = CHURN_LIVE_POOLS[l];
+        pool_pt *pools = calloc(live, sizeof(pool_pt));
+        if (pools == NULL)
+            continue;
+        for (unsigned i = 0; i < live; ++i)
+            pools[i] = mem_pool_open(CHURN_POOL_SIZE, FIRST_FIT);
+
+        unsigned long long ops = 0;
+        unsigned seed = 1;
+        unsigned long long start = bench_start();
+        for (unsigned i = 0; i < iters; ++i) {
+            seed = seed * 1103515245 + 12345;
+            unsigned victim = (seed >> 8) % live;
+            if (pools[victim]) mem_pool_close(pools[victim]);
+            pools[victim] = mem_pool_open(CHURN_POOL_SIZE, FIRST_FIT);
+            ops++;
+        }
+        unsigned long long elapsed = bench_stop(start);
+
+        bench_result_t result = {
+                "open_close_churn", "mem_pool", bench_policy_name(FIRST_FIT), "churn",
+                live, ops, elapsed
+        };
+        bench_report(&result);
+
+        for (unsigned i = 0; i < live; ++i)
+            if (pools[i]) mem_pool_close(pools[i]);
+        free(pools);
+    }
+}
+
+static void bench_open_close(const bench_options_t *opts) {
+    for (unsigned s = 0; s < COUNT_OF(OPEN_CLOSE_SIZES); ++s) {
+        size_t size = OPEN_CLOSE_SIZES[s];
+        unsigned iters = bench_scaled(opts, OPEN_CLOSE_ITERS[s]);
+
+        for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p) {
+            unsigned long long ops = 0;
+            unsigned long long start = bench_start();
+            for (unsigned i = 0; i < iters; ++i) {
+                pool_pt pool = mem_pool_open(size, BENCH_POLICIES[p]);
+                if (pool == NULL)
+                    break;
+                mem_pool_close(pool);
+                ops++;
+            }
+            unsigned long long elapsed = bench_stop(start);
+
+            bench_result_t result = {
+                    "open_close", "mem_pool", bench_policy_name(BENCH_POLICIES[p]), "empty",
+                    size, ops, elapsed
+            };
+            bench_report(&result);
+        }
+
+        // the malloc counterpart of a pool is one zeroed block
+        unsigned long long ops = 0;
+        unsigned long long start = bench_start();
+        for (unsigned i = 0; i < iters; ++i) {
+            char *mem = calloc(size, sizeof(char));
+            if (mem == NULL)
+                break;
+            free(mem);
+            ops++;
+        }
+        unsigned long long elapsed = bench_stop(start);
+
+        bench_result_t result = {
+                "open_close", "malloc", "none", "empty",
+                size, ops, elapsed
+        };
+        bench_report(&result);
+    }
+
+    bench_open_close_churn(opts);
+}
+
+
+/*******************************************/
+/***       3. POOL INSPECTION COST       ***/
+/*******************************************/
+
+/*
+ * The pool is filled with `segments` equal allocations and every other
+ * one is freed, as in test_pool_stresstest, giving `segments` segments
+ * of alternating type.
+ * There is no malloc counterpart.
+ */
+
+static void bench_inspect(const bench_options_t *opts) {
+    for (unsigned s = 0; s < COUNT_OF(INSPECT_SEGMENTS); ++s) {
+        unsigned segments = INSPECT_SEGMENTS[s];
+        unsigned calls = bench_scaled(opts, INSPECT_CALLS / (segments / 16));
+
+        for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p) {
+            pool_pt pool = mem_pool_open(segments * INSPECT_ALLOC_SIZE, BENCH_POLICIES[p]);
+            alloc_t *records = calloc(segments, sizeof(alloc_t));
+            if (pool == NULL || records == NULL) {
+                free(records);
+                if (pool) mem_pool_close(pool);
+                continue;
+            }
+
+            // fill the pool completely, then free the odd allocations
+            for (unsigned i = 0; i < segments; ++i) {
+                alloc_pt alloc = mem_new_alloc(pool, INSPECT_ALLOC_SIZE);
+                if (alloc) records[i] = *alloc;
+            }
+            for (unsigned i = 1; i < segments; i += 2)
+                if (records[i].mem) mem_del_alloc(pool, &records[i]);
+
+            unsigned long long ops = 0;
+            unsigned long long start = bench_start();
+            for (unsigned i = 0; i < calls; ++i) {
+                pool_segment_pt segs = NULL;
+                unsigned num_segs = 0;
+                mem_inspect_pool(pool, &segs, &num_segs);
+                free(segs);
+                ops++;
+            }
+            unsigned long long elapsed = bench_stop(start);
+
+            bench_result_t result = {
+                    "inspect", "mem_pool", bench_policy_name(BENCH_POLICIES[p]), "checkerboard",
+                    segments, ops, elapsed
+            };
+            bench_report(&result);
+
+            // the same walk through the non-allocating iterator
+            start = bench_start();
+            for (unsigned i = 0; i < calls; ++i) {
+                pool_segment_iter_t iter;
+                pool_segment_t seg;
+                mem_segment_iter_init(pool, &iter, 0, 0);
+                while (mem_segment_iter_next(&iter, &seg))
+                    ;
+            }
+            elapsed = bench_stop(start);
+
+            result.name = "inspect_iter";
+            result.elapsed_ns = elapsed;
+            bench_report(&result);
+
+            for (unsigned i = 0; i < segments; i += 2)
+                if (records[i].mem) mem_del_alloc(pool, &records[i]);
+            mem_pool_close(pool);
+            free(records);
+        }
+    }
+}
+
+
+/*******************************************/
+/***          4. DRIVER ROUTINE          ***/
+/*******************************************/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--quick] [--filter NAME] [--max-scale N] [--budget SEC] [--threads N]\n"
+            "          [--no-counters]\n"
+            "  --quick        run a tenth of the default iterations\n"
+            "  --filter NAME  run only benchmarks whose name contains NAME\n"
+            "  --max-scale N  largest gap count for the scaling benchmarks\n"
+            "  --budget SEC   time budget per scale for the scaling benchmarks\n"
+            "  --threads N    largest thread count for the threads benchmark (default: CPUs)\n"
+            "  --no-counters  do not read hardware performance counters\n"
+            "results are written to stdout as JSON\n", prog);
+}
+
+int run_bench_suite(int argc, char *argv[]) {
+    bench_options_t opts = { 1, NULL, BENCH_MAX_SCALE, BENCH_SCALE_BUDGET_SEC, 0 };
+    int counters = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            opts.scale_div = 10;
+        } else if (strcmp(argv[i], "--no-counters") == 0) {
+            counters = 0;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            opts.filter = argv[++i];
+        } else if (strcmp(argv[i], "--max-scale") == 0 && i + 1 < argc) {
+            opts.max_scale = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opts.max_threads = (unsigned) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            opts.budget_sec = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const struct {
+        const char *name;
+        void (*run)(const bench_options_t *opts);
+    } benches[] = {
+            { "alloc_free", bench_alloc_free },
+            { "open_close", bench_open_close },
+            { "inspect",    bench_inspect },
+            { "scaling",    bench_scaling },
+            { "threads",    bench_threads },
+    };
+
+    if (mem_init() != ALLOC_OK) {
+        INFO("mem_init failed\n");
+        return 1;
+    }
+
+    if (counters && bench_counters_init(1) == 0) {
+        INFO("hardware performance counters unavailable, reporting wall time only\n");
+    }
+
+    bench_json_open(stdout, "mem_pool_bench");
+    for (unsigned b = 0; b < COUNT_OF(benches); ++b) {
+        if (!bench_selected(&opts, benches[b].name))
+            continue;
+        INFO("running %s\n", benches[b].name);
+        benches[b].run(&opts);
+    }
+    bench_json_close();
+    bench_counters_shutdown();
+
+    mem_free();
+    return 0;
+}
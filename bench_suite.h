@@ -0,0 +1,32 @@
+//
+// mem_pool benchmark suite: see bench_suite.c for the benchmarks
+// and run_bench_suite() for the command line.
+//
+
+#ifndef DENVER_OS_PA_C_BENCH_SUITE_H
+#define DENVER_OS_PA_C_BENCH_SUITE_H
+
+#define BENCH_SEED              20160303ULL
+#define BENCH_MAX_SCALE         1000000
+#define BENCH_SCALE_BUDGET_SEC  10.0
+
+typedef struct _bench_options {
+    unsigned scale_div;     // divides iteration counts, 10 with --quick
+    const char *filter;     // run only benchmarks whose name contains this
+    unsigned long max_scale;    // largest gap count for the scaling benchmarks
+    double budget_sec;          // time budget per scale for the scaling benchmarks
+    unsigned max_threads;       // largest thread count, 0 for the number of CPUs
+} bench_options_t, *bench_options_pt;
+
+int bench_selected(const bench_options_t *opts, const char *name);
+
+unsigned bench_scaled(const bench_options_t *opts, unsigned count);
+
+/* benchmarks living outside bench_suite.c */
+
+void bench_scaling(const bench_options_t *opts);    // bench_scaling.c
+void bench_threads(const bench_options_t *opts);    // bench_threads.c
+
+int run_bench_suite(int argc, char *argv[]);
+
+#endif //DENVER_OS_PA_C_BENCH_SUITE_H
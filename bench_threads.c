@@ -0,0 +1,358 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mem_pool.h"
+#include "bench_harness.h"
+#include "bench_suite.h"
+
+
+/*****            constants            *****/
+
+static const unsigned THREADS_OPS_PER_THREAD = 20000;  // alloc + free operations
+static const unsigned THREADS_LIVE_PER_THREAD = 64;    // ring of live allocations per thread
+static const size_t   THREADS_MAX_ALLOC      = 1024;   // upper end of SIZE_UNIFORM
+static const unsigned THREADS_RING_CAPACITY  = 256;    // producer/consumer hand-off queue
+static const unsigned THREADS_MONITOR_SEGS   = 4096;   // segment buffer of the monitor thread
+
+typedef enum _thread_mode {
+    MODE_SHARED, MODE_PER_THREAD, MODE_PRODUCER_CONSUMER, MODE_SHARED_MONITORED
+} thread_mode;
+
+static const char *MODE_NAMES[] = { "shared", "per_thread", "producer_consumer", "shared_monitored" };
+
+
+/*
+ * Multi-threaded scaling.
+ *
+ * The library is not thread-safe (pool internals and the pool store are
+ * unsynchronized), so the modes measure what callers have to do today:
+ *
+ *   shared             1..N threads, one pool behind a mutex
+ *   per_thread         1..N threads, one pool each, opened up front since
+ *                      mem_pool_open touches the global pool store
+ *   producer_consumer  N/2 producer/consumer pairs on one mutex-protected
+ *                      pool; producers allocate, hand the record over an
+ *                      SPSC ring, and consumers free it
+ *   shared_monitored   as shared, plus a monitor thread that reads the pool
+ *                      stats and segments back to back without the lock,
+ *                      through mem_read_pool and mem_read_segments
+ *
+ * Every operation is timed, lock wait included, for the tail latencies.
+ * Scaling efficiency is throughput relative to the smallest thread count
+ * of the same mode, divided by the thread ratio.
+ */
+
+typedef struct _ring {
+    alloc_t *slots;
+    _Atomic unsigned head;      // next slot to pop, owned by the consumer
+    _Atomic unsigned tail;      // next slot to push, owned by the producer
+} ring_t, *ring_pt;
+
+typedef struct _worker {
+    pthread_t thread;
+    unsigned index;
+    thread_mode mode;
+    pool_pt pool;
+    pthread_mutex_t *lock;      // NULL for per_thread
+    ring_pt ring;               // producer/consumer only
+    int producer;
+    unsigned ops;
+    _Atomic int *go;            // released by the main thread to start the clock
+    unsigned long long *latencies;
+    unsigned num_latencies;
+} worker_t, *worker_pt;
+
+typedef struct _monitor {
+    pthread_t thread;
+    pool_pt pool;
+    _Atomic int stop;
+    unsigned long reads;        // consistent stats + segments reads
+    unsigned long failed;       // reads that gave up retrying
+} monitor_t, *monitor_pt;
+
+
+/*****         helper routines         *****/
+
+static alloc_pt locked_new(worker_pt w, size_t size, alloc_t *record) {
+    if (w->lock) pthread_mutex_lock(w->lock);
+    alloc_pt alloc = mem_new_alloc(w->pool, size);
+    // copy under the lock: the record moves when another thread grows the node heap
+    if (alloc) *record = *alloc;
+    if (w->lock) pthread_mutex_unlock(w->lock);
+    return alloc;
+}
+
+static void locked_del(worker_pt w, alloc_t *record) {
+    if (w->lock) pthread_mutex_lock(w->lock);
+    mem_del_alloc(w->pool, record);
+    if (w->lock) pthread_mutex_unlock(w->lock);
+}
+
+static void record_latency(worker_pt w, unsigned long long t0) {
+    if (w->num_latencies < w->ops)
+        w->latencies[w->num_latencies++] = bench_now_ns() - t0;
+}
+
+static void wait_for_start(worker_pt w) {
+    while (!atomic_load_explicit(w->go, memory_order_acquire))
+        sched_yield();
+}
+
+static void *run_churn(worker_pt w) {
+    alloc_t *live = calloc(THREADS_LIVE_PER_THREAD, sizeof(alloc_t));
+    bench_rng_t rng;
+    bench_rng_seed(&rng, BENCH_SEED + w->index);
+    if (live == NULL)
+        return NULL;
+
+    // steady state: each slot is freed and immediately refilled
+    wait_for_start(w);
+    for (unsigned op = 0, next = 0; op < w->ops; ) {
+        alloc_t *slot = &live[next++ % THREADS_LIVE_PER_THREAD];
+        unsigned long long t0;
+        if (slot->mem) {
+            t0 = bench_now_ns();
+            locked_del(w, slot);
+            record_latency(w, t0);
+            slot->mem = NULL;
+            if (++op == w->ops)
+                break;
+        }
+        t0 = bench_now_ns();
+        locked_new(w, bench_draw_size(&rng, SIZE_UNIFORM), slot);
+        record_latency(w, t0);
+        op++;
+    }
+    for (unsigned i = 0; i < THREADS_LIVE_PER_THREAD; ++i)
+        if (live[i].mem) locked_del(w, &live[i]);
+
+    free(live);
+    return NULL;
+}
+
+static void *run_producer(worker_pt w) {
+    ring_pt ring = w->ring;
+    bench_rng_t rng;
+    bench_rng_seed(&rng, BENCH_SEED + w->index);
+
+    wait_for_start(w);
+    for (unsigned op = 0; op < w->ops; ++op) {
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= THREADS_RING_CAPACITY)
+            sched_yield();
+
+        alloc_t record = { 0, NULL };
+        unsigned long long t0 = bench_now_ns();
+        locked_new(w, bench_draw_size(&rng, SIZE_UNIFORM), &record);
+        record_latency(w, t0);
+
+        // failed allocations are still handed over, so both sides agree on the count
+        ring->slots[tail % THREADS_RING_CAPACITY] = record;
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void *run_consumer(worker_pt w) {
+    ring_pt ring = w->ring;
+
+    wait_for_start(w);
+    for (unsigned op = 0; op < w->ops; ++op) {
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+            sched_yield();
+
+        alloc_t record = ring->slots[head % THREADS_RING_CAPACITY];
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+        if (record.mem == NULL)
+            continue;
+        unsigned long long t0 = bench_now_ns();
+        locked_del(w, &record);
+        record_latency(w, t0);
+    }
+    return NULL;
+}
+
+static void *monitor_main(void *arg) {
+    monitor_pt m = (monitor_pt) arg;
+    pool_segment_pt segs = calloc(THREADS_MONITOR_SEGS, sizeof(pool_segment_t));
+    if (segs == NULL)
+        return NULL;
+
+    while (!atomic_load_explicit(&m->stop, memory_order_acquire)) {
+        pool_t stats;
+        unsigned num_segs = 0;
+        if (mem_read_pool(m->pool, &stats) == ALLOC_OK
+            && mem_read_segments(m->pool, segs, THREADS_MONITOR_SEGS, &num_segs) == ALLOC_OK)
+            m->reads++;
+        else
+            m->failed++;
+    }
+    free(segs);
+    return NULL;
+}
+
+static void *worker_main(void *arg) {
+    worker_pt w = (worker_pt) arg;
+    if (w->mode != MODE_PRODUCER_CONSUMER)
+        return run_churn(w);
+    return w->producer ? run_producer(w) : run_consumer(w);
+}
+
+
+/*****           benchmark             *****/
+
+/* returns ops/sec, 0 if the run could not be set up */
+static double run_mode(const bench_options_t *opts, thread_mode mode, alloc_policy policy,
+                       unsigned num_threads, double base_rate, unsigned base_threads) {
+    unsigned ops = bench_scaled(opts, THREADS_OPS_PER_THREAD);
+    unsigned num_pools = (mode == MODE_PER_THREAD) ? num_threads : 1;
+    unsigned num_rings = (mode == MODE_PRODUCER_CONSUMER) ? num_threads / 2 : 0;
+    size_t pool_size = (mode == MODE_PRODUCER_CONSUMER)
+                       ? 2 * (size_t) num_rings * (THREADS_RING_CAPACITY + 1) * THREADS_MAX_ALLOC
+                       : 2 * (size_t) (num_threads / num_pools) * THREADS_LIVE_PER_THREAD * THREADS_MAX_ALLOC;
+    double rate = 0;
+
+    worker_pt workers = calloc(num_threads, sizeof(worker_t));
+    pool_pt *pools = calloc(num_pools, sizeof(pool_pt));
+    ring_pt rings = calloc(num_rings ? num_rings : 1, sizeof(ring_t));
+    unsigned long long *latencies = calloc((size_t) num_threads * ops, sizeof(unsigned long long));
+    pthread_mutex_t lock;
+    _Atomic int go;
+    monitor_t monitor;
+    int monitored = 0;
+    if (workers == NULL || pools == NULL || rings == NULL || latencies == NULL)
+        goto out;
+
+    pthread_mutex_init(&lock, NULL);
+    atomic_init(&go, 0);
+
+    for (unsigned p = 0; p < num_pools; ++p) {
+        pools[p] = mem_pool_open(pool_size, policy);
+        if (pools[p] == NULL)
+            goto out_pools;
+    }
+    for (unsigned r = 0; r < num_rings; ++r) {
+        rings[r].slots = calloc(THREADS_RING_CAPACITY, sizeof(alloc_t));
+        atomic_init(&rings[r].head, 0);
+        atomic_init(&rings[r].tail, 0);
+        if (rings[r].slots == NULL)
+            goto out_pools;
+    }
+
+    for (unsigned t = 0; t < num_threads; ++t) {
+        worker_pt w = &workers[t];
+        w->index = t;
+        w->mode = mode;
+        w->pool = pools[mode == MODE_PER_THREAD ? t : 0];
+        w->lock = (mode == MODE_PER_THREAD) ? NULL : &lock;
+        w->ring = num_rings ? &rings[t / 2] : NULL;
+        w->producer = (t % 2 == 0);
+        w->ops = ops;
+        w->go = &go;
+        w->latencies = latencies + (size_t) t * ops;
+    }
+
+    unsigned started = 0;
+    for (; started < num_threads; ++started)
+        if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0)
+            break;
+    if (started < num_threads) {
+        // release the started threads with nothing to do
+        INFO("threads: could only start %u of %u threads\n", started, num_threads);
+        for (unsigned t = 0; t < started; ++t)
+            workers[t].ops = 0;
+        atomic_store_explicit(&go, 1, memory_order_release);
+        for (unsigned t = 0; t < started; ++t)
+            pthread_join(workers[t].thread, NULL);
+        goto out_pools;
+    }
+
+    if (mode == MODE_SHARED_MONITORED) {
+        monitor.pool = pools[0];
+        monitor.reads = monitor.failed = 0;
+        atomic_init(&monitor.stop, 0);
+        monitored = pthread_create(&monitor.thread, NULL, monitor_main, &monitor) == 0;
+    }
+
+    unsigned long long start = bench_now_ns();
+    atomic_store_explicit(&go, 1, memory_order_release);
+    for (unsigned t = 0; t < num_threads; ++t)
+        pthread_join(workers[t].thread, NULL);
+    unsigned long long elapsed = bench_now_ns() - start;
+
+    if (monitored) {
+        atomic_store_explicit(&monitor.stop, 1, memory_order_release);
+        pthread_join(monitor.thread, NULL);
+    }
+
+    // gather latencies of all threads
+    size_t num_samples = 0;
+    for (unsigned t = 0; t < num_threads; ++t) {
+        for (unsigned i = 0; i < workers[t].num_latencies; ++i)
+            latencies[num_samples++] = workers[t].latencies[i];
+    }
+    bench_sort_u64(latencies, num_samples);
+
+    unsigned long long total_ops = (unsigned long long) num_threads * ops;
+    rate = elapsed ? 1e9 * total_ops / elapsed : 0;
+
+    bench_result_t result = {
+            "threads", "mem_pool", bench_policy_name(policy), MODE_NAMES[mode],
+            num_threads, total_ops, elapsed
+    };
+    bench_report_begin(&result);
+    bench_field_u64("threads", num_threads);
+    bench_field_f64("scaling_efficiency", base_rate > 0
+                                          ? rate / (base_rate * num_threads / base_threads)
+                                          : 1.0);
+    bench_field_u64("p50_ns", bench_percentile(latencies, num_samples, 50));
+    bench_field_u64("p99_ns", bench_percentile(latencies, num_samples, 99));
+    bench_field_u64("p999_ns", bench_percentile(latencies, num_samples, 99.9));
+    bench_field_u64("max_ns", num_samples ? latencies[num_samples - 1] : 0);
+    if (monitored) {
+        bench_field_u64("monitor_reads", monitor.reads);
+        bench_field_u64("monitor_failed", monitor.failed);
+    }
+    bench_report_end();
+
+out_pools:
+    for (unsigned p = 0; p < num_pools; ++p)
+        if (pools[p]) mem_pool_close(pools[p]);
+    for (unsigned r = 0; r < num_rings; ++r)
+        free(rings[r].slots);
+    pthread_mutex_destroy(&lock);
+out:
+    free(workers);
+    free(pools);
+    free(rings);
+    free(latencies);
+    return rate;
+}
+
+void bench_threads(const bench_options_t *opts) {
+    unsigned max_threads = opts->max_threads;
+    if (max_threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = online > 0 ? (unsigned) online : 1;
+    }
+
+    for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p) {
+        for (unsigned m = 0; m < COUNT_OF(MODE_NAMES); ++m) {
+            thread_mode mode = (thread_mode) m;
+            unsigned first = (mode == MODE_PRODUCER_CONSUMER) ? 2 : 1;
+            double base_rate = 0;
+            for (unsigned t = first; t <= max_threads; t *= 2) {
+                double rate = run_mode(opts, mode, BENCH_POLICIES[p], t, base_rate, first);
+                if (t == first)
+                    base_rate = rate;
+            }
+        }
+    }
+}
@@ -0,0 +1,23 @@
+# Checks that every probe mem_pool.c fires is in the .note.stapsdt notes
+# of a binary built from it, so the probes cannot silently rot.
+#   cmake -DREADELF=readelf -DBINARY=<binary> -DSOURCE=mem_pool.c -P check_probes.cmake
+
+file(STRINGS ${SOURCE} probe_lines REGEX "MEM_PROBE[0-9]\\([a-z_]+")
+set(probes)
+foreach(line ${probe_lines})
+    string(REGEX MATCH "MEM_PROBE[0-9]\\(([a-z_]+)" match "${line}")
+    list(APPEND probes ${CMAKE_MATCH_1})
+endforeach()
+list(REMOVE_DUPLICATES probes)
+
+execute_process(COMMAND ${READELF} -n ${BINARY} OUTPUT_VARIABLE notes RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${READELF} -n ${BINARY} failed")
+endif()
+foreach(probe ${probes})
+    if(NOT notes MATCHES "Provider: mem_pool[\r\n\t ]+Name: ${probe}[\r\n]")
+        message(FATAL_ERROR "probe mem_pool:${probe} missing from ${BINARY}")
+    endif()
+endforeach()
+list(LENGTH probes num_probes)
+message(STATUS "${num_probes} mem_pool probes in ${BINARY}")
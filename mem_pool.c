@@ -1,8 +1,33 @@
+#define _POSIX_C_SOURCE 200809L // for shm_open()
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <stdint.h> // for uintptr_t
+#include <limits.h> // for LLONG_MAX
+#include <string.h> // for memcpy()
+#include <errno.h>
+#include <stdatomic.h>
+#include <math.h> // for log()
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/file.h> // for flock()
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h> // process-shared locks of shared pools
+#endif
+
+#ifdef __GLIBC__
+#include <execinfo.h> // for backtrace()
+#endif
 
 #include "mem_pool.h"
+#include "mem_stats.h"
+#include "mem_probes.h"
 
 /*************/
 /*           */
@@ -24,6 +49,37 @@ static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 
+static const size_t     MEM_IN_BAND_BYTES_PER_NODE      = 256; // node capacity of mem_pool_open_in
+
+static const char       MEM_FILE_MAGIC[8]               = "MEMPOOL";
+static const unsigned   MEM_FILE_VERSION                = 1;
+static const size_t     MEM_SNAPSHOT_BUFFER_SIZE        = 1 << 20; // metadata batched into writes of this size
+static const size_t     MEM_CHECKPOINT_PAGE_SIZE        = 4096; // granularity of memory change tracking
+static const size_t     MEM_CHECKPOINT_CHUNK            = 256; // nodes or gaps, hashed together
+static const size_t     MEM_TEMPLATE_REWRITE_SHARE      = 2; // rewritten once 1/share of its pages changed
+
+static const unsigned   MEM_READ_MAX_RETRIES            = 64;
+
+static const unsigned   MEM_GROUP_INIT_CAPACITY         = 8;
+static const unsigned   MEM_GROUP_EXPAND_FACTOR         = 2;
+
+static const size_t     MEM_PROFILE_DEFAULT_SAMPLE      = 512 * 1024;
+static const unsigned   MEM_PROFILE_SKIP_FRAMES         = 3; // the sampler, _mem_new_alloc_tagged and the entry
+static const unsigned   MEM_PROFILE_INIT_CAPACITY       = 256;
+#define                 MEM_PROFILE_MAX_DEPTH             32
+
+// the return address of the public entry point, where a heap profile
+// stack starts; NULL falls back to MEM_PROFILE_SKIP_FRAMES
+#ifdef __GNUC__
+#define                 MEM_CALLER()                      __builtin_return_address(0)
+#else
+#define                 MEM_CALLER()                      NULL
+#endif
+
+static const unsigned   MEM_GUARD_DEFAULT_RATE          = 5000;
+static const unsigned   MEM_GUARD_DEFAULT_SLOTS         = 64;
+#define                 MEM_GUARD_MAX_DEPTH               16
+
 /*********************/
 /*                   */
 /* Type declarations */
@@ -31,7 +87,8 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /*********************/
 typedef struct _node {
     alloc_t alloc_record;
-    unsigned used;
+    unsigned short used;
+    unsigned short tag; // allocation tag, for per-tag accounting
     unsigned allocated;
     struct _node *next, *prev; // doubly-linked list for gap deletion
 } node_t, *node_pt;
@@ -43,28 +100,260 @@ typedef struct _gap {
 
 typedef struct _pool_mgr {
     pool_t pool;
+    mem_ctx_pt ctx; // the context whose store holds this pool
+    unsigned store_ix; // slot in the pool store
     node_pt node_heap;
     unsigned total_nodes;
     unsigned used_nodes;
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    unsigned simulated; // no backing memory, pool.mem is NULL
+    _Atomic unsigned seq; // seqlock for readers, odd while the pool is being changed
+    node_pt *retired_heaps; // old node heaps, kept until close for readers still walking them
+    unsigned num_retired;
+    mem_stats_slot_pt stats_slot; // shared-memory stats, NULL if not exported
+    unsigned stats_epoch; // the export the slot belongs to, see stats_epoch
+    long long profile_countdown; // bytes left until the next heap profile sample
+    uint64_t profile_rng;
+    unsigned profile_live; // live samples in this pool
+    pool_tag_stats_t tag_stats[MEM_NUM_TAGS];
+    long long guard_countdown; // allocations left until the next guarded one
+    uint64_t guard_rng;
+    struct _pool_mgr *range_left, *range_right; // treap of pool ranges, by address
+    uint64_t range_priority;
+    pool_group_pt group; // NULL unless the pool is a group member
+    unsigned group_ix; // position in the group heap
+    size_t group_key; // largest gap as of the last change here, the group heap key
+    size_t last_gap; // size of the gap the last deallocation left
+    size_t largest_gap; // kept exact by the gap index updates
+    unsigned num_largest; // gaps of that size
+    struct _pool_mgr *parent; // NULL unless the memory is an allocation in the parent
+    struct _pool_mgr *first_child, *next_sibling, *prev_sibling;
+    struct _pool_mgr *outer; // innermost pool holding this one's memory, if any
+    unsigned depth; // nesting in outer pools, 0 for none
+    unsigned in_band; // metadata and memory in a caller's buffer, nothing to free
+    unsigned heap_grows; // an in-band node heap and gap index that move out of the mapping when full
+    void *mapping; // the file mapping of a file-backed pool, NULL otherwise
+    size_t mapping_size;
+    int mapping_fd; // kept open for its lock
+    struct _mem_checkpoint *checkpoint; // dirty tracking since the last snapshot, NULL if none
+    struct _mem_template *clone_template; // the image the clones map, NULL if none
+    struct _mem_shared_header *shared; // the segment of a shared pool, NULL otherwise
+    alloc_t shared_alloc; // the last allocation in a shared pool, as returned
 } pool_mgr_t, *pool_mgr_pt;
 
+// at the start of a pool file, followed by the in-band pool
+typedef struct _mem_file_header {
+    char magic[8];
+    unsigned version;
+    unsigned mgr_bytes, node_bytes; // layout of the build that wrote the file
+    uintptr_t base; // address the file was last mapped at
+    size_t file_size;
+    size_t mgr_offset;
+} mem_file_header_t, *mem_file_header_pt;
+
+// at the start of a shared pool segment, followed by the in-band pool
+typedef struct _mem_shared_header {
+    mem_file_header_t file; // base is where the last process to change the pool maps it
+#ifdef __unix__
+    pthread_mutex_t lock; // process-shared and robust
+#endif
+    unsigned broken; // a process died in the middle of a change
+    // a rebase in progress, see _mem_shared_rebase
+    _Atomic uintptr_t rebase_to; // 0 if none
+    _Atomic size_t rebase_next; // the next pointer to move
+    _Atomic size_t rebase_field; // the pointer logged in rebase_value
+    uintptr_t rebase_value;
+} mem_shared_header_t, *mem_shared_header_pt;
+
+// where the parts of a pool go in a snapshot file
+typedef struct _mem_snapshot_layout {
+    size_t num_nodes; // capacity of the node heap and the gap index
+    size_t nodes_offset, gaps_offset, mem_offset;
+} mem_snapshot_layout_t, *mem_snapshot_layout_pt;
+
+// what changed since the last snapshot or checkpoint of a pool
+typedef struct _mem_checkpoint {
+    mem_snapshot_layout_t layout;
+    unsigned char *dirty; // bitmap of the memory pages allocated in or marked
+    uint64_t *node_hash; // per chunk of the node heap, as last written
+    uint64_t *gap_hash; // per chunk of the gap index
+} mem_checkpoint_t, *mem_checkpoint_pt;
+
+// the image the clones of a pool map, and what changed in the pool since
+typedef struct _mem_template {
+    int fd; // an unlinked shared memory object
+    size_t size;
+    mem_snapshot_layout_t layout;
+    unsigned changed; // the metadata, at least, is out of date
+    unsigned stale; // changed in a way only a rewrite catches up with
+    unsigned char *dirty; // bitmap of the memory pages allocated in or marked
+    size_t num_dirty;
+} mem_template_t, *mem_template_pt;
+
+// buffered writer of mem_pool_snapshot
+typedef struct _mem_snapshot_out {
+    int fd;
+    char *buf;
+    size_t len;
+    unsigned failed;
+} mem_snapshot_out_t, *mem_snapshot_out_pt;
+
+struct _mem_ctx {
+    pool_mgr_pt *pool_store; // an array of pointers, only expand
+    unsigned pool_store_size; // slots ever used, including the free ones
+    unsigned pool_store_capacity;
+    unsigned *free_slots; // stack of slots freed by mem_pool_close
+    unsigned num_free_slots;
+    struct _mem_ctx *next; // all contexts, for the process-wide tools
+};
+
+struct _pool_group {
+    pool_mgr_pt *heap; // max-heap of the members by group_key
+    unsigned num_pools;
+    unsigned capacity;
+};
+
+typedef struct _profile_stack {
+    void *pcs[MEM_PROFILE_MAX_DEPTH];
+    unsigned depth;
+    unsigned long long inuse_objs, inuse_bytes;
+    unsigned long long alloc_objs, alloc_bytes;
+} profile_stack_t, *profile_stack_pt;
+
+typedef struct _profile_sample {
+    pool_mgr_pt pool_mgr;
+    char *mem;
+    size_t size;
+    unsigned stack;
+    unsigned used;
+} profile_sample_t, *profile_sample_pt;
+
+typedef struct _guard_slot {
+    pool_mgr_pt pool_mgr; // NULL until first used
+    char *pool_mem; // the range the allocation holds in its pool
+    size_t size;
+    unsigned freed; // the page is protected until the slot is reused
+    unsigned alloc_depth, free_depth;
+    void *alloc_pcs[MEM_GUARD_MAX_DEPTH];
+    void *free_pcs[MEM_GUARD_MAX_DEPTH];
+} guard_slot_t, *guard_slot_pt;
+
 /***************************/
 /*                         */
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
-static unsigned pool_store_capacity = 0;
+static mem_ctx_t default_ctx; // behind mem_init, mem_pool_open and mem_free
+static mem_ctx_pt ctx_list = NULL; // contexts with a pool store
+static atomic_flag ctx_lock = ATOMIC_FLAG_INIT;
+
+static mem_stats_region_pt stats_region = NULL; // shared-memory stats export
+static char stats_name[64];
+static atomic_int stats_requested; // MEM_STATS_SIGNAL arrived, the next operation exports
+#ifdef __unix__
+static struct sigaction stats_old_action;
+static unsigned stats_signal_installed;
+#endif
+static _Atomic unsigned stats_next_pool_id = 0;
+static atomic_flag stats_lock = ATOMIC_FLAG_INIT; // slot claims, from any context
+static _Atomic unsigned stats_epoch = 0; // bumped by every export and unexport
+
+// heap profile, shared by all pools: distinct stacks, and the live
+// samples in an open-addressing table keyed by (pool, mem)
+static size_t profile_sample_bytes = 0; // 0 when not profiling
+static atomic_flag profile_lock = ATOMIC_FLAG_INIT;
+static profile_stack_pt profile_stacks = NULL;
+static unsigned profile_num_stacks = 0;
+static unsigned profile_stacks_capacity = 0;
+static unsigned *profile_stack_ix = NULL; // stack index + 1, 0 if empty
+static unsigned profile_stack_ix_capacity = 0;
+static profile_sample_pt profile_live = NULL;
+static unsigned profile_num_live = 0;
+static unsigned profile_live_capacity = 0;
+
+static _Thread_local unsigned thread_tag = 0; // tag for mem_new_alloc
+
+// sampled guard pages, shared by all pools: slot i is the page at
+// guard_region + (2 * i + 1) pages, between two PROT_NONE guard pages
+static unsigned guard_sample_rate = 0; // 0 when not guarding
+static char *guard_region = NULL;
+static size_t guard_region_size = 0;
+static size_t guard_page_size = 0;
+static atomic_flag guard_lock = ATOMIC_FLAG_INIT;
+static guard_slot_pt guard_slots = NULL;
+static unsigned guard_num_slots = 0;
+static unsigned *guard_free = NULL; // FIFO of free slots, least recently freed first
+static unsigned guard_free_head = 0;
+static unsigned guard_num_free = 0;
+#ifdef __unix__
+static struct sigaction guard_old_action;
+#endif
+
+// the memory ranges of the open pools of all contexts, for mem_pool_of
+static pool_mgr_pt range_root = NULL;
+static atomic_flag range_lock = ATOMIC_FLAG_INIT;
+
+// pools watching for changes, with a checkpoint or a clone template, in all contexts
+static _Atomic unsigned num_watched = 0;
+static _Atomic unsigned num_templates_made = 0; // for unique template names
 
 /********************************************/
 /*                                          */
 /* Forward declarations of static functions */
 /*                                          */
 /********************************************/
-static alloc_status _mem_resize_pool_store();
+static alloc_status _mem_ctx_init(mem_ctx_pt ctx);
+static void _mem_ctx_free(mem_ctx_pt ctx);
+static void _mem_ctx_lock();
+static void _mem_ctx_unlock();
+static void _mem_each_pool(void (*visit)(pool_mgr_pt pool_mgr));
+static pool_pt _mem_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy, unsigned simulated,
+                              pool_mgr_pt parent, char *region);
+static pool_pt _mem_pool_setup(mem_ctx_pt ctx, pool_mgr_pt pool_mgr, size_t size, alloc_policy policy,
+                               pool_mgr_pt parent);
+static void _mem_pool_init(pool_mgr_pt pool_mgr, size_t size, alloc_policy policy);
+static pool_mgr_pt _mem_pool_carve(void *buf, size_t size, size_t *pool_size);
+static void _mem_pool_register(mem_ctx_pt ctx, pool_mgr_pt pool_mgr, pool_mgr_pt parent);
+static unsigned _mem_file_header_valid(mem_file_header_pt header, size_t size);
+#ifdef __unix__
+static char *_mem_shared_create(int fd, size_t size, alloc_policy policy);
+static char *_mem_shared_attach(int fd, size_t *size);
+#endif
+static alloc_status _mem_shared_enter(pool_mgr_pt pool_mgr);
+static void _mem_shared_leave(pool_mgr_pt pool_mgr);
+static void _mem_shared_copy(pool_mgr_pt to, pool_mgr_pt from);
+static pool_mgr_pt _mem_shared_mgr(pool_mgr_pt pool_mgr);
+static void _mem_shared_rebase(mem_shared_header_pt shared);
+static void *_mem_shared_field(mem_shared_header_pt shared, size_t k, uintptr_t to);
+static void _mem_file_header_init(mem_file_header_pt header, size_t file_size, size_t mgr_offset,
+                                  uintptr_t base);
+static pool_mgr_pt _mem_pool_attach(mem_ctx_pt ctx, char *map, size_t size);
+static void _mem_pool_reset_local(pool_mgr_pt pool_mgr);
+static void _mem_snapshot_mgr(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, pool_mgr_pt image);
+static void _mem_snapshot_node(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, size_t i, node_pt image);
+static void _mem_snapshot_gap(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, size_t i, gap_pt image);
+static node_pt _mem_snapshot_link(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, node_pt node);
+static void _mem_snapshot_put(mem_snapshot_out_pt out, const void *data, size_t len);
+static void _mem_snapshot_flush(mem_snapshot_out_pt out);
+static unsigned _mem_write_fd(int fd, const char *data, size_t len);
+static unsigned _mem_pwrite_fd(int fd, const char *data, size_t len, off_t offset);
+static void _mem_checkpoint_begin(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout);
+static void _mem_checkpoint_end(pool_mgr_pt pool_mgr);
+static void _mem_pool_touch(pool_mgr_pt pool_mgr, const char *mem, size_t size);
+static alloc_status _mem_pool_write_image(pool_mgr_pt pool_mgr, int fd, size_t num_nodes, mem_snapshot_layout_pt layout);
+static alloc_status _mem_template_make(pool_mgr_pt pool_mgr);
+static void _mem_template_drop(pool_mgr_pt pool_mgr);
+static void _mem_template_update(pool_mgr_pt pool_mgr, char *map);
+static void _mem_pool_mark(pool_mgr_pt pool_mgr, const char *mem, size_t size);
+static size_t _mem_checkpoint_count(size_t first, size_t total);
+static uint64_t _mem_checkpoint_hash(const void *data, size_t len);
+static void _mem_pool_rebase(pool_mgr_pt pool_mgr, uintptr_t delta);
+static void _mem_pool_free(pool_mgr_pt pool_mgr);
+static void _mem_pool_free_heaps(pool_mgr_pt pool_mgr);
+static unsigned _mem_pool_maps(pool_mgr_pt pool_mgr, const void *ptr);
+static void _mem_pool_drop_samples(pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_pool_store(mem_ctx_pt ctx);
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status
@@ -76,6 +365,56 @@ static alloc_status
                                 size_t size,
                                 node_pt node);
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size);
+static alloc_pt _mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag, void *caller);
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc);
+static void _mem_write_begin(pool_mgr_pt pool_mgr);
+static void _mem_write_end(pool_mgr_pt pool_mgr);
+static unsigned _mem_read_begin(pool_mgr_pt pool_mgr);
+static unsigned _mem_read_retry(pool_mgr_pt pool_mgr, unsigned seq);
+static pool_mgr_pt _mem_read_source(pool_mgr_pt pool_mgr);
+static const node_t *_mem_read_next(pool_mgr_pt pool_mgr, const node_t *node);
+static void _mem_stats_attach(pool_mgr_pt pool_mgr);
+static void _mem_stats_detach(pool_mgr_pt pool_mgr);
+static void _mem_stats_publish(pool_mgr_pt pool_mgr, unsigned allocs, unsigned frees, unsigned failed);
+static void _mem_stats_on_request();
+static void _mem_stats_update(pool_mgr_pt pool_mgr, unsigned allocs, unsigned frees, unsigned failed);
+#ifdef __unix__
+static void _mem_stats_on_signal(int sig);
+#endif
+static void _mem_stats_lock();
+static void _mem_stats_unlock();
+static void _mem_profile_reset_countdown(pool_mgr_pt pool_mgr);
+static void _mem_profile_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc, void *caller);
+static void _mem_profile_free(pool_mgr_pt pool_mgr, char *mem);
+static void _mem_profile_remove(pool_mgr_pt pool_mgr, char *mem);
+static void _mem_profile_forget(pool_mgr_pt pool_mgr);
+static void _mem_profile_lock();
+static void _mem_profile_unlock();
+static void _mem_guard_reset_countdown(pool_mgr_pt pool_mgr);
+static void _mem_guard_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_status _mem_guard_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static unsigned _mem_guard_owns(const char *mem);
+static guard_slot_pt _mem_guard_slot(const char *mem);
+static void _mem_guard_lock();
+static void _mem_guard_unlock();
+static void _mem_range_insert(pool_mgr_pt pool_mgr);
+static void _mem_range_erase(pool_mgr_pt pool_mgr);
+static void _mem_range_split(pool_mgr_pt root, uintptr_t start, unsigned depth,
+                             pool_mgr_pt *left, pool_mgr_pt *right);
+static pool_mgr_pt _mem_range_merge(pool_mgr_pt left, pool_mgr_pt right);
+static void _mem_range_lock();
+static void _mem_range_unlock();
+static size_t _mem_largest_gap(pool_mgr_pt pool_mgr);
+static void _mem_group_sift_up(pool_group_pt group, unsigned ix);
+static void _mem_group_sift_down(pool_group_pt group, unsigned ix);
+static void _mem_group_rekey(pool_mgr_pt pool_mgr);
+#ifdef __unix__
+static void _mem_guard_write(const char *msg, size_t len);
+static void _mem_guard_write_str(const char *msg);
+static void _mem_guard_write_num(uintptr_t value, unsigned base, unsigned negative);
+static void _mem_guard_on_fault(int sig, siginfo_t *info, void *context);
+#endif
 
 
 /****************************************/
@@ -86,47 +425,322 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
 alloc_status mem_init() {
 
     // ensure that it's called only once until mem_free
-    // allocate the pool store with initial capacity
-    // note: holds pointers only, other functions to allocate/deallocate
-    if ( pool_store == NULL) {
-        pool_store = (pool_mgr_pt*)calloc( MEM_POOL_STORE_INIT_CAPACITY , sizeof(pool_mgr_pt) );
-        pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
-        pool_store_size = 0;
-    }
-    else
+    // allocate the pool store of the default context
+    if (default_ctx.pool_store != NULL)
         return ALLOC_CALLED_AGAIN;
+    if (_mem_ctx_init(&default_ctx) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    // stats export can be switched on from outside the program
+    const char *stats_env = getenv("MEM_POOL_STATS");
+    if (stats_env != NULL && stats_env[0] != '\0' && strcmp(stats_env, "0") != 0)
+        mem_stats_export(stats_env[0] == '/' ? stats_env : NULL);
+#ifdef __unix__
+    // or later, on a signal, unless the program has its own use for it
+    struct sigaction stats_action;
+    if (sigaction(MEM_STATS_SIGNAL, NULL, &stats_old_action) == 0 && stats_old_action.sa_handler == SIG_DFL
+        && ! (stats_old_action.sa_flags & SA_SIGINFO)) {
+        memset(&stats_action, 0, sizeof(stats_action));
+        stats_action.sa_handler = _mem_stats_on_signal;
+        stats_action.sa_flags = SA_RESTART;
+        sigemptyset(&stats_action.sa_mask);
+        stats_signal_installed = sigaction(MEM_STATS_SIGNAL, &stats_action, NULL) == 0;
+    }
+#endif
+    // and so can guard-page sampling, with the sample rate
+    const char *guard_env = getenv("MEM_POOL_GUARD");
+    if (guard_env != NULL && strtoul(guard_env, NULL, 10) > 0)
+        mem_guard_start((unsigned) strtoul(guard_env, NULL, 10), 0);
     return ALLOC_OK;
 }
 
 alloc_status mem_free() {
     // ensure that it's called only once for each mem_init
-    if (pool_store ==NULL)
+    if (default_ctx.pool_store == NULL)
         return ALLOC_CALLED_AGAIN;
-    // make sure all pool managers have been deallocated
-    // can free the pool store array
-    // update static variables
-    // deallocate every pool memory
-    for ( int i = 0; i < pool_store_capacity ; i ++) {
-        pool_store[i] = NULL;
+    // all its pools must be closed first, as for any context
+    if (default_ctx.pool_store_size != default_ctx.num_free_slots)
+        return ALLOC_NOT_FREED;
+    // the process-wide tools end with the default context
+#ifdef __unix__
+    if (stats_signal_installed) {
+        sigaction(MEM_STATS_SIGNAL, &stats_old_action, NULL);
+        stats_signal_installed = 0;
     }
-    // free pool
-    free(pool_store);
+#endif
+    atomic_store(&stats_requested, 0);
+    if (stats_region != NULL)
+        mem_stats_unexport();
+    if (profile_sample_bytes)
+        mem_profile_stop();
+    if (guard_sample_rate)
+        mem_guard_stop();
+    // free the pool store
+    _mem_ctx_free(&default_ctx);
+
+    return ALLOC_OK;
+}
 
-    // update status after deallocated
-    pool_store_capacity = 0;
-    pool_store_size = 0;
-    pool_store = NULL;
+mem_ctx_pt mem_ctx_init() {
+    mem_ctx_pt ctx = (mem_ctx_pt) calloc(1, sizeof(mem_ctx_t));
+    if (ctx == NULL)
+        return NULL;
+    if (_mem_ctx_init(ctx) != ALLOC_OK) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
 
+alloc_status mem_ctx_free(mem_ctx_pt ctx) {
+    // all its pools must be closed first
+    if (ctx->pool_store_size != ctx->num_free_slots)
+        return ALLOC_NOT_FREED;
+    _mem_ctx_free(ctx);
+    free(ctx);
     return ALLOC_OK;
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    return _mem_pool_open(&default_ctx, size, policy, 0, NULL, NULL);
+}
+
+pool_pt mem_pool_open_sim(size_t size, alloc_policy policy) {
+    return _mem_pool_open(&default_ctx, size, policy, 1, NULL, NULL);
+}
+
+pool_pt mem_ctx_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy) {
+    return _mem_pool_open(ctx, size, policy, 0, NULL, NULL);
+}
+
+pool_pt mem_ctx_pool_open_sim(mem_ctx_pt ctx, size_t size, alloc_policy policy) {
+    return _mem_pool_open(ctx, size, policy, 1, NULL, NULL);
+}
+
+unsigned mem_ctx_store_size(mem_ctx_pt ctx) {
+    return (ctx ? ctx : &default_ctx)->pool_store_size;
+}
+
+unsigned mem_pool_slot(pool_pt pool) {
+    return ((pool_mgr_pt) pool)->store_ix;
+}
+
+pool_pt mem_pool_open_child(pool_pt parent, size_t size, alloc_policy policy) {
+    pool_mgr_pt parent_mgr = (pool_mgr_pt) parent;
+    // the child's memory is one allocation in the parent, never sampled
+    // to a guard page, where the child's metadata would not be in the parent
+    long long guard_countdown = parent_mgr->guard_countdown;
+    parent_mgr->guard_countdown = LLONG_MAX;
+    alloc_pt region = mem_new_alloc(parent, size);
+    parent_mgr->guard_countdown = guard_countdown;
+    if (region == NULL)
+        return NULL;
+    alloc_t record = *region;
+    pool_pt pool = _mem_pool_open(parent_mgr->ctx, size, policy, parent_mgr->simulated, parent_mgr, record.mem);
+    if (pool == NULL)
+        mem_del_alloc(parent, &record);
+    return pool;
+}
+
+alloc_status mem_pool_reset(pool_pt pool) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    // child pools go with their regions
+    while (pool_mgr->first_child != NULL)
+        _mem_pool_free(pool_mgr->first_child);
+    _mem_pool_drop_samples(pool_mgr);
+
+    if (pool_mgr->shared != NULL && _mem_shared_enter(pool_mgr) != ALLOC_OK)
+        return ALLOC_FAIL;
+    _mem_write_begin(pool_mgr);
+    // back to one gap over the whole pool, keeping the capacities
+    memset(pool_mgr->node_heap, 0, pool_mgr->total_nodes * sizeof(node_t));
+    pool_mgr->node_heap[0].alloc_record.mem = pool_mgr->pool.mem;
+    pool_mgr->node_heap[0].alloc_record.size = pool_mgr->pool.total_size;
+    pool_mgr->node_heap[0].used = 1;
+    pool_mgr->used_nodes = 1;
+    pool_mgr->gap_ix[0].size = pool_mgr->pool.total_size;
+    pool_mgr->gap_ix[0].node = pool_mgr->node_heap;
+    pool_mgr->largest_gap = pool_mgr->pool.total_size;
+    pool_mgr->num_largest = 1;
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_allocs = 0;
+    pool_mgr->pool.num_gaps = 1;
+    for (unsigned tag = 0; tag < MEM_NUM_TAGS; tag++) {
+        pool_mgr->tag_stats[tag].live_bytes = 0;
+        pool_mgr->tag_stats[tag].live_allocs = 0;
+    }
+    _mem_write_end(pool_mgr);
+    if (pool_mgr->shared != NULL)
+        _mem_shared_leave(pool_mgr);
+
+    if (pool_mgr->group != NULL)
+        _mem_group_rekey(pool_mgr);
+    _mem_stats_update(pool_mgr, 0, 0, 0);
+    if (num_watched)
+        _mem_pool_touch(pool_mgr, NULL, 0);
+    return ALLOC_OK;
+}
+
+size_t mem_alloc_offset(pool_pt pool, alloc_pt alloc) {
+    // integer arithmetic, since a simulated pool has no base address
+    char *mem = alloc->mem;
+    if (_mem_guard_owns(mem) && ! ((pool_mgr_pt) pool)->simulated)
+        mem = _mem_guard_slot(mem)->pool_mem;
+    return (size_t) ((uintptr_t) mem - (uintptr_t) pool->mem);
+}
+
+pool_pt mem_pool_of(const void *ptr) {
+    // the last (and deepest) pool starting at or below ptr, or the
+    // closest pool around it that holds ptr, since pools may nest
+    uintptr_t addr = (uintptr_t) ptr;
+    pool_mgr_pt found = NULL;
+    _mem_range_lock();
+    for (pool_mgr_pt node = range_root; node != NULL; ) {
+        if ((uintptr_t) node->pool.mem <= addr) {
+            found = node;
+            node = node->range_right;
+        } else
+            node = node->range_left;
+    }
+    while (found != NULL && addr - (uintptr_t) found->pool.mem >= found->pool.total_size)
+        found = found->outer;
+    _mem_range_unlock();
+    // sampled allocations live outside their pools
+    if (found == NULL && _mem_guard_owns(ptr)) {
+        guard_slot_pt slot = _mem_guard_slot(ptr);
+        return slot->freed ? NULL : (pool_pt) slot->pool_mgr;
+    }
+    return (pool_pt) found;
+}
+
+alloc_status mem_free_any(void *ptr) {
+    pool_pt pool = mem_pool_of(ptr);
+    if (pool == NULL)
+        return ALLOC_NOT_FREED;
+    // mem_del_alloc finds the allocation by its address alone
+    alloc_t alloc = { 0, (char *) ptr };
+    return mem_del_alloc(pool, &alloc);
+}
+
+/*
+ * A pool group is a max-heap of its member pools keyed by an upper
+ * bound of each one's largest gap. mem_del_alloc raises the key of a
+ * member to the gap it leaves, and allocations leave it as is, so the
+ * keys stay upper bounds without scanning gap indexes on every call.
+ * mem_group_alloc tightens the key at the top to the exact largest gap
+ * until the top pool fits, and allocates from it: the member with the
+ * largest gap, found in O(log pools) heap steps plus a gap index scan
+ * per stale key.
+ */
+pool_group_pt mem_group_open() {
+    pool_group_pt group = (pool_group_pt) calloc(1, sizeof(pool_group_t));
+    if (group == NULL)
+        return NULL;
+    group->heap = (pool_mgr_pt *) calloc(MEM_GROUP_INIT_CAPACITY, sizeof(pool_mgr_pt));
+    if (group->heap == NULL) {
+        free(group);
+        return NULL;
+    }
+    group->capacity = MEM_GROUP_INIT_CAPACITY;
+    return group;
+}
+
+alloc_status mem_group_close(pool_group_pt group) {
+    // the members stay open
+    for (unsigned i = 0; i < group->num_pools; i++)
+        group->heap[i]->group = NULL;
+    free(group->heap);
+    free(group);
+    return ALLOC_OK;
+}
+
+alloc_status mem_group_add(pool_group_pt group, pool_pt pool) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr->group != NULL)
+        return ALLOC_CALLED_AGAIN;
+    if (group->num_pools == group->capacity) {
+        unsigned new_capacity = group->capacity * MEM_GROUP_EXPAND_FACTOR;
+        pool_mgr_pt *new_heap = (pool_mgr_pt *) realloc(group->heap, new_capacity * sizeof(pool_mgr_pt));
+        if (new_heap == NULL)
+            return ALLOC_FAIL;
+        group->heap = new_heap;
+        group->capacity = new_capacity;
+    }
+    pool_mgr->group = group;
+    pool_mgr->group_key = _mem_largest_gap(pool_mgr);
+    pool_mgr->group_ix = group->num_pools;
+    group->heap[group->num_pools++] = pool_mgr;
+    _mem_group_sift_up(group, pool_mgr->group_ix);
+    return ALLOC_OK;
+}
+
+alloc_status mem_group_remove(pool_group_pt group, pool_pt pool) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr->group != group)
+        return ALLOC_FAIL;
+    // move the last member into the hole, and restore the heap from there
+    unsigned ix = pool_mgr->group_ix;
+    pool_mgr_pt last = group->heap[--group->num_pools];
+    pool_mgr->group = NULL;
+    if (last != pool_mgr) {
+        group->heap[ix] = last;
+        last->group_ix = ix;
+        _mem_group_sift_up(group, ix);
+        _mem_group_sift_down(group, last->group_ix);
+    }
+    return ALLOC_OK;
+}
+
+alloc_pt mem_group_alloc(pool_group_pt group, size_t size, pool_pt *pool) {
+    alloc_pt alloc = NULL;
+    unsigned num_pools = group->num_pools;
+    // the keys are the exact largest gaps, kept so by the allocations and
+    // deallocations in the members, so no member fits once the top is too small
+    while (group->num_pools > 0 && group->heap[0]->group_key >= size) {
+        pool_mgr_pt top = group->heap[0];
+        // except those of shared members, which other processes change
+        if (top->shared != NULL) {
+            size_t largest = _mem_largest_gap(top);
+            if (largest != top->group_key) {
+                top->group_key = largest;
+                _mem_group_sift_down(group, 0);
+                continue;
+            }
+        }
+        alloc = mem_new_alloc((pool_pt) top, size);
+        if (alloc != NULL) {
+            if (pool != NULL)
+                *pool = (pool_pt) top;
+            break;
+        }
+        // the gap is there but the member failed anyway (e.g. out of
+        // nodes), so it sits out the rest of the search past the end of
+        // the heap, and each member is tried at most once
+        pool_mgr_pt last = group->heap[--group->num_pools];
+        group->heap[group->num_pools] = top;
+        top->group_ix = group->num_pools;
+        if (last != top) {
+            group->heap[0] = last;
+            _mem_group_sift_down(group, 0);
+        }
+    }
+    // and goes back in after it
+    while (group->num_pools < num_pools) {
+        group->num_pools++;
+        _mem_group_sift_up(group, group->num_pools - 1);
+    }
+    return alloc;
+}
+
+static pool_pt _mem_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy, unsigned simulated,
+                              pool_mgr_pt parent, char *region) {
     // make sure there the pool store is allocated
-    assert(pool_store);
-    if (pool_store == NULL)
+    assert(ctx->pool_store);
+    if (ctx->pool_store == NULL)
         return NULL;
     // expand the pool store, if necessary
-    _mem_resize_pool_store();
+    if (_mem_resize_pool_store(ctx) != ALLOC_OK)
+        return NULL;
 
     // allocate a new mem pool mgr
     pool_mgr_pt pool_mgr =(pool_mgr_pt) calloc(1, sizeof(pool_mgr_t) );
@@ -135,11 +749,16 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     if ( pool_mgr == NULL) {
         return NULL;
     }
-    // allocate a new memory pool
-    pool_mgr->pool.mem = (char*) calloc(size, sizeof(char));
+    // allocate a new memory pool, unless only the metadata is simulated
+    // or the memory is a region of the parent pool
+    pool_mgr->simulated = simulated;
+    if (parent != NULL)
+        pool_mgr->pool.mem = region;
+    else if (! simulated)
+        pool_mgr->pool.mem = (char*) calloc(size, sizeof(char));
     // check success, on error deallocate mgr and return null
-    assert(pool_mgr->pool.mem);
-    if ( pool_mgr->pool.mem == NULL) {
+    assert(simulated || pool_mgr->pool.mem);
+    if ( ! simulated && pool_mgr->pool.mem == NULL) {
         free(pool_mgr);
         return NULL;
     }
@@ -148,7 +767,8 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     // check success, on error deallocate mgr/pool and return null
     assert(pool_mgr->node_heap);
     if ( pool_mgr->node_heap == NULL) {
-        free(pool_mgr->pool.mem);
+        if (parent == NULL)
+            free(pool_mgr->pool.mem);
         free(pool_mgr);
         return NULL;
     }
@@ -159,11 +779,1004 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     // check success, on error deallocate mgr/pool/heap and return null
     assert(pool_mgr->gap_ix);
     if ( pool_mgr->gap_ix == NULL) {
-        free(pool_mgr->pool.mem);
+        if (parent == NULL)
+            free(pool_mgr->pool.mem);
         free(pool_mgr->node_heap);
         free(pool_mgr);
         return NULL;
     }
+    pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    return _mem_pool_setup(ctx, pool_mgr, size, policy, parent);
+}
+
+pool_pt mem_pool_open_in(void *buf, size_t size, alloc_policy policy) {
+    return mem_ctx_pool_open_in(&default_ctx, buf, size, policy);
+}
+
+pool_pt mem_ctx_pool_open_in(mem_ctx_pt ctx, void *buf, size_t size, alloc_policy policy) {
+    // make sure the pool store is allocated, and has a free slot
+    assert(ctx->pool_store);
+    if (ctx->pool_store == NULL || _mem_resize_pool_store(ctx) != ALLOC_OK)
+        return NULL;
+    size_t pool_size;
+    pool_mgr_pt pool_mgr = _mem_pool_carve(buf, size, &pool_size);
+    if (pool_mgr == NULL)
+        return NULL;
+    return _mem_pool_setup(ctx, pool_mgr, pool_size, policy, NULL);
+}
+
+pool_pt mem_pool_open_shared(const char *name, size_t size, alloc_policy policy) {
+    return mem_ctx_pool_open_shared(&default_ctx, name, size, policy);
+}
+
+pool_pt mem_ctx_pool_open_shared(mem_ctx_pt ctx, const char *name, size_t size, alloc_policy policy) {
+#ifdef __unix__
+    assert(ctx->pool_store);
+    if (ctx->pool_store == NULL || _mem_resize_pool_store(ctx) != ALLOC_OK)
+        return NULL;
+    // this process's own mgr, over the metadata in the segment
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    if (pool_mgr == NULL)
+        return NULL;
+    // the first process creates the segment, the others attach to it
+    unsigned created = 1;
+    int fd = size ? shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600) : -1;
+    if (fd < 0) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0);
+    }
+    if (fd < 0) {
+        free(pool_mgr);
+        return NULL;
+    }
+    char *map = created ? _mem_shared_create(fd, size, policy) : _mem_shared_attach(fd, &size);
+    close(fd);
+    pool_mgr->shared = (mem_shared_header_pt) map;
+    if (map == NULL || _mem_shared_enter(pool_mgr) != ALLOC_OK) {
+        if (map != NULL)
+            munmap(map, size);
+        if (created)
+            shm_unlink(name);
+        free(pool_mgr);
+        return NULL;
+    }
+    _mem_shared_leave(pool_mgr);
+    pool_mgr->in_band = 1;
+    pool_mgr->mapping = map;
+    pool_mgr->mapping_size = size;
+    pool_mgr->mapping_fd = -1;
+    _mem_pool_register(ctx, pool_mgr, NULL);
+    if (profile_sample_bytes)
+        _mem_profile_reset_countdown(pool_mgr);
+    if (guard_sample_rate)
+        _mem_guard_reset_countdown(pool_mgr);
+    MEM_PROBE3(pool_open, pool_mgr, pool_mgr->pool.total_size, (int) pool_mgr->pool.policy);
+    return (pool_pt) pool_mgr;
+#else
+    (void) ctx;
+    (void) name;
+    (void) size;
+    (void) policy;
+    return NULL;
+#endif
+}
+
+alloc_status mem_pool_unlink_shared(const char *name) {
+#ifdef __unix__
+    // the processes that have the pool open keep it until they close it
+    return shm_unlink(name) == 0 ? ALLOC_OK : ALLOC_FAIL;
+#else
+    (void) name;
+    return ALLOC_FAIL;
+#endif
+}
+
+pool_pt mem_pool_open_file(const char *path, size_t size, alloc_policy policy) {
+    return mem_ctx_pool_open_file(&default_ctx, path, size, policy);
+}
+
+pool_pt mem_ctx_pool_open_file(mem_ctx_pt ctx, const char *path, size_t size, alloc_policy policy) {
+#ifdef __unix__
+    assert(ctx->pool_store);
+    if (ctx->pool_store == NULL || _mem_resize_pool_store(ctx) != ALLOC_OK)
+        return NULL;
+    // one process at a time: the lock goes with the descriptor at close
+    int fd = open(path, O_RDWR | O_CLOEXEC | (size ? O_CREAT : 0), 0600);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    unsigned created = st.st_size == 0;
+    if (created) {
+        if (size <= sizeof(mem_file_header_t) || ftruncate(fd, (off_t) size) != 0) {
+            close(fd);
+            return NULL;
+        }
+    } else
+        size = (size_t) st.st_size;
+    char *map = size >= sizeof(mem_file_header_t)
+                ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        if (created && ftruncate(fd, 0) != 0)
+            perror("mem_pool_open_file");
+        close(fd);
+        return NULL;
+    }
+    mem_file_header_pt header = (mem_file_header_pt) map;
+    pool_mgr_pt pool_mgr = NULL;
+
+    if (created) {
+        // a new file holds a new in-band pool, the magic going in last
+        pool_mgr = (pool_mgr_pt) mem_pool_open_in(header + 1, size - sizeof(mem_file_header_t), policy);
+        if (pool_mgr != NULL) {
+            _mem_file_header_init(header, size, (size_t) ((char *) pool_mgr - map), (uintptr_t) map);
+            pool_mgr->mapping = map;
+            pool_mgr->mapping_size = size;
+        }
+    } else
+        pool_mgr = _mem_pool_attach(ctx, map, size);
+    if (pool_mgr == NULL) {
+        munmap(map, size);
+        if (created && ftruncate(fd, 0) != 0)
+            perror("mem_pool_open_file");
+        close(fd);
+        return NULL;
+    }
+    pool_mgr->mapping_fd = fd;
+    return (pool_pt) pool_mgr;
+#else
+    (void) ctx;
+    return NULL;
+#endif
+}
+
+alloc_status mem_pool_snapshot(pool_pt pool, int fd) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr->simulated)
+        return ALLOC_FAIL;
+#ifdef __unix__
+    mem_snapshot_layout_t layout;
+    if (pool_mgr->shared != NULL && _mem_shared_enter(pool_mgr) != ALLOC_OK)
+        return ALLOC_FAIL;
+    // the node heap and gap index as large as the pool has them, since a
+    // restored pool grows them when they fill up
+    alloc_status status = _mem_pool_write_image(pool_mgr, fd, 0, &layout);
+    if (pool_mgr->shared != NULL)
+        _mem_shared_leave(pool_mgr);
+    if (status != ALLOC_OK)
+        return ALLOC_FAIL;
+    // checkpoints go on from here
+    _mem_checkpoint_begin(pool_mgr, &layout);
+    return ALLOC_OK;
+#else
+    (void) fd;
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_pool_checkpoint(pool_pt pool, int fd) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    mem_checkpoint_pt checkpoint = pool_mgr->checkpoint;
+#ifdef __unix__
+    // without a snapshot to build on, or with one too small for the node heap, start over;
+    // the other processes of a shared pool leave no dirty marks here
+    if (checkpoint == NULL || pool_mgr->shared != NULL || pool_mgr->total_nodes > checkpoint->layout.num_nodes) {
+        if (pool_mgr->simulated || lseek(fd, 0, SEEK_SET) != 0 || ftruncate(fd, 0) != 0)
+            return ALLOC_FAIL;
+        return mem_pool_snapshot(pool, fd);
+    }
+    mem_snapshot_layout_pt layout = &checkpoint->layout;
+    char *buf = (char *) malloc(MEM_SNAPSHOT_BUFFER_SIZE);
+    if (buf == NULL)
+        return ALLOC_FAIL;
+
+    // the manager goes first marked as mid-change, and last as done, so
+    // that a file left by a checkpoint cut short does not restore
+    pool_mgr_t image;
+    _mem_snapshot_mgr(pool_mgr, layout, &image);
+    atomic_init(&image.seq, 1);
+    const off_t mgr_offset = (off_t) sizeof(mem_file_header_t);
+    unsigned failed = ! _mem_pwrite_fd(fd, (const char *) &image, sizeof(image), mgr_offset);
+
+    // the chunks of the node heap and gap index that hash differently; a
+    // chunk or a run of pages counts as written only once its write is
+    // through, so a checkpoint that fails leaves them to the next one
+    size_t num_chunks = (layout->num_nodes + MEM_CHECKPOINT_CHUNK - 1) / MEM_CHECKPOINT_CHUNK;
+    for (size_t c = 0; c < num_chunks && ! failed; c++) {
+        size_t first = c * MEM_CHECKPOINT_CHUNK;
+        size_t count = _mem_checkpoint_count(first, pool_mgr->total_nodes);
+        uint64_t hash = _mem_checkpoint_hash(pool_mgr->node_heap + first, count * sizeof(node_t));
+        if (hash == checkpoint->node_hash[c])
+            continue;
+        for (size_t i = 0; i < count; i++)
+            _mem_snapshot_node(pool_mgr, layout, first + i, (node_pt) buf + i);
+        failed = ! _mem_pwrite_fd(fd, buf, count * sizeof(node_t),
+                                  (off_t) (layout->nodes_offset + first * sizeof(node_t)));
+        if (! failed)
+            checkpoint->node_hash[c] = hash;
+    }
+    for (size_t c = 0; c < num_chunks && ! failed; c++) {
+        size_t first = c * MEM_CHECKPOINT_CHUNK;
+        size_t count = _mem_checkpoint_count(first, pool_mgr->pool.num_gaps);
+        uint64_t hash = _mem_checkpoint_hash(pool_mgr->gap_ix + first, count * sizeof(gap_t));
+        if (hash == checkpoint->gap_hash[c])
+            continue;
+        for (size_t i = 0; i < count; i++)
+            _mem_snapshot_gap(pool_mgr, layout, first + i, (gap_pt) buf + i);
+        failed = ! _mem_pwrite_fd(fd, buf, count * sizeof(gap_t),
+                                  (off_t) (layout->gaps_offset + first * sizeof(gap_t)));
+        if (! failed)
+            checkpoint->gap_hash[c] = hash;
+    }
+    free(buf);
+
+    // the runs of dirty pages of the memory
+    size_t num_pages = (pool_mgr->pool.total_size + MEM_CHECKPOINT_PAGE_SIZE - 1) / MEM_CHECKPOINT_PAGE_SIZE;
+    for (size_t page = 0; page < num_pages && ! failed; ) {
+        if (! (checkpoint->dirty[page / 8] & (1u << page % 8))) {
+            page += checkpoint->dirty[page / 8] ? 1 : 8 - page % 8;
+            continue;
+        }
+        size_t end = page;
+        while (end < num_pages && (checkpoint->dirty[end / 8] & (1u << end % 8)))
+            end++;
+        size_t from = page * MEM_CHECKPOINT_PAGE_SIZE;
+        size_t to = end * MEM_CHECKPOINT_PAGE_SIZE;
+        if (to > pool_mgr->pool.total_size)
+            to = pool_mgr->pool.total_size;
+        failed = ! _mem_pwrite_fd(fd, pool_mgr->pool.mem + from, to - from, (off_t) (layout->mem_offset + from));
+        for (; page < end && ! failed; page++)
+            checkpoint->dirty[page / 8] &= (unsigned char) ~(1u << page % 8);
+    }
+    // sampled guard-page allocations, always, since their data is elsewhere
+    if (guard_sample_rate && ! failed) {
+        _mem_guard_lock();
+        for (unsigned i = 0; i < guard_num_slots && ! failed; i++) {
+            guard_slot_pt slot = &guard_slots[i];
+            if (slot->pool_mgr != pool_mgr || slot->freed)
+                continue;
+            char *page = guard_region + (2 * (size_t) i + 1) * guard_page_size;
+            failed = ! _mem_pwrite_fd(fd, page + guard_page_size - slot->size, slot->size,
+                                      (off_t) (layout->mem_offset + (size_t) (slot->pool_mem - pool_mgr->pool.mem)));
+        }
+        _mem_guard_unlock();
+    }
+
+    if (! failed) {
+        atomic_init(&image.seq, 0);
+        failed = ! _mem_pwrite_fd(fd, (const char *) &image, sizeof(image), mgr_offset);
+    }
+    return failed ? ALLOC_FAIL : ALLOC_OK;
+#else
+    (void) fd;
+    (void) checkpoint;
+    return ALLOC_FAIL;
+#endif
+}
+
+pool_pt mem_pool_clone(pool_pt pool) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr->simulated)
+        return NULL;
+#ifdef __unix__
+    mem_ctx_pt ctx = pool_mgr->ctx;
+    if (_mem_resize_pool_store(ctx) != ALLOC_OK)
+        return NULL;
+    // the first clone writes the template, the rest map it, copy-on-write,
+    // and copy in what changed since; once much has, or the node heap has
+    // outgrown it, the template is written anew; the other processes of a
+    // shared pool leave no marks, so its clones always start over
+    if (pool_mgr->shared != NULL && _mem_shared_enter(pool_mgr) != ALLOC_OK)
+        return NULL;
+    mem_template_pt tmpl = pool_mgr->clone_template;
+    if (tmpl != NULL && (pool_mgr->shared != NULL || tmpl->stale
+                         || pool_mgr->total_nodes > tmpl->layout.num_nodes)) {
+        _mem_template_drop(pool_mgr);
+        tmpl = NULL;
+    }
+    if (tmpl == NULL && _mem_template_make(pool_mgr) != ALLOC_OK) {
+        if (pool_mgr->shared != NULL)
+            _mem_shared_leave(pool_mgr);
+        return NULL;
+    }
+    tmpl = pool_mgr->clone_template;
+    size_t size = tmpl->size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, tmpl->fd, 0);
+    if (map != MAP_FAILED && tmpl->changed)
+        _mem_template_update(pool_mgr, map);
+    if (pool_mgr->shared != NULL)
+        _mem_shared_leave(pool_mgr);
+    if (map == MAP_FAILED)
+        return NULL;
+    pool_mgr_pt clone = _mem_pool_attach(ctx, map, size);
+    if (clone == NULL) {
+        munmap(map, size);
+        return NULL;
+    }
+    clone->mapping_fd = -1;
+    clone->heap_grows = 1;
+    return (pool_pt) clone;
+#else
+    return NULL;
+#endif
+}
+
+alloc_status mem_pool_mark_dirty(pool_pt pool, const void *mem, size_t size) {
+    uintptr_t offset = (uintptr_t) mem - (uintptr_t) pool->mem;
+    if (offset > pool->total_size || size > pool->total_size - offset)
+        return ALLOC_FAIL;
+    if (num_watched)
+        _mem_pool_touch((pool_mgr_pt) pool, (const char *) mem, size);
+    return ALLOC_OK;
+}
+
+pool_pt mem_pool_restore(int fd) {
+    return mem_ctx_pool_restore(&default_ctx, fd);
+}
+
+pool_pt mem_ctx_pool_restore(mem_ctx_pt ctx, int fd) {
+#ifdef __unix__
+    assert(ctx->pool_store);
+    if (ctx->pool_store == NULL || _mem_resize_pool_store(ctx) != ALLOC_OK)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(mem_file_header_t))
+        return NULL;
+    // private, so the pool pages in from the snapshot lazily and its
+    // changes never reach the file
+    size_t size = (size_t) st.st_size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    pool_mgr_pt pool_mgr = _mem_pool_attach(ctx, map, size);
+    if (pool_mgr == NULL) {
+        munmap(map, size);
+        return NULL;
+    }
+    pool_mgr->mapping_fd = -1;
+    pool_mgr->heap_grows = 1;
+    return (pool_pt) pool_mgr;
+#else
+    (void) ctx;
+    (void) fd;
+    return NULL;
+#endif
+}
+
+alloc_status mem_pool_sync(pool_pt pool) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr->mapping == NULL)
+        return ALLOC_FAIL;
+#ifdef __unix__
+    if (msync(pool_mgr->mapping, pool_mgr->mapping_size, MS_SYNC) == 0)
+        return ALLOC_OK;
+#endif
+    return ALLOC_FAIL;
+}
+
+static void _mem_file_header_init(mem_file_header_pt header, size_t file_size, size_t mgr_offset,
+                                  uintptr_t base) {
+    header->version = MEM_FILE_VERSION;
+    header->mgr_bytes = sizeof(pool_mgr_t);
+    header->node_bytes = sizeof(node_t);
+    header->base = base;
+    header->file_size = file_size;
+    header->mgr_offset = mgr_offset;
+    memcpy(header->magic, MEM_FILE_MAGIC, sizeof(header->magic));
+}
+
+static unsigned _mem_file_header_valid(mem_file_header_pt header, size_t size) {
+    return memcmp(header->magic, MEM_FILE_MAGIC, sizeof(header->magic)) == 0
+           && header->version == MEM_FILE_VERSION
+           && header->mgr_bytes == sizeof(pool_mgr_t) && header->node_bytes == sizeof(node_t)
+           && header->file_size == size && header->mgr_offset >= sizeof(mem_file_header_t)
+           && header->mgr_offset <= size - sizeof(pool_mgr_t);
+}
+
+static pool_mgr_pt _mem_pool_attach(mem_ctx_pt ctx, char *map, size_t size) {
+    mem_file_header_pt header = (mem_file_header_pt) map;
+    if (! _mem_file_header_valid(header, size))
+        return NULL;
+    // an odd seqlock means the writer died in the middle of a change
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) (map + header->mgr_offset);
+    if (atomic_load(&pool_mgr->seq) & 1)
+        return NULL;
+    // the metadata has to stay inside the file
+    size_t nodes = (uintptr_t) pool_mgr->node_heap - header->base;
+    size_t gaps = (uintptr_t) pool_mgr->gap_ix - header->base;
+    size_t mem = (uintptr_t) pool_mgr->pool.mem - header->base;
+    if (! pool_mgr->in_band || pool_mgr->used_nodes > pool_mgr->total_nodes
+        || pool_mgr->pool.num_gaps > pool_mgr->gap_ix_capacity
+        || nodes > size || (size - nodes) / sizeof(node_t) < pool_mgr->total_nodes
+        || gaps > size || (size - gaps) / sizeof(gap_t) < pool_mgr->gap_ix_capacity
+        || mem > size || size - mem < pool_mgr->pool.total_size)
+        return NULL;
+
+    // the metadata points into the old mapping, which may have moved
+    if (header->base != (uintptr_t) map)
+        _mem_pool_rebase(pool_mgr, (uintptr_t) map - header->base);
+    header->base = (uintptr_t) map;
+    // and what only meant something to the old process starts over
+    _mem_pool_reset_local(pool_mgr);
+    _mem_pool_register(ctx, pool_mgr, NULL);
+    if (profile_sample_bytes)
+        _mem_profile_reset_countdown(pool_mgr);
+    if (guard_sample_rate)
+        _mem_guard_reset_countdown(pool_mgr);
+    pool_mgr->mapping = map;
+    pool_mgr->mapping_size = size;
+    MEM_PROBE3(pool_open, pool_mgr, pool_mgr->pool.total_size, (int) pool_mgr->pool.policy);
+    return pool_mgr;
+}
+
+#ifdef __unix__
+static char *_mem_shared_create(int fd, size_t size, alloc_policy policy) {
+    if (size <= sizeof(mem_shared_header_t) || ftruncate(fd, (off_t) size) != 0)
+        return NULL;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    // robust, so that a process dying with the lock does not wedge the others
+    mem_shared_header_pt shared = (mem_shared_header_pt) map;
+    pthread_mutexattr_t attr;
+    int status = pthread_mutexattr_init(&attr);
+    if (status == 0) {
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        status = pthread_mutex_init(&shared->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    size_t pool_size;
+    pool_mgr_pt pool_mgr = _mem_pool_carve(shared + 1, size - sizeof(mem_shared_header_t), &pool_size);
+    atomic_store(&shared->rebase_field, SIZE_MAX);
+    if (status != 0 || pool_mgr == NULL) {
+        munmap(map, size);
+        return NULL;
+    }
+    _mem_pool_init(pool_mgr, pool_size, policy);
+    // the magic goes in last, with the address every process maps at
+    _mem_file_header_init(&shared->file, size, (size_t) ((char *) pool_mgr - map), (uintptr_t) map);
+    return map;
+}
+
+static char *_mem_shared_attach(int fd, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(mem_shared_header_t))
+        return NULL;
+    mem_shared_header_pt peek = mmap(NULL, sizeof(mem_shared_header_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (peek == MAP_FAILED)
+        return NULL;
+    unsigned valid = _mem_file_header_valid(&peek->file, (size_t) st.st_size);
+    char *base = (char *) peek->file.base;
+    munmap(peek, sizeof(mem_shared_header_t));
+    if (! valid)
+        return NULL;
+    // where the metadata points, if that is free, which spares the
+    // rebases of _mem_shared_enter, and anywhere otherwise
+    int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    char *map = mmap(base, (size_t) st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (map == MAP_FAILED)
+        map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = (size_t) st.st_size;
+    return map;
+}
+#endif
+
+static alloc_status _mem_shared_enter(pool_mgr_pt pool_mgr) {
+#ifdef __unix__
+    mem_shared_header_pt shared = pool_mgr->shared;
+    pool_mgr_pt shared_mgr = _mem_shared_mgr(pool_mgr);
+    int status = pthread_mutex_lock(&shared->lock);
+    if (status == EOWNERDEAD) {
+        // the holder died: the pool is whole, unless it died mid-change;
+        // a rebase is not a change, and is finished for it
+        if (atomic_load(&shared->rebase_to) != 0) {
+            _mem_shared_rebase(shared);
+            atomic_fetch_add(&shared_mgr->seq, 1);
+        } else if (atomic_load(&shared_mgr->seq) & 1)
+            shared->broken = 1;
+        pthread_mutex_consistent(&shared->lock);
+    } else if (status != 0)
+        return ALLOC_FAIL;
+    if (shared->broken) {
+        pthread_mutex_unlock(&shared->lock);
+        return ALLOC_FAIL;
+    }
+    atomic_fetch_add(&shared_mgr->seq, 1);
+    // the metadata points into the mapping of the last process to change
+    // it, so a process that mapped the segment elsewhere rebases it first
+    if (shared->file.base != (uintptr_t) shared) {
+        atomic_store(&shared->rebase_to, (uintptr_t) shared);
+        _mem_shared_rebase(shared);
+    }
+    _mem_shared_copy(pool_mgr, shared_mgr);
+    return ALLOC_OK;
+#else
+    (void) pool_mgr;
+    return ALLOC_FAIL;
+#endif
+}
+
+static void _mem_shared_leave(pool_mgr_pt pool_mgr) {
+#ifdef __unix__
+    mem_shared_header_pt shared = pool_mgr->shared;
+    pool_mgr_pt shared_mgr = _mem_shared_mgr(pool_mgr);
+    _mem_shared_copy(shared_mgr, pool_mgr);
+    atomic_fetch_add(&shared_mgr->seq, 1);
+    pthread_mutex_unlock(&shared->lock);
+#else
+    (void) pool_mgr;
+#endif
+}
+
+static pool_mgr_pt _mem_shared_mgr(pool_mgr_pt pool_mgr) {
+    // the mgr in the segment, as opposed to this process's own
+    return (pool_mgr_pt) ((char *) pool_mgr->shared + pool_mgr->shared->file.mgr_offset);
+}
+
+static void _mem_shared_rebase(mem_shared_header_pt shared) {
+    // the metadata moves from file.base to rebase_to one pointer at a
+    // time down the segment list, as _mem_pool_rebase does, each logged
+    // before it is written, so that when the process dies part way the
+    // next one to take the lock finishes the move
+    pool_mgr_pt shared_mgr = (pool_mgr_pt) ((char *) shared + shared->file.mgr_offset);
+    uintptr_t from = shared->file.base;
+    uintptr_t to = atomic_load(&shared->rebase_to);
+    size_t gaps_field = 3 + 3 * (size_t) shared_mgr->total_nodes;
+    size_t num_fields = gaps_field + shared_mgr->pool.num_gaps;
+    for (size_t k = atomic_load(&shared->rebase_next), next_k; k < num_fields; k = next_k) {
+        void *field = _mem_shared_field(shared, k, to);
+        uintptr_t value = 0;
+        if (atomic_load(&shared->rebase_field) == k) {
+            // the dead process logged it, and may or may not have written it
+            value = shared->rebase_value;
+        } else {
+            memcpy(&value, field, sizeof(value));
+            // null links stay null
+            if (value != 0) {
+                value += to - from;
+                shared->rebase_value = value;
+                atomic_store(&shared->rebase_field, k);
+            }
+        }
+        if (value != 0)
+            memcpy(field, &value, sizeof(value));
+        // the list goes on at the node the link just moved points to
+        next_k = k + 1;
+        if (k >= 3 && k < gaps_field && (k - 3) % 3 == 2)
+            next_k = value == 0 ? gaps_field
+                                : 3 + 3 * ((value - (uintptr_t) shared_mgr->node_heap) / sizeof(node_t));
+        atomic_store(&shared->rebase_next, next_k);
+    }
+    // done, in an order that leaves a restart harmless
+    shared->file.base = to;
+    atomic_store(&shared->rebase_field, SIZE_MAX);
+    atomic_store(&shared->rebase_next, 0);
+    atomic_store(&shared->rebase_to, 0);
+}
+
+static void *_mem_shared_field(mem_shared_header_pt shared, size_t k, uintptr_t to) {
+    // the pointers of the metadata: the three of the mgr, three per node
+    // (the link to the next one last), one per gap
+    pool_mgr_pt shared_mgr = (pool_mgr_pt) ((char *) shared + shared->file.mgr_offset);
+    if (k == 0)
+        return &shared_mgr->pool.mem;
+    if (k == 1)
+        return &shared_mgr->node_heap;
+    if (k == 2)
+        return &shared_mgr->gap_ix;
+    // where this process maps the heap and the index, from their
+    // pointers, which are at the new base by now
+    k -= 3;
+    if (k < 3 * (size_t) shared_mgr->total_nodes) {
+        node_pt node = (node_pt) ((char *) shared + ((uintptr_t) shared_mgr->node_heap - to)) + k / 3;
+        return k % 3 == 0 ? (void *) &node->alloc_record.mem
+                          : k % 3 == 1 ? (void *) &node->prev : (void *) &node->next;
+    }
+    k -= 3 * (size_t) shared_mgr->total_nodes;
+    gap_pt gap_ix = (gap_pt) ((char *) shared + ((uintptr_t) shared_mgr->gap_ix - to));
+    return &gap_ix[k].node;
+}
+
+static void _mem_shared_copy(pool_mgr_pt to, pool_mgr_pt from) {
+    // what the allocator works on, as opposed to this process's bookkeeping
+    to->pool = from->pool;
+    to->node_heap = from->node_heap;
+    to->total_nodes = from->total_nodes;
+    to->used_nodes = from->used_nodes;
+    to->gap_ix = from->gap_ix;
+    to->gap_ix_capacity = from->gap_ix_capacity;
+    memcpy(to->tag_stats, from->tag_stats, sizeof(to->tag_stats));
+    to->last_gap = from->last_gap;
+    to->largest_gap = from->largest_gap;
+    to->num_largest = from->num_largest;
+}
+
+static void _mem_pool_reset_local(pool_mgr_pt pool_mgr) {
+    pool_mgr->ctx = NULL;
+    pool_mgr->store_ix = 0;
+    pool_mgr->retired_heaps = NULL;
+    pool_mgr->num_retired = 0;
+    pool_mgr->stats_slot = NULL;
+    pool_mgr->profile_countdown = 0;
+    pool_mgr->profile_live = 0;
+    pool_mgr->guard_countdown = 0;
+    pool_mgr->range_left = pool_mgr->range_right = NULL;
+    pool_mgr->group = NULL;
+    pool_mgr->group_ix = 0;
+    pool_mgr->parent = pool_mgr->first_child = NULL;
+    pool_mgr->next_sibling = pool_mgr->prev_sibling = NULL;
+    pool_mgr->outer = NULL;
+    pool_mgr->depth = 0;
+    pool_mgr->checkpoint = NULL;
+    pool_mgr->clone_template = NULL;
+    pool_mgr->shared = NULL;
+    pool_mgr->heap_grows = 0;
+}
+
+static void _mem_snapshot_mgr(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, pool_mgr_pt image) {
+    *image = *pool_mgr;
+    _mem_pool_reset_local(image);
+    atomic_init(&image->seq, 0);
+    image->pool.mem = (char *) layout->mem_offset;
+    image->node_heap = (node_pt) layout->nodes_offset;
+    image->gap_ix = (gap_pt) layout->gaps_offset;
+    image->total_nodes = (unsigned) layout->num_nodes;
+    image->gap_ix_capacity = (unsigned) layout->num_nodes;
+    image->simulated = 0;
+    image->in_band = 1;
+    image->mapping = NULL;
+    image->mapping_size = 0;
+    image->mapping_fd = 0;
+}
+
+static void _mem_snapshot_node(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, size_t i, node_pt image) {
+    memset(image, 0, sizeof(node_t));
+    if (i >= pool_mgr->total_nodes || ! pool_mgr->node_heap[i].used)
+        return;
+    *image = pool_mgr->node_heap[i];
+    // sampled guard-page allocations go back to their ranges in the pool
+    char *mem = image->alloc_record.mem;
+    if (_mem_guard_owns(mem))
+        mem = _mem_guard_slot(mem)->pool_mem;
+    image->alloc_record.mem = (char *) (layout->mem_offset + (size_t) (mem - pool_mgr->pool.mem));
+    image->next = _mem_snapshot_link(pool_mgr, layout, image->next);
+    image->prev = _mem_snapshot_link(pool_mgr, layout, image->prev);
+}
+
+static void _mem_snapshot_gap(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, size_t i, gap_pt image) {
+    image->size = 0;
+    image->node = NULL;
+    if (i >= pool_mgr->pool.num_gaps)
+        return;
+    image->size = pool_mgr->gap_ix[i].size;
+    image->node = _mem_snapshot_link(pool_mgr, layout, pool_mgr->gap_ix[i].node);
+}
+
+static node_pt _mem_snapshot_link(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout, node_pt node) {
+    if (node == NULL)
+        return NULL;
+    return (node_pt) (layout->nodes_offset + (size_t) (node - pool_mgr->node_heap) * sizeof(node_t));
+}
+
+static void _mem_snapshot_put(mem_snapshot_out_pt out, const void *data, size_t len) {
+    if (out->len + len > MEM_SNAPSHOT_BUFFER_SIZE)
+        _mem_snapshot_flush(out);
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+}
+
+static void _mem_snapshot_flush(mem_snapshot_out_pt out) {
+    if (! out->failed && ! _mem_write_fd(out->fd, out->buf, out->len))
+        out->failed = 1;
+    out->len = 0;
+}
+
+static unsigned _mem_pwrite_fd(int fd, const char *data, size_t len, off_t offset) {
+#ifdef __unix__
+    while (len > 0) {
+        ssize_t written = pwrite(fd, data, len, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 0;
+        data += written;
+        len -= (size_t) written;
+        offset += written;
+    }
+    return 1;
+#else
+    (void) fd;
+    (void) data;
+    (void) offset;
+    return len == 0;
+#endif
+}
+
+static alloc_status _mem_pool_write_image(pool_mgr_pt pool_mgr, int fd, size_t num_nodes, mem_snapshot_layout_pt layout) {
+    // the image of an in-band pool file, pointers being file offsets (base 0),
+    // with room for num_nodes nodes, or as many as the pool has
+    layout->num_nodes = num_nodes;
+    if (layout->num_nodes < pool_mgr->total_nodes)
+        layout->num_nodes = pool_mgr->total_nodes;
+    layout->nodes_offset = sizeof(mem_file_header_t) + sizeof(pool_mgr_t);
+    layout->gaps_offset = layout->nodes_offset + layout->num_nodes * sizeof(node_t);
+    layout->mem_offset = layout->gaps_offset + layout->num_nodes * sizeof(gap_t);
+
+    mem_snapshot_out_t out = { fd, (char *) malloc(MEM_SNAPSHOT_BUFFER_SIZE), 0, 0 };
+    if (out.buf == NULL)
+        return ALLOC_FAIL;
+    mem_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    _mem_file_header_init(&header, layout->mem_offset + pool_mgr->pool.total_size, sizeof(mem_file_header_t), 0);
+    _mem_snapshot_put(&out, &header, sizeof(header));
+    pool_mgr_t image;
+    _mem_snapshot_mgr(pool_mgr, layout, &image);
+    _mem_snapshot_put(&out, &image, sizeof(image));
+    for (size_t i = 0; i < layout->num_nodes; i++) {
+        node_t node;
+        _mem_snapshot_node(pool_mgr, layout, i, &node);
+        _mem_snapshot_put(&out, &node, sizeof(node));
+    }
+    for (size_t i = 0; i < layout->num_nodes; i++) {
+        gap_t gap;
+        _mem_snapshot_gap(pool_mgr, layout, i, &gap);
+        _mem_snapshot_put(&out, &gap, sizeof(gap));
+    }
+    _mem_snapshot_flush(&out);
+    free(out.buf);
+
+    // the memory, in runs as long as the guard-page allocations allow
+    char *run = pool_mgr->pool.mem;
+    for (node_pt node = pool_mgr->node_heap; node != NULL && ! out.failed; node = node->next) {
+        char *mem = node->alloc_record.mem;
+        if (! node->allocated || ! _mem_guard_owns(mem))
+            continue;
+        guard_slot_pt slot = _mem_guard_slot(mem);
+        out.failed = ! _mem_write_fd(fd, run, (size_t) (slot->pool_mem - run))
+                     || ! _mem_write_fd(fd, mem, slot->size);
+        run = slot->pool_mem + slot->size;
+    }
+    if (! out.failed)
+        out.failed = ! _mem_write_fd(fd, run, (size_t) (pool_mgr->pool.mem + pool_mgr->pool.total_size - run));
+    return out.failed ? ALLOC_FAIL : ALLOC_OK;
+}
+
+static alloc_status _mem_template_make(pool_mgr_pt pool_mgr) {
+#ifdef __unix__
+    size_t num_pages = (pool_mgr->pool.total_size + MEM_CHECKPOINT_PAGE_SIZE - 1) / MEM_CHECKPOINT_PAGE_SIZE;
+    mem_template_pt tmpl = (mem_template_pt) calloc(1, sizeof(mem_template_t));
+    if (tmpl == NULL)
+        return ALLOC_FAIL;
+    tmpl->dirty = (unsigned char *) calloc((num_pages + 7) / 8 + 1, 1);
+    // an unlinked shared memory object, only ever mapped privately
+    char name[64];
+    snprintf(name, sizeof(name), "/mem_pool.%ld.clone.%u", (long) getpid(), num_templates_made++);
+    tmpl->fd = tmpl->dirty ? shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600) : -1;
+    if (tmpl->fd < 0) {
+        free(tmpl->dirty);
+        free(tmpl);
+        return ALLOC_FAIL;
+    }
+    shm_unlink(name);
+    // with the node heap as it is, since clones grow theirs
+    if (_mem_pool_write_image(pool_mgr, tmpl->fd, 0, &tmpl->layout) != ALLOC_OK) {
+        close(tmpl->fd);
+        free(tmpl->dirty);
+        free(tmpl);
+        return ALLOC_FAIL;
+    }
+    tmpl->size = tmpl->layout.mem_offset + pool_mgr->pool.total_size;
+    pool_mgr->clone_template = tmpl;
+    num_watched++;
+    return ALLOC_OK;
+#else
+    (void) pool_mgr;
+    return ALLOC_FAIL;
+#endif
+}
+
+static void _mem_template_drop(pool_mgr_pt pool_mgr) {
+    // the clones keep their mappings of it
+    mem_template_pt tmpl = pool_mgr->clone_template;
+#ifdef __unix__
+    close(tmpl->fd);
+#endif
+    free(tmpl->dirty);
+    free(tmpl);
+    pool_mgr->clone_template = NULL;
+    num_watched--;
+}
+
+static void _mem_template_update(pool_mgr_pt pool_mgr, char *map) {
+    // bring a private mapping of the template up to date with the pool: the
+    // metadata whole, the memory only in the pages that changed, which are
+    // the only ones the clone does not share with the others
+    mem_template_pt tmpl = pool_mgr->clone_template;
+    mem_snapshot_layout_pt layout = &tmpl->layout;
+    _mem_snapshot_mgr(pool_mgr, layout, (pool_mgr_pt) (map + sizeof(mem_file_header_t)));
+    for (size_t i = 0; i < layout->num_nodes; i++)
+        _mem_snapshot_node(pool_mgr, layout, i, (node_pt) (map + layout->nodes_offset) + i);
+    for (size_t i = 0; i < layout->num_nodes; i++)
+        _mem_snapshot_gap(pool_mgr, layout, i, (gap_pt) (map + layout->gaps_offset) + i);
+    char *mem = map + layout->mem_offset;
+    size_t num_pages = (pool_mgr->pool.total_size + MEM_CHECKPOINT_PAGE_SIZE - 1) / MEM_CHECKPOINT_PAGE_SIZE;
+    for (size_t page = 0; page < num_pages && tmpl->num_dirty; ) {
+        if (! (tmpl->dirty[page / 8] & (1u << page % 8))) {
+            page += tmpl->dirty[page / 8] ? 1 : 8 - page % 8;
+            continue;
+        }
+        size_t end = page;
+        while (end < num_pages && (tmpl->dirty[end / 8] & (1u << end % 8)))
+            end++;
+        size_t from = page * MEM_CHECKPOINT_PAGE_SIZE;
+        size_t to = end * MEM_CHECKPOINT_PAGE_SIZE;
+        if (to > pool_mgr->pool.total_size)
+            to = pool_mgr->pool.total_size;
+        memcpy(mem + from, pool_mgr->pool.mem + from, to - from);
+        page = end;
+    }
+    // sampled guard-page allocations, always, since their data is elsewhere
+    if (guard_sample_rate) {
+        _mem_guard_lock();
+        for (unsigned i = 0; i < guard_num_slots; i++) {
+            guard_slot_pt slot = &guard_slots[i];
+            if (slot->pool_mgr != pool_mgr || slot->freed)
+                continue;
+            char *page = guard_region + (2 * (size_t) i + 1) * guard_page_size;
+            memcpy(mem + (slot->pool_mem - pool_mgr->pool.mem), page + guard_page_size - slot->size, slot->size);
+        }
+        _mem_guard_unlock();
+    }
+}
+
+static void _mem_checkpoint_begin(pool_mgr_pt pool_mgr, mem_snapshot_layout_pt layout) {
+    // without the memory for tracking, the next checkpoint is a snapshot
+    _mem_checkpoint_end(pool_mgr);
+    size_t num_pages = (pool_mgr->pool.total_size + MEM_CHECKPOINT_PAGE_SIZE - 1) / MEM_CHECKPOINT_PAGE_SIZE;
+    size_t num_chunks = (layout->num_nodes + MEM_CHECKPOINT_CHUNK - 1) / MEM_CHECKPOINT_CHUNK;
+    mem_checkpoint_pt checkpoint = (mem_checkpoint_pt) calloc(1, sizeof(mem_checkpoint_t));
+    if (checkpoint == NULL)
+        return;
+    checkpoint->layout = *layout;
+    checkpoint->dirty = (unsigned char *) calloc((num_pages + 7) / 8 + 1, 1);
+    checkpoint->node_hash = (uint64_t *) calloc(num_chunks, sizeof(uint64_t));
+    checkpoint->gap_hash = (uint64_t *) calloc(num_chunks, sizeof(uint64_t));
+    if (checkpoint->dirty == NULL || checkpoint->node_hash == NULL || checkpoint->gap_hash == NULL) {
+        free(checkpoint->dirty);
+        free(checkpoint->node_hash);
+        free(checkpoint->gap_hash);
+        free(checkpoint);
+        return;
+    }
+    for (size_t c = 0; c < num_chunks; c++) {
+        size_t first = c * MEM_CHECKPOINT_CHUNK;
+        size_t count = _mem_checkpoint_count(first, pool_mgr->total_nodes);
+        checkpoint->node_hash[c] = _mem_checkpoint_hash(pool_mgr->node_heap + first, count * sizeof(node_t));
+        count = _mem_checkpoint_count(first, pool_mgr->pool.num_gaps);
+        checkpoint->gap_hash[c] = _mem_checkpoint_hash(pool_mgr->gap_ix + first, count * sizeof(gap_t));
+    }
+    pool_mgr->checkpoint = checkpoint;
+    num_watched++;
+}
+
+static void _mem_checkpoint_end(pool_mgr_pt pool_mgr) {
+    mem_checkpoint_pt checkpoint = pool_mgr->checkpoint;
+    if (checkpoint == NULL)
+        return;
+    free(checkpoint->dirty);
+    free(checkpoint->node_hash);
+    free(checkpoint->gap_hash);
+    free(checkpoint);
+    pool_mgr->checkpoint = NULL;
+    num_watched--;
+}
+
+static void _mem_pool_touch(pool_mgr_pt pool_mgr, const char *mem, size_t size) {
+    // in this pool and every one around it: the metadata of a template is
+    // out of date, and a template or checkpoint has to copy the pages of mem
+    unsigned in_memory = 0;
+    for (; pool_mgr != NULL; pool_mgr = pool_mgr->outer) {
+        _mem_pool_mark(pool_mgr, mem, size);
+        // an in-band pool has metadata in the memory of the pools around it,
+        // which would take marking its whole node heap, so theirs are rewritten
+        if (in_memory && pool_mgr->clone_template)
+            pool_mgr->clone_template->stale = 1;
+        if (pool_mgr->in_band && pool_mgr->mapping == NULL)
+            in_memory = 1;
+    }
+}
+
+static void _mem_pool_mark(pool_mgr_pt pool_mgr, const char *mem, size_t size) {
+    mem_template_pt tmpl = pool_mgr->clone_template;
+    if (tmpl != NULL)
+        tmpl->changed = 1;
+    mem_checkpoint_pt checkpoint = pool_mgr->checkpoint;
+    if ((tmpl == NULL && checkpoint == NULL) || size == 0)
+        return;
+    size_t offset = (size_t) (mem - pool_mgr->pool.mem);
+    // a pool in a sampled allocation of this one is on a guard page,
+    // whose data every checkpoint and clone copies anyway
+    if (offset >= pool_mgr->pool.total_size || size > pool_mgr->pool.total_size - offset)
+        return;
+    size_t last = (offset + size - 1) / MEM_CHECKPOINT_PAGE_SIZE;
+    for (size_t page = offset / MEM_CHECKPOINT_PAGE_SIZE; page <= last; page++) {
+        unsigned char bit = (unsigned char) (1u << page % 8);
+        if (checkpoint != NULL)
+            checkpoint->dirty[page / 8] |= bit;
+        if (tmpl != NULL && ! (tmpl->dirty[page / 8] & bit)) {
+            tmpl->dirty[page / 8] |= bit;
+            tmpl->num_dirty++;
+        }
+    }
+    // past a share of the pages, copying them into every clone costs more
+    // than a new template
+    size_t num_pages = (pool_mgr->pool.total_size + MEM_CHECKPOINT_PAGE_SIZE - 1) / MEM_CHECKPOINT_PAGE_SIZE;
+    if (tmpl != NULL && tmpl->num_dirty * MEM_TEMPLATE_REWRITE_SHARE > num_pages)
+        tmpl->stale = 1;
+}
+
+static size_t _mem_checkpoint_count(size_t first, size_t total) {
+    // entries of the chunk starting at first that are in use
+    if (first >= total)
+        return 0;
+    return total - first < MEM_CHECKPOINT_CHUNK ? total - first : MEM_CHECKPOINT_CHUNK;
+}
+
+static uint64_t _mem_checkpoint_hash(const void *data, size_t len) {
+    // word at a time, since the node heap is hashed whole at each checkpoint
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    for (size_t i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+static unsigned _mem_write_fd(int fd, const char *data, size_t len) {
+#ifdef __unix__
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 0;
+        data += written;
+        len -= (size_t) written;
+    }
+    return 1;
+#else
+    (void) fd;
+    (void) data;
+    return len == 0;
+#endif
+}
+
+static pool_pt _mem_pool_setup(mem_ctx_pt ctx, pool_mgr_pt pool_mgr, size_t size, alloc_policy policy,
+                               pool_mgr_pt parent) {
+    _mem_pool_init(pool_mgr, size, policy);
+    _mem_pool_register(ctx, pool_mgr, parent);
+    if (profile_sample_bytes)
+        _mem_profile_reset_countdown(pool_mgr);
+    if (guard_sample_rate)
+        _mem_guard_reset_countdown(pool_mgr);
+    MEM_PROBE3(pool_open, pool_mgr, size, (int) policy);
+    return (pool_pt) pool_mgr;
+}
+
+static void _mem_pool_init(pool_mgr_pt pool_mgr, size_t size, alloc_policy policy) {
     // assign all the pointers and update meta data:
     pool_mgr->pool.total_size = size;
     pool_mgr->pool.alloc_size= 0;
@@ -183,62 +1796,272 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     //   initialize top node of gap index
     pool_mgr->gap_ix[0].size = pool_mgr->node_heap->alloc_record.size;
     pool_mgr->gap_ix[0].node = pool_mgr->node_heap;
+    pool_mgr->largest_gap = size;
+    pool_mgr->num_largest = 1;
 
     //   initialize pool mgr
-    // pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-    pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
     pool_mgr->used_nodes = 1;
-    pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+}
+
+static pool_mgr_pt _mem_pool_carve(void *buf, size_t size, size_t *pool_size) {
+    // carve the mgr, a fixed node heap and gap index, and the memory out
+    // of the buffer; a pool has at most one gap per node
+    uintptr_t start = ((uintptr_t) buf + _Alignof(pool_mgr_t) - 1) & ~(uintptr_t) (_Alignof(pool_mgr_t) - 1);
+    size_t num_nodes = size / MEM_IN_BAND_BYTES_PER_NODE;
+    if (num_nodes < MEM_NODE_HEAP_INIT_CAPACITY)
+        num_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    size_t metadata = (start - (uintptr_t) buf) + sizeof(pool_mgr_t) + num_nodes * (sizeof(node_t) + sizeof(gap_t));
+    if (buf == NULL || metadata >= size)
+        return NULL;
+
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) start;
+    memset(pool_mgr, 0, metadata - (start - (uintptr_t) buf));
+    pool_mgr->in_band = 1;
+    pool_mgr->node_heap = (node_pt) (pool_mgr + 1);
+    pool_mgr->gap_ix = (gap_pt) (pool_mgr->node_heap + num_nodes);
+    pool_mgr->pool.mem = (char *) (pool_mgr->gap_ix + num_nodes);
+    pool_mgr->total_nodes = (unsigned) num_nodes;
+    pool_mgr->gap_ix_capacity = (unsigned) num_nodes;
+    *pool_size = size - metadata;
+    return pool_mgr;
+}
+
+static void _mem_pool_register(mem_ctx_pt ctx, pool_mgr_pt pool_mgr, pool_mgr_pt parent) {
+    pool_mgr->ctx = ctx;
+    //   link a child pool to its parent
+    if (parent != NULL) {
+        pool_mgr->parent = parent;
+        pool_mgr->next_sibling = parent->first_child;
+        if (parent->first_child != NULL)
+            parent->first_child->prev_sibling = pool_mgr;
+        parent->first_child = pool_mgr;
+    }
+    //   and any pool to the innermost one its memory is in, for mem_pool_of
+    pool_mgr->outer = parent;
+    if (parent == NULL && ! pool_mgr->simulated)
+        pool_mgr->outer = (pool_mgr_pt) mem_pool_of(pool_mgr->pool.mem);
+    pool_mgr->depth = pool_mgr->outer ? pool_mgr->outer->depth + 1 : 0;
+    //   index the pool memory for mem_pool_of
+    _mem_range_insert(pool_mgr);
     //   link pool mgr to pool store
     // return the address of the mgr, cast to (pool_pt)
     //unsigned int i;
     //while (pool_store[i] != NULL) {
     //    ++i;
     //}
-    pool_store[pool_store_size] = pool_mgr;
-//    pool_mgr->pool.num_allocs= 0;
-//    pool_mgr->pool.num_gaps = 1;
-//     return the address of the mgr, cast to (pool_pt)
-    pool_store_size ++;
-    return (pool_pt) pool_mgr;
+    //   reuse a slot freed by mem_pool_close before taking a new one
+    pool_mgr->store_ix = ctx->num_free_slots ? ctx->free_slots[--ctx->num_free_slots]
+                                             : ctx->pool_store_size++;
+    ctx->pool_store[pool_mgr->store_ix] = pool_mgr;
+    _mem_stats_attach(pool_mgr);
 }
 
 alloc_status mem_pool_close(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
     // check if this pool is allocated
-    if ( pool_mgr->pool.mem == NULL || pool_mgr->pool.num_gaps >1 || pool_mgr->pool.num_allocs >0) {
+    // a child pool is released whatever it holds, a file-backed one keeps it
+    if (pool_mgr->parent == NULL && pool_mgr->mapping == NULL
+        && ((pool_mgr->pool.mem == NULL && ! pool_mgr->simulated)
+            || pool_mgr->pool.num_gaps >1 || pool_mgr->pool.num_allocs >0)) {
         return ALLOC_NOT_FREED;
     }
     // check if pool has only one gap
     // check if it has zero allocations
 
-    // free memory pool
-    free(pool_mgr->pool.mem);
+    pool_mgr_pt parent = pool_mgr->parent;
+    alloc_t region = { pool_mgr->pool.total_size, pool_mgr->pool.mem };
+    _mem_pool_free(pool_mgr);
+    // hand a child's region back to its parent in one deallocation
+    if (parent != NULL)
+        return mem_del_alloc((pool_pt) parent, &region);
+    return ALLOC_OK;
+}
+
+static void _mem_pool_free(pool_mgr_pt pool_mgr) {
+    MEM_PROBE1(pool_close, pool_mgr);
+    // child pools go with their regions, live allocations with the pool
+    while (pool_mgr->first_child != NULL)
+        _mem_pool_free(pool_mgr->first_child);
+    if (pool_mgr->pool.num_allocs > 0)
+        _mem_pool_drop_samples(pool_mgr);
+    if (pool_mgr->parent != NULL) {
+        if (pool_mgr->prev_sibling != NULL)
+            pool_mgr->prev_sibling->next_sibling = pool_mgr->next_sibling;
+        else
+            pool_mgr->parent->first_child = pool_mgr->next_sibling;
+        if (pool_mgr->next_sibling != NULL)
+            pool_mgr->next_sibling->prev_sibling = pool_mgr->prev_sibling;
+    }
+    if (pool_mgr->group)
+        mem_group_remove(pool_mgr->group, (pool_pt) pool_mgr);
+    _mem_stats_detach(pool_mgr);
+    _mem_range_erase(pool_mgr);
+    _mem_checkpoint_end(pool_mgr);
+    if (pool_mgr->clone_template)
+        _mem_template_drop(pool_mgr);
+    // set the mgr's slot in the pool store to null, and free it for reuse
+    mem_ctx_pt ctx = pool_mgr->ctx;
+    ctx->pool_store[pool_mgr->store_ix] = NULL;
+    ctx->free_slots[ctx->num_free_slots++] = pool_mgr->store_ix;
+    // the buffer of an in-band pool stays the caller's
+    if (pool_mgr->in_band) {
+        struct _mem_shared_header *shared = pool_mgr->shared;
+        if (pool_mgr->heap_grows)
+            _mem_pool_free_heaps(pool_mgr);
+#ifdef __unix__
+        // unmapping last, since the mgr lives in the mapping
+        if (pool_mgr->mapping != NULL) {
+            int fd = pool_mgr->mapping_fd;
+            munmap(pool_mgr->mapping, pool_mgr->mapping_size);
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+        // except for the mgr of a shared pool, which is this process's own
+        if (shared != NULL)
+            free(pool_mgr);
+        return;
+    }
+    // free memory pool, unless it belongs to the parent
+    if (pool_mgr->parent == NULL)
+        free(pool_mgr->pool.mem);
     pool_mgr->pool.mem = NULL;
-    // free node heap
-    free(pool_mgr->node_heap);
+    _mem_pool_free_heaps(pool_mgr);
+    // free mgr
+    free(pool_mgr);
+}
+
+static void _mem_pool_free_heaps(pool_mgr_pt pool_mgr) {
+    // free node heap, and the ones it replaced, but not what is in the mapping
+    if (! _mem_pool_maps(pool_mgr, pool_mgr->node_heap))
+        free(pool_mgr->node_heap);
     pool_mgr->node_heap = NULL;
+    for (unsigned i = 0; i < pool_mgr->num_retired; i++)
+        free(pool_mgr->retired_heaps[i]);
+    free(pool_mgr->retired_heaps);
+    pool_mgr->retired_heaps = NULL;
     // free gap index
-    free(pool_mgr->gap_ix);
+    if (! _mem_pool_maps(pool_mgr, pool_mgr->gap_ix))
+        free(pool_mgr->gap_ix);
     pool_mgr->gap_ix =NULL;
-    // find mgr in pool store and set to null
+}
 
-    for ( int i = 0; i< pool_store_capacity; i++){
-        if (pool_mgr == pool_store[i]) {
-            pool_store[i] = NULL;
-            break;
+static unsigned _mem_pool_maps(pool_mgr_pt pool_mgr, const void *ptr) {
+    return pool_mgr->mapping != NULL
+           && (uintptr_t) ptr - (uintptr_t) pool_mgr->mapping < pool_mgr->mapping_size;
+}
+
+static void _mem_pool_drop_samples(pool_mgr_pt pool_mgr) {
+    // the heap profile samples and guard slots of allocations released in bulk
+    if (pool_mgr->profile_live) {
+        _mem_profile_lock();
+        for (unsigned i = 0; pool_mgr->profile_live > 0 && i < profile_live_capacity; i++) {
+            if (profile_live[i].used && profile_live[i].pool_mgr == pool_mgr) {
+                _mem_profile_remove(pool_mgr, profile_live[i].mem);
+                i--; // the backward shift may have moved another entry here
+            }
         }
+        _mem_profile_unlock();
     }
-    // note: don't decrement pool_store_size, because it only grows
-    // free mgr
-    free(pool_mgr);
-    pool_mgr = NULL;
-
-    return ALLOC_OK;
+#ifdef __unix__
+    if (guard_sample_rate) {
+        _mem_guard_lock();
+        for (unsigned i = 0; i < guard_num_slots; i++) {
+            guard_slot_pt slot = &guard_slots[i];
+            if (slot->pool_mgr != pool_mgr || slot->freed)
+                continue;
+            mprotect(guard_region + (2 * (size_t) i + 1) * guard_page_size, guard_page_size, PROT_NONE);
+            slot->freed = 1;
+            slot->free_depth = 0;
+            guard_free[(guard_free_head + guard_num_free) % guard_num_slots] = i;
+            guard_num_free++;
+        }
+        _mem_guard_unlock();
+    }
+#endif
 }
 
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+    return _mem_new_alloc_tagged(pool, size, thread_tag, MEM_CALLER());
+}
+
+alloc_pt mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag) {
+    return _mem_new_alloc_tagged(pool, size, tag, MEM_CALLER());
+}
+
+static alloc_pt _mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag, void *caller) {
+    if (tag >= MEM_NUM_TAGS)
+        return NULL;
+    MEM_PROBE2(alloc_entry, pool, size);
+    if (((pool_mgr_pt) pool)->shared != NULL && _mem_shared_enter((pool_mgr_pt) pool) != ALLOC_OK)
+        return NULL;
+    _mem_write_begin((pool_mgr_pt) pool);
+    alloc_pt alloc = _mem_new_alloc(pool, size);
+    if (alloc != NULL) {
+        if (num_watched)
+            _mem_pool_touch((pool_mgr_pt) pool, alloc->mem, size);
+        pool_tag_stats_pt stats = &((pool_mgr_pt) pool)->tag_stats[tag];
+        ((node_pt) alloc)->tag = (unsigned short) tag;
+        stats->live_bytes += size;
+        stats->live_allocs++;
+        stats->total_allocs++;
+        if (stats->live_bytes > stats->peak_bytes)
+            stats->peak_bytes = stats->live_bytes;
+        if (guard_sample_rate && --((pool_mgr_pt) pool)->guard_countdown <= 0)
+            _mem_guard_alloc((pool_mgr_pt) pool, alloc);
+    }
+    _mem_write_end((pool_mgr_pt) pool);
+    if (((pool_mgr_pt) pool)->shared != NULL) {
+        // not the node, which another process may rebase once the lock is gone
+        if (alloc != NULL) {
+            ((pool_mgr_pt) pool)->shared_alloc = *alloc;
+            alloc = &((pool_mgr_pt) pool)->shared_alloc;
+        }
+        _mem_shared_leave((pool_mgr_pt) pool);
+    }
+    if (atomic_load_explicit(&stats_requested, memory_order_relaxed))
+        _mem_stats_on_request();
+    if (profile_sample_bytes && alloc != NULL) {
+        // sample 1 in every profile_sample_bytes bytes on average
+        pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+        pool_mgr->profile_countdown -= (long long) size;
+        if (pool_mgr->profile_countdown <= 0)
+            _mem_profile_alloc(pool_mgr, alloc, caller);
+    }
+    _mem_stats_update((pool_mgr_pt) pool, alloc != NULL, 0, alloc == NULL);
+    if (((pool_mgr_pt) pool)->group && alloc != NULL)
+        _mem_group_rekey((pool_mgr_pt) pool);
+    MEM_PROBE3(alloc_return, pool, size, alloc ? alloc->mem : NULL);
+    return alloc;
+}
+
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+    char *mem = alloc->mem;
+    MEM_PROBE2(free_entry, pool, mem);
+    if (((pool_mgr_pt) pool)->shared != NULL && _mem_shared_enter((pool_mgr_pt) pool) != ALLOC_OK)
+        return ALLOC_FAIL;
+    _mem_write_begin((pool_mgr_pt) pool);
+    alloc_status status = _mem_guard_owns(mem) && ! ((pool_mgr_pt) pool)->simulated
+                          ? _mem_guard_free((pool_mgr_pt) pool, alloc)
+                          : _mem_del_alloc(pool, alloc);
+    _mem_write_end((pool_mgr_pt) pool);
+    if (((pool_mgr_pt) pool)->shared != NULL)
+        _mem_shared_leave((pool_mgr_pt) pool);
+    if (num_watched && status == ALLOC_OK)
+        _mem_pool_touch((pool_mgr_pt) pool, NULL, 0);
+    if (atomic_load_explicit(&stats_requested, memory_order_relaxed))
+        _mem_stats_on_request();
+    if (((pool_mgr_pt) pool)->profile_live && status == ALLOC_OK)
+        _mem_profile_free((pool_mgr_pt) pool, mem);
+    _mem_stats_update((pool_mgr_pt) pool, 0, status == ALLOC_OK, 0);
+    if (((pool_mgr_pt) pool)->group && status == ALLOC_OK)
+        _mem_group_rekey((pool_mgr_pt) pool);
+    MEM_PROBE3(free_return, pool, mem, (int) status);
+    return status;
+}
+
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
     // check if any gaps, return null if none
@@ -248,12 +2071,9 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
         return NULL;
     }
 
-    // alloc_status status = _mem_resize_node_heap(pool_mgr);
-    //if ( status!= ALLOC_OK)
-    //    return NULL;
-
     // expand heap node, if necessary, quit on error
-    // assert(_mem_resize_node_heap(pool_mgr)==ALLOC_OK);
+    if (_mem_resize_node_heap(pool_mgr) != ALLOC_OK)
+        return NULL;
 
     // check used nodes fewer than total nodes, quit on error
     //assert(pool_mgr->used_nodes >= pool_mgr->total_nodes);
@@ -301,7 +2121,7 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
    // new_node->used =1;
     new_node->alloc_record.size =size;
     // adjust node heap:
-    node_pt unused_node;
+    node_pt unused_node = NULL;
     //   if remaining gap, need a new node
     if ( remaining_gap !=0) {
         //   find an unused one in the node heap
@@ -319,7 +2139,8 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
         //   update metadata (used_nodes)
         unused_node->allocated = 0;
         unused_node->used = 1;
-        unused_node->alloc_record.mem = new_node->alloc_record.mem + size;
+        // integer arithmetic, since a simulated pool has no base address
+        unused_node->alloc_record.mem = (char *) ((uintptr_t) new_node->alloc_record.mem + size);
         unused_node->alloc_record.size = remaining_gap;
         pool_mgr->used_nodes++;
 
@@ -345,6 +2166,7 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
 
         alloc_status status = _mem_add_to_gap_ix(pool_mgr, remaining_gap, unused_node);
         assert(status == ALLOC_OK);
+        MEM_PROBE4(split, pool, new_node->alloc_record.mem, size, remaining_gap);
     }
     if (new_node == NULL)
         return NULL;
@@ -353,16 +2175,18 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
 }
 
 // TODO DONE DONE DONE !!!!
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
     // get node from alloc by casting the pointer to (node_pt)
     node_pt new_node = (node_pt) alloc;
     // find the node in the node heap
     // this is node-to-delete
-    node_pt node_to_delete;
+    node_pt node_to_delete = NULL;
     for ( int i =0; i < pool_mgr->total_nodes; i++) {
-        if ((new_node->alloc_record.mem) == (pool_mgr->node_heap[i].alloc_record.mem)){
+        // unused nodes have a NULL mem, which is also offset 0 of a simulated pool
+        if (pool_mgr->node_heap[i].used && pool_mgr->node_heap[i].allocated
+            && (new_node->alloc_record.mem) == (pool_mgr->node_heap[i].alloc_record.mem)){
             node_to_delete = &pool_mgr->node_heap[i];
             break;
         }
@@ -372,9 +2196,11 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
         return ALLOC_NOT_FREED;
     // convert to gap node
     node_to_delete->allocated = 0;
-    // update metadata (num_allocs, alloc_size)
+    // update metadata (num_allocs, alloc_size, tag accounting)
     pool_mgr->pool.num_allocs --;
     pool_mgr->pool.alloc_size -= node_to_delete->alloc_record.size;
+    pool_mgr->tag_stats[node_to_delete->tag].live_bytes -= node_to_delete->alloc_record.size;
+    pool_mgr->tag_stats[node_to_delete->tag].live_allocs--;
     // if the next node in the list is also a gap, merge into node-to-delete
     //   remove the next node from gap index
     //   check success
@@ -382,7 +2208,7 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     //   update node as unused
     node_pt next_node;
     if ((node_to_delete->next !=NULL) && (node_to_delete->next->allocated == 0)
-        && (node_to_delete->next->used =1)) {
+        && (node_to_delete->next->used == 1)) {
         next_node = node_to_delete->next;
         //next_node->alloc_record.size = node_to_delete->alloc_record.size;
         _mem_remove_from_gap_ix(pool_mgr, next_node->alloc_record.size, next_node);
@@ -414,8 +2240,10 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
         }
         next_node->next = NULL;
         next_node->prev = NULL;
+        MEM_PROBE3(merge, pool, node_to_delete->alloc_record.mem, node_to_delete->alloc_record.size);
     }
     _mem_add_to_gap_ix(pool_mgr,node_to_delete->alloc_record.size, node_to_delete);
+    pool_mgr->last_gap = node_to_delete->alloc_record.size;
 
     // this merged node-to-delete might need to be added to the gap index
     // but one more thing to check...
@@ -426,7 +2254,7 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     //   update node-to-delete as unused
     node_pt pre_node;
     if((node_to_delete->prev != NULL) &&(node_to_delete->prev->allocated == 0)
-       && ( node_to_delete->prev->used =1) ) {
+       && ( node_to_delete->prev->used == 1) ) {
         pre_node = node_to_delete->prev;
         alloc_status status = _mem_remove_from_gap_ix(pool_mgr, pre_node->alloc_record.size, pre_node);
         if (status == ALLOC_FAIL)
@@ -435,6 +2263,7 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
         if (status == ALLOC_FAIL)
             return ALLOC_FAIL;
         pre_node->alloc_record.size = node_to_delete->alloc_record.size + node_to_delete->prev->alloc_record.size;
+        pool_mgr->last_gap = pre_node->alloc_record.size;
         node_to_delete->used = 0;
         node_to_delete->alloc_record.size = 0;
         node_to_delete->alloc_record.mem = NULL;
@@ -470,6 +2299,7 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
         // check success
 
         _mem_add_to_gap_ix(pool_mgr, pre_node->alloc_record.size, pre_node);
+        MEM_PROBE3(merge, pool, pre_node->alloc_record.mem, pre_node->alloc_record.size);
     }
     return ALLOC_OK;
 }
@@ -479,12 +2309,17 @@ void mem_inspect_pool(pool_pt pool,
                       unsigned *num_segments) {
     // get the mgr from the pool
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr->shared != NULL && _mem_shared_enter(pool_mgr) != ALLOC_OK)
+        return;
     // allocate the segments array with size == used_nodes
     pool_segment_pt segs = (pool_segment_pt ) calloc(pool_mgr->used_nodes, sizeof(pool_segment_t));
     // check successful
     //assert(segs);
-    if (segs == NULL)
+    if (segs == NULL) {
+        if (pool_mgr->shared != NULL)
+            _mem_shared_leave(pool_mgr);
         return;
+    }
 
 
     // loop through the node heap and the segments array
@@ -506,6 +2341,373 @@ void mem_inspect_pool(pool_pt pool,
     */
     *segments = segs;
     *num_segments = pool_mgr->used_nodes;
+    if (pool_mgr->shared != NULL)
+        _mem_shared_leave(pool_mgr);
+}
+
+/*
+ * Segment iterator: walks the node list in address order without
+ * allocating, so it can be called as often as needed. The pool must
+ * not be modified between init and the last next, since the node heap
+ * may move; the other processes of a shared pool modify it anyway, so
+ * its walk checks the pool's seqlock at every step and ends early,
+ * setting changed, once it moved.
+ */
+void mem_segment_iter_init(pool_pt pool,
+                           pool_segment_iter_pt iter,
+                           unsigned gaps_only,
+                           size_t min_size) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    iter->pool = pool;
+    // the first node of the heap is always the head of the list
+    iter->next = pool_mgr->node_heap;
+    iter->gaps_only = gaps_only;
+    iter->min_size = min_size;
+    iter->seq = _mem_read_begin(_mem_read_source(pool_mgr));
+    iter->changed = 0;
+}
+
+unsigned mem_segment_iter_next(pool_segment_iter_pt iter, pool_segment_pt segment) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) iter->pool;
+    const node_t *node = (const node_t *) iter->next;
+    while (node != NULL) {
+        size_t size = node->alloc_record.size;
+        unsigned allocated = node->allocated;
+        node = _mem_read_next(pool_mgr, node);
+        if (pool_mgr->shared != NULL && _mem_read_retry(_mem_read_source(pool_mgr), iter->seq)) {
+            iter->changed = 1;
+            break;
+        }
+        iter->next = node;
+        if ((! iter->gaps_only || ! allocated) && size >= iter->min_size) {
+            segment->size = size;
+            segment->allocated = allocated;
+            return 1;
+        }
+    }
+    iter->next = NULL;
+    return 0;
+}
+
+/*
+ * Lock-free readers for monitoring threads. Writers (mem_new_alloc and
+ * mem_del_alloc, serialized by the caller) bump the pool's sequence
+ * number before and after every change and never wait for readers.
+ * A reader copies what it needs and retries if the sequence number was
+ * odd or moved meanwhile; after MEM_READ_MAX_RETRIES it gives up with
+ * ALLOC_FAIL, so callers decide whether to try again later or lock.
+ * Old node heaps are kept until mem_pool_close, so a walk that races
+ * with a heap resize reads stale but valid memory. A shared pool is
+ * read in its segment, under the seqlock there, and its links are
+ * translated into this process's mapping and checked to stay in the
+ * node heap, since other processes change them.
+ */
+alloc_status mem_read_pool(pool_pt pool, pool_pt stats) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    pool_mgr_pt source = _mem_read_source(pool_mgr);
+    for (unsigned retry = 0; retry < MEM_READ_MAX_RETRIES; retry++) {
+        unsigned seq = _mem_read_begin(source);
+        *stats = source->pool;
+        if (! _mem_read_retry(source, seq)) {
+            stats->mem = pool_mgr->pool.mem;
+            return ALLOC_OK;
+        }
+    }
+    return ALLOC_FAIL;
+}
+
+alloc_status mem_read_segments(pool_pt pool,
+                               pool_segment_pt segments,
+                               unsigned capacity,
+                               unsigned *num_segments) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    pool_mgr_pt source = _mem_read_source(pool_mgr);
+    for (unsigned retry = 0; retry < MEM_READ_MAX_RETRIES; retry++) {
+        unsigned seq = _mem_read_begin(source);
+        unsigned used = source->used_nodes;
+        const node_t *node = pool_mgr->node_heap;
+        unsigned count = 0;
+        // bounded by the buffer, since a torn walk may not end where expected
+        while (node != NULL && count < used && count < capacity) {
+            segments[count].size = node->alloc_record.size;
+            segments[count].allocated = node->allocated;
+            node = _mem_read_next(pool_mgr, node);
+            count++;
+        }
+        if (_mem_read_retry(source, seq))
+            continue;
+        *num_segments = used;
+        return (used <= capacity) ? ALLOC_OK : ALLOC_FAIL;
+    }
+    return ALLOC_FAIL;
+}
+
+/*
+ * Shared-memory stats export: a POSIX shared-memory object laid out as
+ * in mem_stats.h, one seqlock-protected slot per open pool, updated
+ * after every allocation and deallocation. mempool-top (or any other
+ * process) maps it read-only. Setting MEM_POOL_STATS in the environment
+ * to 1, or to a name starting with '/', exports from mem_init on, and
+ * MEM_STATS_SIGNAL starts exporting under the default name at the next
+ * allocation or deallocation.
+ */
+alloc_status mem_stats_export(const char *name) {
+#ifdef __unix__
+    if (stats_region != NULL)
+        return ALLOC_CALLED_AGAIN;
+    if (name == NULL) {
+        snprintf(stats_name, sizeof(stats_name), MEM_STATS_NAME_FORMAT, (int) getpid());
+    } else {
+        snprintf(stats_name, sizeof(stats_name), "%s", name);
+    }
+
+    int fd = shm_open(stats_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+        return ALLOC_FAIL;
+    if (ftruncate(fd, sizeof(mem_stats_region_t)) != 0) {
+        close(fd);
+        shm_unlink(stats_name);
+        return ALLOC_FAIL;
+    }
+    void *region = mmap(NULL, sizeof(mem_stats_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        shm_unlink(stats_name);
+        return ALLOC_FAIL;
+    }
+
+    // a fresh object is zero-filled, so only the header needs writing
+    mem_stats_region_pt new_region = (mem_stats_region_pt) region;
+    new_region->version = MEM_STATS_VERSION;
+    new_region->header_size = (uint32_t) offsetof(mem_stats_region_t, slots);
+    new_region->slot_size = (uint32_t) sizeof(mem_stats_slot_t);
+    new_region->max_pools = MEM_STATS_MAX_POOLS;
+    new_region->pid = (uint32_t) getpid();
+    atomic_store_explicit(&new_region->magic, MEM_STATS_MAGIC, memory_order_release);
+
+    // pools opened before the export may be in use on other threads, so
+    // each takes its slot at its own next operation, when it sees the epoch
+    _mem_stats_lock();
+    stats_region = new_region;
+    atomic_fetch_add_explicit(&stats_epoch, 1, memory_order_release);
+    _mem_stats_unlock();
+    return ALLOC_OK;
+#else
+    (void) name;
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_stats_unexport() {
+#ifdef __unix__
+    if (stats_region == NULL)
+        return ALLOC_CALLED_AGAIN;
+    // the pools drop their slots at their next operation, or on close
+    _mem_stats_lock();
+    mem_stats_region_pt region = stats_region;
+    stats_region = NULL;
+    atomic_fetch_add_explicit(&stats_epoch, 1, memory_order_release);
+    _mem_stats_unlock();
+    munmap(region, sizeof(mem_stats_region_t));
+    shm_unlink(stats_name);
+    return ALLOC_OK;
+#else
+    return ALLOC_CALLED_AGAIN;
+#endif
+}
+
+alloc_status mem_set_thread_tag(unsigned tag) {
+    if (tag >= MEM_NUM_TAGS)
+        return ALLOC_FAIL;
+    thread_tag = tag;
+    return ALLOC_OK;
+}
+
+unsigned mem_thread_tag() {
+    return thread_tag;
+}
+
+alloc_status mem_pool_tag_stats(pool_pt pool, unsigned tag, pool_tag_stats_pt stats) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (tag >= MEM_NUM_TAGS)
+        return ALLOC_FAIL;
+    // consistent under concurrent writers, as mem_read_pool
+    pool_mgr_pt source = _mem_read_source(pool_mgr);
+    for (unsigned retry = 0; retry < MEM_READ_MAX_RETRIES; retry++) {
+        unsigned seq = _mem_read_begin(source);
+        *stats = source->tag_stats[tag];
+        if (! _mem_read_retry(source, seq))
+            return ALLOC_OK;
+    }
+    return ALLOC_FAIL;
+}
+
+const char *mem_stats_name() {
+    return (stats_region != NULL) ? stats_name : NULL;
+}
+
+/*
+ * Sampled heap profile. Each pool counts down the bytes it allocates,
+ * and when the count runs out the allocation is sampled: its backtrace
+ * is recorded against its call site until the matching mem_del_alloc,
+ * and the countdown restarts from an exponentially distributed
+ * interval of mean sample_bytes, as pprof's unsampling expects. Only
+ * sampled allocations and the frees of sampled allocations touch the
+ * (spin-locked) global profile, so pools used from different threads
+ * keep their own fast path.
+ */
+alloc_status mem_profile_start(size_t sample_bytes) {
+    if (profile_sample_bytes)
+        return ALLOC_CALLED_AGAIN;
+    profile_sample_bytes = sample_bytes ? sample_bytes : MEM_PROFILE_DEFAULT_SAMPLE;
+    _mem_each_pool(_mem_profile_reset_countdown);
+    return ALLOC_OK;
+}
+
+alloc_status mem_profile_stop() {
+    if (! profile_sample_bytes)
+        return ALLOC_CALLED_AGAIN;
+    _mem_profile_lock();
+    profile_sample_bytes = 0;
+    _mem_each_pool(_mem_profile_forget);
+    free(profile_stacks);
+    free(profile_stack_ix);
+    free(profile_live);
+    profile_stacks = NULL;
+    profile_stack_ix = NULL;
+    profile_live = NULL;
+    profile_num_stacks = profile_stacks_capacity = profile_stack_ix_capacity = 0;
+    profile_num_live = profile_live_capacity = 0;
+    _mem_profile_unlock();
+    return ALLOC_OK;
+}
+
+/*
+ * Writes the legacy gperftools heap profile text format, which pprof
+ * reads: one line per call site with the live (in-use) and cumulative
+ * sampled objects and bytes, then the process mappings for symbolization.
+ * The heap_v2 tag carries the sampling interval, so pprof scales the
+ * samples back up; pick live or cumulative data with
+ * pprof -sample_index=inuse_space|alloc_space.
+ */
+alloc_status mem_profile_dump(const char *path) {
+    if (! profile_sample_bytes)
+        return ALLOC_FAIL;
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        return ALLOC_FAIL;
+
+    _mem_profile_lock();
+    unsigned long long totals[4] = { 0, 0, 0, 0 };
+    for (unsigned i = 0; i < profile_num_stacks; i++) {
+        totals[0] += profile_stacks[i].inuse_objs;
+        totals[1] += profile_stacks[i].inuse_bytes;
+        totals[2] += profile_stacks[i].alloc_objs;
+        totals[3] += profile_stacks[i].alloc_bytes;
+    }
+    fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%lu\n",
+            totals[0], totals[1], totals[2], totals[3], (unsigned long) profile_sample_bytes);
+    for (unsigned i = 0; i < profile_num_stacks; i++) {
+        profile_stack_pt stack = &profile_stacks[i];
+        fprintf(out, "%llu: %llu [%llu: %llu] @",
+                stack->inuse_objs, stack->inuse_bytes, stack->alloc_objs, stack->alloc_bytes);
+        for (unsigned d = 0; d < stack->depth; d++)
+            fprintf(out, " %p", stack->pcs[d]);
+        fprintf(out, "\n");
+    }
+    _mem_profile_unlock();
+
+    // mappings, so pprof can symbolize the addresses
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps != NULL) {
+        char line[512];
+        fprintf(out, "\nMAPPED_LIBRARIES:\n");
+        while (fgets(line, sizeof(line), maps))
+            fputs(line, out);
+        fclose(maps);
+    }
+    fclose(out);
+    return ALLOC_OK;
+}
+
+
+/*
+ * Sampled guard pages, after GWP-ASan. Each pool counts down its
+ * allocations, and when the count runs out the allocation is moved to
+ * a free slot page: the node keeps its range in the pool, so the pool
+ * metadata does not change, but mem points to the end of the slot
+ * page, right before a PROT_NONE guard page. mem_del_alloc hands the
+ * range back and protects the page, so overflows and use-after-free
+ * fault, and the SIGSEGV handler reports the allocation and where it
+ * was allocated and freed. Only sampled allocations, and their frees,
+ * take the guard lock.
+ */
+alloc_status mem_guard_start(unsigned sample_rate, unsigned num_slots) {
+    if (guard_sample_rate)
+        return ALLOC_CALLED_AGAIN;
+#ifdef __unix__
+    num_slots = num_slots ? num_slots : MEM_GUARD_DEFAULT_SLOTS;
+    guard_page_size = (size_t) sysconf(_SC_PAGESIZE);
+    guard_region_size = (2 * (size_t) num_slots + 1) * guard_page_size;
+    void *region = mmap(NULL, guard_region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    guard_slots = (guard_slot_pt) calloc(num_slots, sizeof(guard_slot_t));
+    guard_free = (unsigned *) calloc(num_slots, sizeof(unsigned));
+    if (region == MAP_FAILED || guard_slots == NULL || guard_free == NULL) {
+        if (region != MAP_FAILED)
+            munmap(region, guard_region_size);
+        free(guard_slots);
+        free(guard_free);
+        guard_slots = NULL;
+        guard_free = NULL;
+        return ALLOC_FAIL;
+    }
+    guard_region = (char *) region;
+    guard_num_slots = num_slots;
+    for (unsigned i = 0; i < num_slots; i++)
+        guard_free[i] = i;
+    guard_free_head = 0;
+    guard_num_free = num_slots;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = _mem_guard_on_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &guard_old_action);
+
+    guard_sample_rate = sample_rate ? sample_rate : MEM_GUARD_DEFAULT_RATE;
+    _mem_each_pool(_mem_guard_reset_countdown);
+    return ALLOC_OK;
+#else
+    (void) sample_rate;
+    (void) num_slots;
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_guard_stop() {
+    if (! guard_sample_rate)
+        return ALLOC_CALLED_AGAIN;
+#ifdef __unix__
+    // the slot pages back live allocations
+    for (unsigned i = 0; i < guard_num_slots; i++) {
+        if (guard_slots[i].pool_mgr && ! guard_slots[i].freed)
+            return ALLOC_NOT_FREED;
+    }
+    _mem_guard_lock();
+    guard_sample_rate = 0;
+    sigaction(SIGSEGV, &guard_old_action, NULL);
+    munmap(guard_region, guard_region_size);
+    free(guard_slots);
+    free(guard_free);
+    guard_region = NULL;
+    guard_region_size = 0;
+    guard_slots = NULL;
+    guard_free = NULL;
+    guard_num_slots = guard_num_free = guard_free_head = 0;
+    _mem_guard_unlock();
+#endif
+    return ALLOC_OK;
 }
 
 
@@ -516,52 +2718,512 @@ void mem_inspect_pool(pool_pt pool,
 /*                                 */
 /***********************************/
 
-static alloc_status _mem_resize_pool_store() {
-    // check if necessary
+static void _mem_write_begin(pool_mgr_pt pool_mgr) {
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    atomic_store_explicit(&pool_mgr->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void _mem_write_end(pool_mgr_pt pool_mgr) {
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    atomic_store_explicit(&pool_mgr->seq, seq + 1, memory_order_release);
+}
+
+static unsigned _mem_read_begin(pool_mgr_pt pool_mgr) {
+    return atomic_load_explicit(&pool_mgr->seq, memory_order_acquire);
+}
+
+static unsigned _mem_read_retry(pool_mgr_pt pool_mgr, unsigned seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return (seq & 1) || atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed) != seq;
+}
+
+static pool_mgr_pt _mem_read_source(pool_mgr_pt pool_mgr) {
+    // a shared pool is read in the segment, whose seqlock every process bumps
+    return pool_mgr->shared != NULL ? _mem_shared_mgr(pool_mgr) : pool_mgr;
+}
+
+static const node_t *_mem_read_next(pool_mgr_pt pool_mgr, const node_t *node) {
+    // the links of a shared pool point into the mapping of the last process
+    // to change it, and into anywhere while another process does
+    const node_t *next = node->next;
+    if (pool_mgr->shared == NULL || next == NULL)
+        return next;
+    uintptr_t offset = (uintptr_t) next + ((uintptr_t) pool_mgr->shared - pool_mgr->shared->file.base)
+                       - (uintptr_t) pool_mgr->node_heap;
+    if (offset % sizeof(node_t) != 0 || offset / sizeof(node_t) >= pool_mgr->total_nodes)
+        return NULL;
+    return pool_mgr->node_heap + offset / sizeof(node_t);
+}
+
+static void _mem_stats_lock() {
+    while (atomic_flag_test_and_set_explicit(&stats_lock, memory_order_acquire))
+        ;
+}
+
+static void _mem_stats_unlock() {
+    atomic_flag_clear_explicit(&stats_lock, memory_order_release);
+}
+
+static void _mem_stats_attach(pool_mgr_pt pool_mgr) {
+    unsigned pool_id = atomic_fetch_add_explicit(&stats_next_pool_id, 1, memory_order_relaxed);
+    // pools of other contexts may be opened on other threads
+    _mem_stats_lock();
+    pool_mgr->stats_slot = NULL;
+    pool_mgr->stats_epoch = atomic_load_explicit(&stats_epoch, memory_order_relaxed);
+    for (unsigned i = 0; stats_region != NULL && i < MEM_STATS_MAX_POOLS; i++) {
+        mem_stats_slot_pt slot = &stats_region->slots[i];
+        if (slot->in_use)
+            continue;
+        // only this process writes the region, so no race for the slot
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot->in_use = 1;
+        slot->pool_id = pool_id;
+        slot->policy = pool_mgr->pool.policy;
+        slot->allocs = slot->frees = slot->failed_allocs = 0;
+        atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+        pool_mgr->stats_slot = slot;
+        _mem_stats_unlock();
+        _mem_stats_publish(pool_mgr, 0, 0, 0);
+        return;
+    }
+    _mem_stats_unlock();
+    // more open pools than slots: this one is not exported
+}
+
+static void _mem_stats_detach(pool_mgr_pt pool_mgr) {
+    mem_stats_slot_pt slot = pool_mgr->stats_slot;
+    if (slot == NULL)
+        return;
+    _mem_stats_lock();
+    // a slot of an earlier export is gone with its region
+    if (pool_mgr->stats_epoch != atomic_load_explicit(&stats_epoch, memory_order_relaxed)) {
+        _mem_stats_unlock();
+        pool_mgr->stats_slot = NULL;
+        return;
+    }
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->in_use = 0;
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    _mem_stats_unlock();
+    pool_mgr->stats_slot = NULL;
+}
+
+static void _mem_stats_on_request() {
+    // the first thread to see the request exports, outside the signal handler
+    if (atomic_exchange(&stats_requested, 0) && stats_region == NULL)
+        mem_stats_export(NULL);
+}
+
+#ifdef __unix__
+static void _mem_stats_on_signal(int sig) {
+    (void) sig;
+    atomic_store(&stats_requested, 1);
+}
+#endif
+
+static void _mem_stats_update(pool_mgr_pt pool_mgr, unsigned allocs, unsigned frees, unsigned failed) {
+    // the pool follows exports and unexports by itself, on the thread that
+    // uses it, so that no other thread writes its slot
+    if (pool_mgr->stats_epoch != atomic_load_explicit(&stats_epoch, memory_order_acquire))
+        _mem_stats_attach(pool_mgr);
+    if (pool_mgr->stats_slot)
+        _mem_stats_publish(pool_mgr, allocs, frees, failed);
+}
+
+static void _mem_stats_publish(pool_mgr_pt pool_mgr, unsigned allocs, unsigned frees, unsigned failed) {
+    mem_stats_slot_pt slot = pool_mgr->stats_slot;
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->total_size = pool_mgr->pool.total_size;
+    slot->alloc_size = pool_mgr->pool.alloc_size;
+    slot->num_allocs = pool_mgr->pool.num_allocs;
+    slot->num_gaps = pool_mgr->pool.num_gaps;
+    slot->allocs += allocs;
+    slot->frees += frees;
+    slot->failed_allocs += failed;
+    // the largest gap costs a scan of the gap index, so it is refreshed
+    // periodically; in between, a free can only raise it to the gap it left
+    if ((slot->allocs + slot->frees + slot->failed_allocs) % MEM_STATS_GAP_INTERVAL == 0) {
+        slot->largest_gap = _mem_largest_gap(pool_mgr);
+    } else if (frees && pool_mgr->last_gap > slot->largest_gap) {
+        slot->largest_gap = pool_mgr->last_gap;
+    }
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+static void _mem_profile_forget(pool_mgr_pt pool_mgr) {
+    pool_mgr->profile_live = 0;
+}
+
+static void _mem_profile_lock() {
+    while (atomic_flag_test_and_set_explicit(&profile_lock, memory_order_acquire))
+        ;
+}
+
+static void _mem_profile_unlock() {
+    atomic_flag_clear_explicit(&profile_lock, memory_order_release);
+}
+
+static void _mem_profile_reset_countdown(pool_mgr_pt pool_mgr) {
+    // xorshift64*, seeded from the manager address
+    uint64_t x = pool_mgr->profile_rng ? pool_mgr->profile_rng : (uint64_t) (uintptr_t) pool_mgr | 1;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    pool_mgr->profile_rng = x;
+    double u = ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+    pool_mgr->profile_countdown = (long long) (-log(1.0 - u) * profile_sample_bytes) + 1;
+}
+
+static uint64_t _mem_profile_hash(const void *key, size_t len) {
+    // FNV-1a
+    const unsigned char *bytes = (const unsigned char *) key;
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t _mem_profile_live_hash(pool_mgr_pt pool_mgr, char *mem) {
+    uintptr_t key[2] = { (uintptr_t) pool_mgr, (uintptr_t) mem };
+    return _mem_profile_hash(key, sizeof(key));
+}
+
+/* finds or adds the stack, returns its index or -1 on allocation failure */
+static long _mem_profile_find_stack(void **pcs, unsigned depth) {
+    if (2 * (profile_num_stacks + 1) > profile_stack_ix_capacity) {
+        unsigned capacity = profile_stack_ix_capacity ? profile_stack_ix_capacity * 2 : MEM_PROFILE_INIT_CAPACITY;
+        unsigned *ix = (unsigned *) calloc(capacity, sizeof(unsigned));
+        profile_stack_pt stacks = (profile_stack_pt) realloc(profile_stacks, capacity / 2 * sizeof(profile_stack_t));
+        if (stacks != NULL)
+            profile_stacks = stacks;
+        if (ix == NULL || stacks == NULL) {
+            free(ix);
+            return -1;
+        }
+        for (unsigned i = 0; i < profile_num_stacks; i++) {
+            uint64_t h = _mem_profile_hash(profile_stacks[i].pcs, profile_stacks[i].depth * sizeof(void *));
+            unsigned slot = (unsigned) (h & (capacity - 1));
+            while (ix[slot])
+                slot = (slot + 1) & (capacity - 1);
+            ix[slot] = i + 1;
+        }
+        free(profile_stack_ix);
+        profile_stack_ix = ix;
+        profile_stack_ix_capacity = capacity;
+        profile_stacks_capacity = capacity / 2;
+    }
+
+    uint64_t h = _mem_profile_hash(pcs, depth * sizeof(void *));
+    unsigned slot = (unsigned) (h & (profile_stack_ix_capacity - 1));
+    while (profile_stack_ix[slot]) {
+        profile_stack_pt stack = &profile_stacks[profile_stack_ix[slot] - 1];
+        if (stack->depth == depth && memcmp(stack->pcs, pcs, depth * sizeof(void *)) == 0)
+            return profile_stack_ix[slot] - 1;
+        slot = (slot + 1) & (profile_stack_ix_capacity - 1);
+    }
+    profile_stack_pt stack = &profile_stacks[profile_num_stacks];
+    memset(stack, 0, sizeof(profile_stack_t));
+    memcpy(stack->pcs, pcs, depth * sizeof(void *));
+    stack->depth = depth;
+    profile_stack_ix[slot] = ++profile_num_stacks;
+    return profile_num_stacks - 1;
+}
+
+static alloc_status _mem_profile_grow_live() {
+    unsigned capacity = profile_live_capacity ? profile_live_capacity * 2 : MEM_PROFILE_INIT_CAPACITY;
+    profile_sample_pt live = (profile_sample_pt) calloc(capacity, sizeof(profile_sample_t));
+    if (live == NULL)
+        return ALLOC_FAIL;
+    for (unsigned i = 0; i < profile_live_capacity; i++) {
+        if (! profile_live[i].used)
+            continue;
+        unsigned slot = (unsigned) (_mem_profile_live_hash(profile_live[i].pool_mgr, profile_live[i].mem)
+                                    & (capacity - 1));
+        while (live[slot].used)
+            slot = (slot + 1) & (capacity - 1);
+        live[slot] = profile_live[i];
+    }
+    free(profile_live);
+    profile_live = live;
+    profile_live_capacity = capacity;
+    return ALLOC_OK;
+}
+
+static void _mem_profile_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc, void *caller) {
+    void *pcs[MEM_PROFILE_MAX_DEPTH + MEM_PROFILE_SKIP_FRAMES];
+    unsigned depth = 0;
+    unsigned skip = MEM_PROFILE_SKIP_FRAMES;
+#ifdef __GLIBC__
+    int frames = backtrace(pcs, MEM_PROFILE_MAX_DEPTH + MEM_PROFILE_SKIP_FRAMES);
+    // the frames of the library up to the caller, however many inlining
+    // and tail calls left of them
+    for (int i = 0; caller != NULL && i < frames; i++) {
+        if (pcs[i] == caller) {
+            skip = (unsigned) i;
+            break;
+        }
+    }
+    if (frames > (int) skip)
+        depth = (unsigned) frames - skip;
+    if (depth > MEM_PROFILE_MAX_DEPTH)
+        depth = MEM_PROFILE_MAX_DEPTH;
+#else
+    (void) caller;
+#endif
+    _mem_profile_reset_countdown(pool_mgr);
+
+    _mem_profile_lock();
+    long stack_ix = _mem_profile_find_stack(pcs + skip, depth);
+    if (stack_ix < 0
+        || (2 * (profile_num_live + 1) > profile_live_capacity && _mem_profile_grow_live() != ALLOC_OK)) {
+        _mem_profile_unlock();
+        return;
+    }
+    profile_stack_pt stack = &profile_stacks[stack_ix];
+    stack->inuse_objs++;
+    stack->inuse_bytes += alloc->size;
+    stack->alloc_objs++;
+    stack->alloc_bytes += alloc->size;
+
+    unsigned slot = (unsigned) (_mem_profile_live_hash(pool_mgr, alloc->mem) & (profile_live_capacity - 1));
+    while (profile_live[slot].used)
+        slot = (slot + 1) & (profile_live_capacity - 1);
+    profile_live[slot].pool_mgr = pool_mgr;
+    profile_live[slot].mem = alloc->mem;
+    profile_live[slot].size = alloc->size;
+    profile_live[slot].stack = (unsigned) stack_ix;
+    profile_live[slot].used = 1;
+    profile_num_live++;
+    pool_mgr->profile_live++;
+    _mem_profile_unlock();
+}
+
+static void _mem_profile_free(pool_mgr_pt pool_mgr, char *mem) {
+    _mem_profile_lock();
+    _mem_profile_remove(pool_mgr, mem);
+    _mem_profile_unlock();
+}
+
+static void _mem_profile_remove(pool_mgr_pt pool_mgr, char *mem) {
+    // the caller holds the profile lock
+    if (profile_live_capacity == 0)
+        return;
+    unsigned mask = profile_live_capacity - 1;
+    unsigned slot = (unsigned) (_mem_profile_live_hash(pool_mgr, mem) & mask);
+    while (profile_live[slot].used
+           && (profile_live[slot].pool_mgr != pool_mgr || profile_live[slot].mem != mem))
+        slot = (slot + 1) & mask;
+    if (profile_live[slot].used) {
+        profile_stack_pt stack = &profile_stacks[profile_live[slot].stack];
+        stack->inuse_objs--;
+        stack->inuse_bytes -= profile_live[slot].size;
+        profile_live[slot].used = 0;
+        profile_num_live--;
+        pool_mgr->profile_live--;
+
+        // backward-shift deletion keeps the probe sequences intact
+        unsigned hole = slot;
+        for (unsigned next = (hole + 1) & mask; profile_live[next].used; next = (next + 1) & mask) {
+            unsigned home = (unsigned) (_mem_profile_live_hash(profile_live[next].pool_mgr, profile_live[next].mem)
+                                        & mask);
+            // move the entry if its home is not in (hole, next]
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                profile_live[hole] = profile_live[next];
+                profile_live[next].used = 0;
+                hole = next;
+            }
+        }
+    }
+}
+
+static alloc_status _mem_ctx_init(mem_ctx_pt ctx) {
+    // allocate the pool store with initial capacity
+    // note: holds pointers only, other functions to allocate/deallocate
+    ctx->pool_store = (pool_mgr_pt *) calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
+    ctx->free_slots = (unsigned *) calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(unsigned));
+    if (ctx->pool_store == NULL || ctx->free_slots == NULL) {
+        free(ctx->pool_store);
+        free(ctx->free_slots);
+        ctx->pool_store = NULL;
+        ctx->free_slots = NULL;
+        return ALLOC_FAIL;
+    }
+    ctx->pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+    ctx->pool_store_size = 0;
+    ctx->num_free_slots = 0;
+    _mem_ctx_lock();
+    ctx->next = ctx_list;
+    ctx_list = ctx;
+    _mem_ctx_unlock();
+    return ALLOC_OK;
+}
+
+static void _mem_ctx_free(mem_ctx_pt ctx) {
+    _mem_ctx_lock();
+    for (mem_ctx_pt *link = &ctx_list; *link != NULL; link = &(*link)->next) {
+        if (*link == ctx) {
+            *link = ctx->next;
+            break;
+        }
+    }
+    _mem_ctx_unlock();
+    free(ctx->pool_store);
+    free(ctx->free_slots);
+    ctx->pool_store = NULL;
+    ctx->free_slots = NULL;
+    ctx->pool_store_capacity = 0;
+    ctx->pool_store_size = 0;
+    ctx->num_free_slots = 0;
+    ctx->next = NULL;
+}
+
+static void _mem_ctx_lock() {
+    while (atomic_flag_test_and_set_explicit(&ctx_lock, memory_order_acquire))
+        ;
+}
+
+static void _mem_ctx_unlock() {
+    atomic_flag_clear_explicit(&ctx_lock, memory_order_release);
+}
+
+static void _mem_each_pool(void (*visit)(pool_mgr_pt pool_mgr)) {
+    // for the process-wide tools, which see the pools of every context
+    _mem_ctx_lock();
+    for (mem_ctx_pt ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
+        for (unsigned i = 0; i < ctx->pool_store_size; i++) {
+            if (ctx->pool_store[i] != NULL)
+                visit(ctx->pool_store[i]);
+        }
+    }
+    _mem_ctx_unlock();
+}
+
+static alloc_status _mem_resize_pool_store(mem_ctx_pt ctx) {
+    // check if necessary: free slots are reused first, so the store
+    // only grows with the number of open pools
     // don't forget to update capacity variables
-    if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
-        pool_store = realloc(pool_store, MEM_EXPAND_FACTOR  * sizeof(pool_store));
-        pool_store_capacity *= MEM_EXPAND_FACTOR;
+    if (ctx->num_free_slots == 0
+        && ((float) ctx->pool_store_size / ctx->pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
+        unsigned new_capacity = ctx->pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        pool_mgr_pt *new_store = (pool_mgr_pt *) realloc(ctx->pool_store, new_capacity * sizeof(pool_mgr_pt));
+        if (new_store == NULL)
+            return ALLOC_FAIL;
+        for (unsigned i = ctx->pool_store_capacity; i < new_capacity; ++i)
+            new_store[i] = NULL;
+        ctx->pool_store = new_store;
+        unsigned *new_free = (unsigned *) realloc(ctx->free_slots, new_capacity * sizeof(unsigned));
+        if (new_free == NULL)
+            return ALLOC_FAIL;
+        ctx->free_slots = new_free;
+        ctx->pool_store_capacity = new_capacity;
     }
     return ALLOC_OK;
 
 }
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
-    if (((float) pool_mgr->node_heap->used / pool_mgr->node_heap->alloc_record.size) > MEM_NODE_HEAP_FILL_FACTOR) {
 
-        pool_mgr->node_heap = (node_pt) realloc(pool_mgr->node_heap,MEM_NODE_HEAP_EXPAND_FACTOR * sizeof(pool_store));
-        pool_mgr->total_nodes *= MEM_NODE_HEAP_EXPAND_FACTOR;
-        for (int i = pool_mgr->total_nodes; i < pool_mgr->total_nodes; ++i) {
-            pool_mgr->node_heap[i].used = 0;
-            pool_mgr->node_heap[i].allocated = 0;
-            pool_mgr->node_heap[i].alloc_record.size = 0;
-            pool_mgr->node_heap[i].alloc_record.mem = NULL;
-            pool_mgr->node_heap[i].next = NULL;
-            pool_mgr->node_heap[i].prev = NULL;
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
+    // an in-band node heap has a fixed capacity, used up to the last node,
+    // unless it is a restored one, which grows out of its mapping
+    if (pool_mgr->in_band && ! pool_mgr->heap_grows)
+        return ALLOC_OK;
+    if (((float) pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR) {
+        unsigned new_total = pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
+        uintptr_t old_base = (uintptr_t) pool_mgr->node_heap;
+        // not realloc: the old heap stays readable for mem_read_segments until
+        // close, retired unless it is in the mapping, which is unmapped then
+        unsigned retire = ! _mem_pool_maps(pool_mgr, pool_mgr->node_heap);
+        if (retire) {
+            node_pt *retired = (node_pt *) realloc(pool_mgr->retired_heaps,
+                                                   (pool_mgr->num_retired + 1) * sizeof(node_pt));
+            if (retired == NULL)
+                return ALLOC_FAIL;
+            pool_mgr->retired_heaps = retired;
+        }
+        node_pt new_heap = (node_pt) malloc(new_total * sizeof(node_t));
+        if (new_heap == NULL)
+            return ALLOC_FAIL;
+        memcpy(new_heap, pool_mgr->node_heap, pool_mgr->total_nodes * sizeof(node_t));
+        if (retire)
+            pool_mgr->retired_heaps[pool_mgr->num_retired++] = pool_mgr->node_heap;
+
+        // the nodes moved with the heap, so rebase the list links and the gap index
+        for (unsigned i = 0; i < pool_mgr->total_nodes; ++i) {
+            if (new_heap[i].next)
+                new_heap[i].next = new_heap + ((uintptr_t) new_heap[i].next - old_base) / sizeof(node_t);
+            if (new_heap[i].prev)
+                new_heap[i].prev = new_heap + ((uintptr_t) new_heap[i].prev - old_base) / sizeof(node_t);
+        }
+        for (unsigned i = 0; i < pool_mgr->pool.num_gaps; ++i)
+            pool_mgr->gap_ix[i].node = new_heap + ((uintptr_t) pool_mgr->gap_ix[i].node - old_base) / sizeof(node_t);
+
+        for (unsigned i = pool_mgr->total_nodes; i < new_total; ++i) {
+            new_heap[i].used = 0;
+            new_heap[i].allocated = 0;
+            new_heap[i].alloc_record.size = 0;
+            new_heap[i].alloc_record.mem = NULL;
+            new_heap[i].next = NULL;
+            new_heap[i].prev = NULL;
         }
 
-        //    if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
-        //    }
         // don't forget to update capacity variables
+        pool_mgr->node_heap = new_heap;
+        pool_mgr->total_nodes = new_total;
     }
     return ALLOC_OK;
 }
 
 
+static void _mem_pool_rebase(pool_mgr_pt pool_mgr, uintptr_t delta) {
+    // every pointer in the metadata is into the same mapping, so it moves by delta
+    pool_mgr->pool.mem = (char *) ((uintptr_t) pool_mgr->pool.mem + delta);
+    pool_mgr->node_heap = (node_pt) ((uintptr_t) pool_mgr->node_heap + delta);
+    pool_mgr->gap_ix = (gap_pt) ((uintptr_t) pool_mgr->gap_ix + delta);
+    // the used nodes are all on the list, and unused ones are set up
+    // afresh when used, so only the list needs walking
+    for (node_pt node = pool_mgr->node_heap; node != NULL; node = node->next) {
+        node->alloc_record.mem = (char *) ((uintptr_t) node->alloc_record.mem + delta);
+        if (node->next)
+            node->next = (node_pt) ((uintptr_t) node->next + delta);
+        if (node->prev)
+            node->prev = (node_pt) ((uintptr_t) node->prev + delta);
+    }
+    for (unsigned i = 0; i < pool_mgr->pool.num_gaps; ++i)
+        pool_mgr->gap_ix[i].node = (node_pt) ((uintptr_t) pool_mgr->gap_ix[i].node + delta);
+}
+
+
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->in_band && ! pool_mgr->heap_grows)
+        return ALLOC_OK;
     if (((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR) {
-
-        pool_mgr->gap_ix = (gap_pt) realloc(pool_mgr->gap_ix, MEM_GAP_IX_EXPAND_FACTOR * sizeof(pool_store));
-        pool_mgr->gap_ix_capacity *= MEM_GAP_IX_EXPAND_FACTOR;
-        for (int i = pool_mgr->pool.num_gaps; i < pool_mgr->gap_ix_capacity; ++i)
+        unsigned new_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+        // a gap index in the mapping is copied out rather than reallocated
+        gap_pt old_ix = _mem_pool_maps(pool_mgr, pool_mgr->gap_ix) ? NULL : pool_mgr->gap_ix;
+        gap_pt new_ix = (gap_pt) realloc(old_ix, new_capacity * sizeof(gap_t));
+        if (new_ix == NULL)
+            return ALLOC_FAIL;
+        if (old_ix == NULL)
+            memcpy(new_ix, pool_mgr->gap_ix, pool_mgr->pool.num_gaps * sizeof(gap_t));
+        for (unsigned i = pool_mgr->pool.num_gaps; i < new_capacity; ++i)
         {
-            pool_mgr->gap_ix[i].size = 0;
-            pool_mgr->gap_ix[i].node = NULL;
+            new_ix[i].size = 0;
+            new_ix[i].node = NULL;
         }
+        // don't forget to update capacity variables
+        pool_mgr->gap_ix = new_ix;
+        pool_mgr->gap_ix_capacity = new_capacity;
     }
-    //    if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
-    //    }
-    // don't forget to update capacity variables
     return ALLOC_OK;
 }
 
@@ -570,13 +3232,19 @@ static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                                        node_pt node) {
 
     // expand the gap index, if necessary (call the function)
-    _mem_resize_gap_ix(pool_mgr);
+    if (_mem_resize_gap_ix(pool_mgr) != ALLOC_OK)
+        return ALLOC_FAIL;
 
     // add the entry at the end
     pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
     pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
-    // update metadata (num_gaps)
+    // update metadata (num_gaps, largest gap)
     pool_mgr->pool.num_gaps ++;
+    if (size > pool_mgr->largest_gap || pool_mgr->num_largest == 0) {
+        pool_mgr->largest_gap = size;
+        pool_mgr->num_largest = 1;
+    } else if (size == pool_mgr->largest_gap)
+        pool_mgr->num_largest++;
     // sort the gap index (call the function)
     alloc_status status = (_mem_sort_gap_ix(pool_mgr)== ALLOC_OK);
         // check success
@@ -598,22 +3266,85 @@ static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
             break;
         }
     }
+    size_t removed = pool_mgr->gap_ix[index].size;
     // loop from there to the end of the array:
     //    pull the entries (i.e. copy over) one position up
     //    this effectively deletes the chosen node
-    for ( int i = index; i < pool_mgr->gap_ix_capacity - 1; i++) {
+    for ( int i = index; i < pool_mgr->pool.num_gaps - 1; i++) {
         pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i+1];
     }
     // update metadata (num_gaps)
     pool_mgr->pool.num_gaps --;
-    pool_mgr->gap_ix_capacity --;
     pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = 0;
     pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = NULL;
     // zero out the element at position num_gaps!
 
+    // the last of the largest gaps takes a scan for the next largest, no
+    // more than the search above
+    if (removed == pool_mgr->largest_gap && --pool_mgr->num_largest == 0) {
+        pool_mgr->largest_gap = 0;
+        for (unsigned i = 0; i < pool_mgr->pool.num_gaps; i++) {
+            if (pool_mgr->gap_ix[i].size > pool_mgr->largest_gap) {
+                pool_mgr->largest_gap = pool_mgr->gap_ix[i].size;
+                pool_mgr->num_largest = 1;
+            } else if (pool_mgr->gap_ix[i].size == pool_mgr->largest_gap)
+                pool_mgr->num_largest++;
+        }
+    }
+
     return ALLOC_OK;
 }
 
+static size_t _mem_largest_gap(pool_mgr_pt pool_mgr) {
+    // the largest gap of a shared pool changes with the other processes,
+    // so it is read under its lock
+    if (pool_mgr->shared != NULL && _mem_shared_enter(pool_mgr) != ALLOC_OK)
+        return 0;
+    size_t largest = pool_mgr->largest_gap;
+    if (pool_mgr->shared != NULL)
+        _mem_shared_leave(pool_mgr);
+    return largest;
+}
+
+static void _mem_group_rekey(pool_mgr_pt pool_mgr) {
+    // after a change in a member, which knows its largest gap exactly
+    size_t old_key = pool_mgr->group_key;
+    pool_mgr->group_key = _mem_largest_gap(pool_mgr);
+    if (pool_mgr->group_key > old_key)
+        _mem_group_sift_up(pool_mgr->group, pool_mgr->group_ix);
+    else if (pool_mgr->group_key < old_key)
+        _mem_group_sift_down(pool_mgr->group, pool_mgr->group_ix);
+}
+
+static void _mem_group_sift_up(pool_group_pt group, unsigned ix) {
+    pool_mgr_pt pool_mgr = group->heap[ix];
+    while (ix > 0 && group->heap[(ix - 1) / 2]->group_key < pool_mgr->group_key) {
+        group->heap[ix] = group->heap[(ix - 1) / 2];
+        group->heap[ix]->group_ix = ix;
+        ix = (ix - 1) / 2;
+    }
+    group->heap[ix] = pool_mgr;
+    pool_mgr->group_ix = ix;
+}
+
+static void _mem_group_sift_down(pool_group_pt group, unsigned ix) {
+    pool_mgr_pt pool_mgr = group->heap[ix];
+    for (;;) {
+        unsigned child = 2 * ix + 1;
+        if (child >= group->num_pools)
+            break;
+        if (child + 1 < group->num_pools && group->heap[child + 1]->group_key > group->heap[child]->group_key)
+            child++;
+        if (group->heap[child]->group_key <= pool_mgr->group_key)
+            break;
+        group->heap[ix] = group->heap[child];
+        group->heap[ix]->group_ix = ix;
+        ix = child;
+    }
+    group->heap[ix] = pool_mgr;
+    pool_mgr->group_ix = ix;
+}
+
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
     gap_t temp;
     // the new entry is at the end, so "bubble it up"
@@ -630,3 +3361,290 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
     }
     return ALLOC_OK;
 }
+
+static void _mem_guard_lock() {
+    while (atomic_flag_test_and_set_explicit(&guard_lock, memory_order_acquire))
+        ;
+}
+
+static void _mem_guard_unlock() {
+    atomic_flag_clear_explicit(&guard_lock, memory_order_release);
+}
+
+static void _mem_guard_reset_countdown(pool_mgr_pt pool_mgr) {
+    // xorshift64*, seeded from the manager address; uniform in [1, 2 * rate - 1]
+    uint64_t x = pool_mgr->guard_rng ? pool_mgr->guard_rng : (uint64_t) (uintptr_t) pool_mgr | 1;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    pool_mgr->guard_rng = x;
+    pool_mgr->guard_countdown = (long long) ((x * 0x2545F4914F6CDD1DULL) % (2 * (uint64_t) guard_sample_rate - 1)) + 1;
+}
+
+static unsigned _mem_guard_owns(const char *mem) {
+    // a single comparison, and false while not guarding
+    return (uintptr_t) mem - (uintptr_t) guard_region < guard_region_size;
+}
+
+static guard_slot_pt _mem_guard_slot(const char *mem) {
+    return &guard_slots[(size_t) (mem - guard_region) / guard_page_size / 2];
+}
+
+static void _mem_guard_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    _mem_guard_reset_countdown(pool_mgr);
+    // the data of a file-backed pool has to stay in the file
+    if (pool_mgr->simulated || pool_mgr->mapping || alloc->size == 0 || alloc->size > guard_page_size)
+        return;
+#ifdef __unix__
+    void *pcs[MEM_GUARD_MAX_DEPTH];
+    unsigned depth = 0;
+#ifdef __GLIBC__
+    depth = (unsigned) backtrace(pcs, MEM_GUARD_MAX_DEPTH);
+#endif
+
+    _mem_guard_lock();
+    if (guard_num_free == 0) {
+        _mem_guard_unlock();
+        return;
+    }
+    unsigned i = guard_free[guard_free_head];
+    char *page = guard_region + (2 * (size_t) i + 1) * guard_page_size;
+    if (mprotect(page, guard_page_size, PROT_READ | PROT_WRITE) != 0) {
+        _mem_guard_unlock();
+        return;
+    }
+    guard_free_head = (guard_free_head + 1) % guard_num_slots;
+    guard_num_free--;
+
+    guard_slot_pt slot = &guard_slots[i];
+    slot->pool_mgr = pool_mgr;
+    slot->pool_mem = alloc->mem;
+    slot->size = alloc->size;
+    slot->freed = 0;
+    slot->alloc_depth = depth;
+    memcpy(slot->alloc_pcs, pcs, depth * sizeof(void *));
+    slot->free_depth = 0;
+    // right-aligned, so the first byte past the end is on the guard page
+    alloc->mem = page + guard_page_size - alloc->size;
+    _mem_guard_unlock();
+#endif
+}
+
+static alloc_status _mem_guard_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+#ifdef __unix__
+    void *pcs[MEM_GUARD_MAX_DEPTH];
+    unsigned depth = 0;
+#ifdef __GLIBC__
+    depth = (unsigned) backtrace(pcs, MEM_GUARD_MAX_DEPTH);
+#endif
+    char *mem = alloc->mem;
+
+    _mem_guard_lock();
+    guard_slot_pt slot = _mem_guard_slot(mem);
+    unsigned i = (unsigned) (slot - guard_slots);
+    char *page = guard_region + (2 * (size_t) i + 1) * guard_page_size;
+    if (slot->pool_mgr != pool_mgr || slot->freed || mem != page + guard_page_size - slot->size) {
+        _mem_guard_unlock();
+        if (slot->pool_mgr == pool_mgr && slot->freed)
+            fprintf(stderr, "mem_pool guard: double free of %p in pool %p\n", (void *) mem, (void *) pool_mgr);
+        return ALLOC_NOT_FREED;
+    }
+    // hand the node its range in the pool back, and free it there
+    for (unsigned n = 0; n < pool_mgr->total_nodes; n++) {
+        if (pool_mgr->node_heap[n].used && pool_mgr->node_heap[n].alloc_record.mem == mem) {
+            pool_mgr->node_heap[n].alloc_record.mem = slot->pool_mem;
+            break;
+        }
+    }
+    alloc_t pool_alloc = { slot->size, slot->pool_mem };
+    alloc_status status = _mem_del_alloc((pool_pt) pool_mgr, &pool_alloc);
+
+    mprotect(page, guard_page_size, PROT_NONE);
+    slot->freed = 1;
+    slot->free_depth = depth;
+    memcpy(slot->free_pcs, pcs, depth * sizeof(void *));
+    guard_free[(guard_free_head + guard_num_free) % guard_num_slots] = i;
+    guard_num_free++;
+    _mem_guard_unlock();
+    return status;
+#else
+    (void) pool_mgr;
+    (void) alloc;
+    return ALLOC_NOT_FREED;
+#endif
+}
+
+#ifdef __unix__
+static void _mem_guard_write(const char *msg, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(STDERR_FILENO, msg, len);
+        if (written <= 0)
+            return;
+        msg += written;
+        len -= (size_t) written;
+    }
+}
+
+static void _mem_guard_write_str(const char *msg) {
+    _mem_guard_write(msg, strlen(msg));
+}
+
+static void _mem_guard_write_num(uintptr_t value, unsigned base, unsigned negative) {
+    // snprintf is not async-signal-safe
+    char digits[2 + 3 * sizeof(value)];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value > 0);
+    if (base == 16) {
+        digits[--i] = 'x';
+        digits[--i] = '0';
+    } else if (negative)
+        digits[--i] = '-';
+    _mem_guard_write(digits + i, sizeof(digits) - i);
+}
+
+/*
+ * Reports a fault in the guard region and lets the access fault again
+ * under the default action. Other faults go to the previous handler,
+ * which stays chained behind this one, unless it is the default action,
+ * which ends the process anyway.
+ */
+static void _mem_guard_on_fault(int sig, siginfo_t *info, void *context) {
+    char *addr = (char *) info->si_addr;
+    if (! _mem_guard_owns(addr)) {
+        if (guard_old_action.sa_flags & SA_SIGINFO)
+            guard_old_action.sa_sigaction(sig, info, context);
+        else if (guard_old_action.sa_handler != SIG_DFL && guard_old_action.sa_handler != SIG_IGN)
+            guard_old_action.sa_handler(sig);
+        else
+            sigaction(SIGSEGV, &guard_old_action, NULL);
+        return;
+    }
+
+    size_t page = (size_t) (addr - guard_region) / guard_page_size;
+    guard_slot_pt slot = NULL;
+    const char *kind = "invalid access";
+    char *start = NULL;
+    if (page % 2) {
+        // a slot page is only protected when unused or freed
+        slot = &guard_slots[page / 2];
+        if (slot->freed)
+            kind = "use-after-free";
+    } else if (page > 0 && guard_slots[page / 2 - 1].pool_mgr && ! guard_slots[page / 2 - 1].freed) {
+        slot = &guard_slots[page / 2 - 1];
+        kind = "buffer-overflow";
+    } else if (page / 2 < guard_num_slots && guard_slots[page / 2].pool_mgr && ! guard_slots[page / 2].freed) {
+        slot = &guard_slots[page / 2];
+        kind = "buffer-underflow";
+    }
+    if (slot && slot->pool_mgr)
+        start = guard_region + (2 * (slot - guard_slots) + 2) * guard_page_size - slot->size;
+
+    _mem_guard_write_str("mem_pool guard: ");
+    _mem_guard_write_str(kind);
+    _mem_guard_write_str(" at ");
+    _mem_guard_write_num((uintptr_t) addr, 16, 0);
+    if (start) {
+        _mem_guard_write_str(", offset ");
+        _mem_guard_write_num(addr >= start ? (uintptr_t) (addr - start) : (uintptr_t) (start - addr), 10, addr < start);
+        _mem_guard_write_str(" of a ");
+        _mem_guard_write_num(slot->size, 10, 0);
+        _mem_guard_write_str("-byte allocation at ");
+        _mem_guard_write_num((uintptr_t) start, 16, 0);
+        _mem_guard_write_str(" in pool ");
+        _mem_guard_write_num((uintptr_t) slot->pool_mgr, 16, 0);
+    }
+    _mem_guard_write_str("\n");
+#ifdef __GLIBC__
+    if (start) {
+        const char allocated[] = "allocated at:\n", freed[] = "freed at:\n";
+        _mem_guard_write(allocated, sizeof(allocated) - 1);
+        backtrace_symbols_fd(slot->alloc_pcs, (int) slot->alloc_depth, STDERR_FILENO);
+        if (slot->freed) {
+            _mem_guard_write(freed, sizeof(freed) - 1);
+            backtrace_symbols_fd(slot->free_pcs, (int) slot->free_depth, STDERR_FILENO);
+        }
+    }
+#endif
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGSEGV, &action, NULL);
+}
+#endif
+
+/*
+ * The pool ranges form a treap keyed by start address, then depth, as
+ * a child pool may start where its parent does, with random priorities,
+ * so insertion, deletion and lookup take O(log n) expected time.
+ * Simulated pools, which have no memory, and empty pools are left out.
+ */
+static void _mem_range_lock() {
+    while (atomic_flag_test_and_set_explicit(&range_lock, memory_order_acquire))
+        ;
+}
+
+static void _mem_range_unlock() {
+    atomic_flag_clear_explicit(&range_lock, memory_order_release);
+}
+
+static void _mem_range_split(pool_mgr_pt root, uintptr_t start, unsigned depth,
+                             pool_mgr_pt *left, pool_mgr_pt *right) {
+    // left gets the pools before (start, depth), right the rest
+    if (root == NULL) {
+        *left = *right = NULL;
+    } else if ((uintptr_t) root->pool.mem < start
+               || ((uintptr_t) root->pool.mem == start && root->depth < depth)) {
+        _mem_range_split(root->range_right, start, depth, &root->range_right, right);
+        *left = root;
+    } else {
+        _mem_range_split(root->range_left, start, depth, left, &root->range_left);
+        *right = root;
+    }
+}
+
+static pool_mgr_pt _mem_range_merge(pool_mgr_pt left, pool_mgr_pt right) {
+    // every pool in left starts below every pool in right
+    if (left == NULL)
+        return right;
+    if (right == NULL)
+        return left;
+    if (left->range_priority > right->range_priority) {
+        left->range_right = _mem_range_merge(left->range_right, right);
+        return left;
+    }
+    right->range_left = _mem_range_merge(left, right->range_left);
+    return right;
+}
+
+static void _mem_range_insert(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->simulated || pool_mgr->pool.total_size == 0)
+        return;
+    // splitmix64 of the manager address
+    uint64_t x = (uint64_t) (uintptr_t) pool_mgr + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    pool_mgr->range_priority = x ^ (x >> 31);
+    pool_mgr->range_left = pool_mgr->range_right = NULL;
+
+    pool_mgr_pt left, right;
+    _mem_range_lock();
+    _mem_range_split(range_root, (uintptr_t) pool_mgr->pool.mem, pool_mgr->depth, &left, &right);
+    range_root = _mem_range_merge(_mem_range_merge(left, pool_mgr), right);
+    _mem_range_unlock();
+}
+
+static void _mem_range_erase(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->simulated || pool_mgr->pool.total_size == 0)
+        return;
+    pool_mgr_pt left, middle, right;
+    uintptr_t start = (uintptr_t) pool_mgr->pool.mem;
+    _mem_range_lock();
+    _mem_range_split(range_root, start, pool_mgr->depth, &left, &right);
+    _mem_range_split(right, start, pool_mgr->depth + 1, &middle, &right);
+    // middle is this pool: live pools do not overlap
+    range_root = _mem_range_merge(left, right);
+    _mem_range_unlock();
+}
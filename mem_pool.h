@@ -7,6 +7,10 @@
 
 #include <stddef.h>
 
+/* constants */
+
+#define MEM_NUM_TAGS 16 // allocation tags 0 .. MEM_NUM_TAGS - 1, 0 is the default
+
 /* type declarations */
 
 typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
@@ -30,6 +34,25 @@ typedef struct _pool_segment {
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _mem_ctx mem_ctx_t, *mem_ctx_pt; // allocator context, opaque
+typedef struct _pool_group pool_group_t, *pool_group_pt; // pool group, opaque
+
+typedef struct _pool_tag_stats {
+    size_t live_bytes;
+    unsigned live_allocs;
+    size_t peak_bytes;          // high-water mark of live_bytes
+    unsigned long total_allocs;
+} pool_tag_stats_t, *pool_tag_stats_pt;
+
+typedef struct _pool_segment_iter {
+    pool_pt pool;
+    const void *next;        // next node to visit, NULL at the end
+    unsigned gaps_only;      // filter: skip allocations
+    size_t min_size;         // filter: skip segments smaller than this
+    unsigned seq;            // of a shared pool, at init
+    unsigned changed;        // another process changed a shared pool, cutting the walk short
+} pool_segment_iter_t, *pool_segment_iter_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -48,16 +71,165 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_sim(size_t size, alloc_policy policy); // metadata only: pool->mem is NULL, alloc->mem holds offsets
+
+mem_ctx_pt
+mem_ctx_init();                     // a context with its own pool store
+
+alloc_status
+mem_ctx_free(mem_ctx_pt ctx);
+
+pool_pt
+mem_ctx_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy);
+
+pool_pt
+mem_ctx_pool_open_sim(mem_ctx_pt ctx, size_t size, alloc_policy policy);
+
+unsigned
+mem_ctx_store_size(mem_ctx_pt ctx); // store slots in use or free, NULL for the default context
+
+unsigned
+mem_pool_slot(pool_pt pool);        // slot of the pool in its context's store
+
+pool_pt
+mem_pool_open_in(void *buf, size_t size, alloc_policy policy); // pool and metadata inside buf
+
+pool_pt
+mem_ctx_pool_open_in(mem_ctx_pt ctx, void *buf, size_t size, alloc_policy policy);
+
+pool_pt
+mem_pool_open_file(const char *path, size_t size, alloc_policy policy); // reopens the pool in path, if any
+
+pool_pt
+mem_ctx_pool_open_file(mem_ctx_pt ctx, const char *path, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_sync(pool_pt pool);        // flush a file-backed pool to disk
+
+alloc_status
+mem_pool_snapshot(pool_pt pool, int fd); // the pool as a file mem_pool_restore maps back
+
+pool_pt
+mem_pool_restore(int fd);
+
+pool_pt
+mem_ctx_pool_restore(mem_ctx_pt ctx, int fd);
+
+alloc_status
+mem_pool_checkpoint(pool_pt pool, int fd); // only what changed since the last snapshot in fd
+
+pool_pt
+mem_pool_clone(pool_pt pool);       // independent copy-on-write copy
+
+alloc_status
+mem_pool_mark_dirty(pool_pt pool, const void *mem, size_t size); // data changed in place
+
+pool_pt
+mem_pool_open_shared(const char *name, size_t size, alloc_policy policy); // POSIX shm, several processes
+
+pool_pt
+mem_ctx_pool_open_shared(mem_ctx_pt ctx, const char *name, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_unlink_shared(const char *name); // removes name, the pool goes with its last close
+
+pool_pt
+mem_pool_open_child(pool_pt parent, size_t size, alloc_policy policy); // memory is one allocation in parent
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_reset(pool_pt pool);       // frees all allocations and child pools at once
+
+/*
+ * The alloc_pt returned points into the pool's node heap, which moves
+ * when it grows, so it is valid only until the next allocation in the
+ * pool. Keep a copy of the alloc_t, or alloc->mem, and pass the copy to
+ * mem_del_alloc (or the address to mem_free_any) later. For a shared
+ * pool it is a copy in this process's mapping, which the next
+ * allocation through the same mapping overwrites.
+ */
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_pt
+mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_status
+mem_set_thread_tag(unsigned tag);   // tag for this thread's mem_new_alloc calls
+
+unsigned
+mem_thread_tag();
+
+alloc_status
+mem_pool_tag_stats(pool_pt pool, unsigned tag, pool_tag_stats_pt stats);
+
+alloc_status
+mem_guard_start(unsigned sample_rate, unsigned num_slots); // 0 for the defaults
+
+alloc_status
+mem_guard_stop();
+
+size_t
+mem_alloc_offset(pool_pt pool, alloc_pt alloc);
+
+pool_pt
+mem_pool_of(const void *ptr);       // the open pool holding ptr, or NULL
+
+alloc_status
+mem_free_any(void *ptr);            // mem_del_alloc of the allocation at ptr, in whichever pool
+
+pool_group_pt
+mem_group_open();
+
+alloc_status
+mem_group_close(pool_group_pt group); // the member pools stay open
+
+alloc_status
+mem_group_add(pool_group_pt group, pool_pt pool);
+
+alloc_status
+mem_group_remove(pool_group_pt group, pool_pt pool);
+
+alloc_pt
+mem_group_alloc(pool_group_pt group, size_t size, pool_pt *pool); // from the member with the largest gap
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+void
+mem_segment_iter_init(pool_pt pool, pool_segment_iter_pt iter, unsigned gaps_only, size_t min_size);
+
+unsigned
+mem_segment_iter_next(pool_segment_iter_pt iter, pool_segment_pt segment); // 0 when done
+
+alloc_status
+mem_read_pool(pool_pt pool, pool_pt stats); // lock-free consistent copy of the pool metadata
+
+alloc_status
+mem_read_segments(pool_pt pool, pool_segment_pt segments, unsigned capacity, unsigned *num_segments);
+
+alloc_status
+mem_stats_export(const char *name); // shared-memory stats for mempool-top, NULL for "/mem_pool.<pid>"
+
+alloc_status
+mem_stats_unexport();
+
+const char *
+mem_stats_name();                   // NULL when not exporting
+
+alloc_status
+mem_profile_start(size_t sample_bytes); // sample 1 in every sample_bytes allocated bytes, 0 for the default
+
+alloc_status
+mem_profile_stop();
+
+alloc_status
+mem_profile_dump(const char *path);     // live and cumulative profile, pprof heap format
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
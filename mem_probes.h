@@ -0,0 +1,48 @@
+//
+// USDT (statically defined tracing) probes of the pool library, in
+// provider "mem_pool". With <sys/sdt.h> (systemtap-sdt-dev) each probe
+// compiles to a single NOP plus an ELF note, which bpftrace and perf
+// patch when a tracer attaches. Without it, or with
+// MEM_POOL_NO_PROBES defined, the probes compile to nothing.
+//
+// Probes and their arguments:
+//   pool_open      (pool, size, policy)
+//   pool_close     (pool)
+//   alloc_entry    (pool, size)
+//   alloc_return   (pool, size, mem)    mem is NULL on failure
+//   free_entry     (pool, mem)
+//   free_return    (pool, mem, status)
+//   split          (pool, mem, size, remaining_gap)
+//   merge          (pool, mem, size)     mem and size of the merged gap
+//
+
+#ifndef DENVER_OS_PA_C_MEM_PROBES_H
+#define DENVER_OS_PA_C_MEM_PROBES_H
+
+#if !defined(MEM_POOL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MEM_POOL_HAVE_PROBES
+#endif
+#endif
+
+#ifdef MEM_POOL_HAVE_PROBES
+
+#include <sys/sdt.h>
+
+#define MEM_PROBE1(name, a)             DTRACE_PROBE1(mem_pool, name, a)
+#define MEM_PROBE2(name, a, b)          DTRACE_PROBE2(mem_pool, name, a, b)
+#define MEM_PROBE3(name, a, b, c)       DTRACE_PROBE3(mem_pool, name, a, b, c)
+#define MEM_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(mem_pool, name, a, b, c, d)
+
+#else
+
+// the arguments are still evaluated, so that variables only the probes
+// read do not warn as unused
+#define MEM_PROBE1(name, a)             do { (void) (a); } while (0)
+#define MEM_PROBE2(name, a, b)          do { (void) (a); (void) (b); } while (0)
+#define MEM_PROBE3(name, a, b, c)       do { (void) (a); (void) (b); (void) (c); } while (0)
+#define MEM_PROBE4(name, a, b, c, d)    do { (void) (a); (void) (b); (void) (c); (void) (d); } while (0)
+
+#endif
+
+#endif //DENVER_OS_PA_C_MEM_PROBES_H
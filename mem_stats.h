@@ -0,0 +1,54 @@
+//
+// Layout of the shared-memory stats region exported by the pool
+// library (see mem_stats_export) and read by mempool-top. Readers
+// must check magic and version, and index slots by header_size and
+// slot_size, so later versions can append fields.
+//
+
+#ifndef DENVER_OS_PA_C_MEM_STATS_H
+#define DENVER_OS_PA_C_MEM_STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+
+#define MEM_STATS_MAGIC         0x5453504dU     // "MPST"
+#define MEM_STATS_VERSION       1
+#define MEM_STATS_MAX_POOLS     64
+#define MEM_STATS_GAP_INTERVAL  64              // updates between largest_gap refreshes
+#define MEM_STATS_NAME_FORMAT   "/mem_pool.%d"  // default shm name, by pid
+#define MEM_STATS_SIGNAL        SIGUSR2         // starts the export in a running process, see mem_init
+
+/* type declarations */
+
+/*
+ * One slot per open pool. The owning process updates a slot under its
+ * seqlock: seq is odd while an update is in progress, and a reader
+ * retries until it sees the same even value before and after copying.
+ */
+typedef struct _mem_stats_slot {
+    _Atomic uint32_t seq;
+    uint32_t in_use;
+    uint32_t pool_id;           // order in which the pools were opened
+    uint32_t policy;            // alloc_policy
+    uint64_t total_size;
+    uint64_t alloc_size;
+    uint64_t num_allocs;
+    uint64_t num_gaps;
+    uint64_t largest_gap;       // raised by every free, lowered only every MEM_STATS_GAP_INTERVAL updates
+    uint64_t allocs;            // cumulative since the pool was opened
+    uint64_t frees;
+    uint64_t failed_allocs;
+} mem_stats_slot_t, *mem_stats_slot_pt;
+
+typedef struct _mem_stats_region {
+    _Atomic uint32_t magic;     // stored last, once the region is initialized
+    uint32_t version;
+    uint32_t header_size;       // offset of slots[0]
+    uint32_t slot_size;
+    uint32_t max_pools;
+    uint32_t pid;
+    mem_stats_slot_t slots[MEM_STATS_MAX_POOLS];
+} mem_stats_region_t, *mem_stats_region_pt;
+
+#endif //DENVER_OS_PA_C_MEM_STATS_H
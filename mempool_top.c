@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mem_pool.h"
+#include "mem_stats.h"
+
+
+/*****            constants            *****/
+
+static const unsigned READ_MAX_RETRIES = 1000;
+static const unsigned ATTACH_MAX_WAITS = 50; // of 100 ms, after MEM_STATS_SIGNAL
+
+
+/*****         helper routines         *****/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-i SEC] [-n COUNT] [-s] PID|/NAME\n"
+            "  attaches to the stats a process exports with MEM_POOL_STATS=1\n"
+            "  (or mem_stats_export) and prints them every SEC seconds\n"
+            "  -i SEC    refresh interval (default 1)\n"
+            "  -n COUNT  number of refreshes, 0 for no limit (default 0)\n"
+            "  -s        if PID does not export yet, send it SIGUSR2 to start; the\n"
+            "            export begins at its next allocation or deallocation (a\n"
+            "            process without the mem_pool handler is killed by it)\n"
+            "  frag%% uses the largest gap, which may lag shrinking by up to %d updates\n",
+            prog, MEM_STATS_GAP_INTERVAL);
+}
+
+static const mem_stats_slot_t *slot_at(const mem_stats_region_t *region, unsigned i) {
+    return (const mem_stats_slot_t *) ((const char *) region + region->header_size
+                                       + (size_t) i * region->slot_size);
+}
+
+/* seqlock read of one slot; 0 if the slot kept changing */
+static int read_slot(const mem_stats_slot_t *slot, mem_stats_slot_t *copy) {
+    for (unsigned retry = 0; retry < READ_MAX_RETRIES; ++retry) {
+        uint32_t seq = atomic_load_explicit((_Atomic uint32_t *) &slot->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        copy->in_use = slot->in_use;
+        copy->pool_id = slot->pool_id;
+        copy->policy = slot->policy;
+        copy->total_size = slot->total_size;
+        copy->alloc_size = slot->alloc_size;
+        copy->num_allocs = slot->num_allocs;
+        copy->num_gaps = slot->num_gaps;
+        copy->largest_gap = slot->largest_gap;
+        copy->allocs = slot->allocs;
+        copy->frees = slot->frees;
+        copy->failed_allocs = slot->failed_allocs;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit((_Atomic uint32_t *) &slot->seq, memory_order_relaxed) == seq)
+            return 1;
+    }
+    return 0;
+}
+
+static const char *human_size(uint64_t bytes, char *buf, size_t len) {
+    const char *units[] = { "B", "K", "M", "G", "T" };
+    double value = (double) bytes;
+    unsigned u = 0;
+    while (value >= 1024 && u + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024;
+        u++;
+    }
+    snprintf(buf, len, u ? "%.1f%s" : "%.0f%s", value, units[u]);
+    return buf;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*****              main               *****/
+
+int main(int argc, char *argv[]) {
+    double interval = 1.0;
+    unsigned long count = 0;
+    int start = 0;
+    const char *target = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            count = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-s") == 0)
+            start = 1;
+        else if (target == NULL && argv[i][0] != '-')
+            target = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (target == NULL || interval <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char name[64];
+    if (target[0] == '/')
+        snprintf(name, sizeof(name), "%s", target);
+    else
+        snprintf(name, sizeof(name), MEM_STATS_NAME_FORMAT, atoi(target));
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0 && start && target[0] != '/' && kill((pid_t) atoi(target), MEM_STATS_SIGNAL) == 0) {
+        struct timespec wait = { 0, 100000000 };
+        for (unsigned i = 0; fd < 0 && i < ATTACH_MAX_WAITS; ++i) {
+            nanosleep(&wait, NULL);
+            fd = shm_open(name, O_RDONLY, 0);
+        }
+        // and give the export the moment it takes to write the header
+        nanosleep(&wait, NULL);
+    }
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(name);
+        return 1;
+    }
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(name);
+        return 1;
+    }
+
+    const mem_stats_region_t *region = (const mem_stats_region_t *) map;
+    if ((size_t) st.st_size < sizeof(uint32_t) * 6
+        || atomic_load_explicit((_Atomic uint32_t *) &region->magic, memory_order_acquire) != MEM_STATS_MAGIC
+        || region->version != MEM_STATS_VERSION
+        || region->slot_size < sizeof(mem_stats_slot_t)
+        || region->header_size + (size_t) region->max_pools * region->slot_size > (size_t) st.st_size) {
+        fprintf(stderr, "%s: not a mem_pool stats region (version %d)\n", name, MEM_STATS_VERSION);
+        munmap(map, (size_t) st.st_size);
+        return 1;
+    }
+
+    // previous readings, for the rates
+    unsigned max_pools = region->max_pools;
+    mem_stats_slot_t *prev = calloc(max_pools, sizeof(mem_stats_slot_t));
+    double prev_time = now_sec();
+    int clear = isatty(STDOUT_FILENO) && count != 1;
+
+    for (unsigned long n = 0; count == 0 || n < count; ++n) {
+        if (n > 0) {
+            struct timespec ts = { (time_t) interval, (long) ((interval - (time_t) interval) * 1e9) };
+            nanosleep(&ts, NULL);
+        }
+        double now = now_sec(), elapsed = now - prev_time;
+        prev_time = now;
+
+        if (clear) printf("\033[H\033[2J");
+        printf("mempool-top  pid %u  %s\n\n", region->pid, name);
+        printf("%5s %-9s %9s %9s %6s %9s %8s %9s %6s %10s %10s %8s\n",
+               "pool", "policy", "size", "alloc", "used%", "allocs", "gaps", "largest", "frag%",
+               "allocs/s", "frees/s", "failed");
+
+        for (unsigned i = 0; i < max_pools; ++i) {
+            mem_stats_slot_t s;
+            if (!read_slot(slot_at(region, i), &s) || !s.in_use) {
+                if (prev) prev[i].in_use = 0;
+                continue;
+            }
+            // rates only against the same pool in the same slot
+            int same = prev && prev[i].in_use && prev[i].pool_id == s.pool_id && n > 0;
+            double alloc_rate = same ? (s.allocs - prev[i].allocs) / elapsed : 0;
+            double free_rate = same ? (s.frees - prev[i].frees) / elapsed : 0;
+            uint64_t free_bytes = s.total_size - s.alloc_size;
+            double frag = free_bytes ? 100.0 * (1.0 - (double) s.largest_gap / free_bytes) : 0;
+            if (frag < 0) frag = 0;
+            char b1[16], b2[16], b3[16];
+
+            printf("%5u %-9s %9s %9s %6.1f %9llu %8llu %9s %6.1f %10.0f %10.0f %8llu\n",
+                   s.pool_id, s.policy == FIRST_FIT ? "FIRST_FIT" : "BEST_FIT",
+                   human_size(s.total_size, b1, sizeof(b1)), human_size(s.alloc_size, b2, sizeof(b2)),
+                   s.total_size ? 100.0 * s.alloc_size / s.total_size : 0,
+                   (unsigned long long) s.num_allocs, (unsigned long long) s.num_gaps,
+                   human_size(s.largest_gap, b3, sizeof(b3)), frag, alloc_rate, free_rate,
+                   (unsigned long long) s.failed_allocs);
+            if (prev) prev[i] = s;
+        }
+        fflush(stdout);
+    }
+
+    free(prev);
+    munmap(map, (size_t) st.st_size);
+    return 0;
+}
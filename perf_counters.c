@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/*****            constants            *****/
+
+static const char *PERF_EVENT_NAMES[PERF_NUM_EVENTS] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+const char *perf_event_name(perf_event_id event) {
+    return (unsigned) event < PERF_NUM_EVENTS ? PERF_EVENT_NAMES[event] : "unknown";
+}
+
+
+#ifdef __linux__
+
+#define CACHE_READ_MISS(cache) \
+        ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} PERF_EVENTS[PERF_NUM_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+        { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+        { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/*
+ * Events are opened one by one rather than as a group, so a single
+ * unsupported event does not take the others down. When the PMU has
+ * fewer slots than events the kernel multiplexes them; the counts are
+ * scaled by enabled/running time to compensate.
+ */
+
+unsigned perf_counters_open(perf_counters_pt counters) {
+    counters->num_available = 0;
+    for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_EVENTS[e].type;
+        attr.config = PERF_EVENTS[e].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;    // allowed at perf_event_paranoid 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        counters->fds[e] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fds[e] >= 0)
+            counters->num_available++;
+    }
+    return counters->num_available;
+}
+
+void perf_counters_start(perf_counters_pt counters) {
+    for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e) {
+        if (counters->fds[e] < 0)
+            continue;
+        ioctl(counters->fds[e], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_counters_stop(perf_counters_pt counters, perf_sample_pt sample) {
+    memset(sample, 0, sizeof(perf_sample_t));
+    for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e) {
+        if (counters->fds[e] >= 0)
+            ioctl(counters->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e) {
+        unsigned long long buf[3];  // value, time enabled, time running
+        if (counters->fds[e] < 0)
+            continue;
+        if (read(counters->fds[e], buf, sizeof(buf)) != (ssize_t) sizeof(buf) || buf[2] == 0)
+            continue;
+        sample->values[e] = (buf[2] < buf[1])
+                            ? (unsigned long long) ((double) buf[0] * buf[1] / buf[2])
+                            : buf[0];
+        sample->valid[e] = 1;
+    }
+}
+
+void perf_counters_close(perf_counters_pt counters) {
+    for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e) {
+        if (counters->fds[e] >= 0)
+            close(counters->fds[e]);
+        counters->fds[e] = -1;
+    }
+    counters->num_available = 0;
+}
+
+#else
+
+unsigned perf_counters_open(perf_counters_pt counters) {
+    for (unsigned e = 0; e < PERF_NUM_EVENTS; ++e)
+        counters->fds[e] = -1;
+    counters->num_available = 0;
+    return 0;
+}
+
+void perf_counters_start(perf_counters_pt counters) {
+    (void) counters;
+}
+
+void perf_counters_stop(perf_counters_pt counters, perf_sample_pt sample) {
+    (void) counters;
+    memset(sample, 0, sizeof(perf_sample_t));
+}
+
+void perf_counters_close(perf_counters_pt counters) {
+    (void) counters;
+}
+
+#endif
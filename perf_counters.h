@@ -0,0 +1,50 @@
+//
+// Hardware performance counters for the benchmarks, read with
+// perf_event_open(2). Every counter is optional: events the kernel
+// or the hardware refuses (no PMU, perf_event_paranoid, containers)
+// are simply left out of the results.
+//
+
+#ifndef DENVER_OS_PA_C_PERF_COUNTERS_H
+#define DENVER_OS_PA_C_PERF_COUNTERS_H
+
+/* type declarations */
+
+typedef enum _perf_event_id {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NUM_EVENTS
+} perf_event_id;
+
+typedef struct _perf_counters {
+    int fds[PERF_NUM_EVENTS];           // -1 when the event is unavailable
+    unsigned num_available;
+} perf_counters_t, *perf_counters_pt;
+
+typedef struct _perf_sample {
+    unsigned long long values[PERF_NUM_EVENTS];
+    unsigned valid[PERF_NUM_EVENTS];
+} perf_sample_t, *perf_sample_pt;
+
+/* function declarations */
+
+unsigned
+perf_counters_open(perf_counters_pt counters);  // returns the number of usable events
+
+void
+perf_counters_start(perf_counters_pt counters);
+
+void
+perf_counters_stop(perf_counters_pt counters, perf_sample_pt sample);
+
+void
+perf_counters_close(perf_counters_pt counters);
+
+const char *
+perf_event_name(perf_event_id event);
+
+#endif //DENVER_OS_PA_C_PERF_COUNTERS_H
@@ -2,8 +2,22 @@
 // Created by Ivo Georgiev on 3/3/16.
 //
 
+#define _POSIX_C_SOURCE 200809L // for shm_open()
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -11,6 +25,7 @@
 
 #include "cmocka.h"
 #include "mem_pool.h"
+#include "mem_stats.h"
 #include "test_suite.h"
 
 
@@ -2316,7 +2331,1503 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
+/***         5. POOL EXTENSIONS          ***/
+/*******************************************/
+
+static void test_pool_simulated(void **state) {
+    (void) state; /* unused */
+
+    size_t pool_size = (size_t) 1 << 40; // 1 TiB, never backed by memory
+    alloc_pt alloc0, alloc1;
+    alloc_t rec0, rec1;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    INFO("Simulating a pool of %lu bytes\n", (unsigned long) pool_size);
+    pool_pt pool = mem_pool_open_sim(pool_size, BEST_FIT);
+    assert_non_null(pool);
+    assert_null(pool->mem);
+
+    alloc0 = mem_new_alloc(pool, pool_size / 4);
+    assert_non_null(alloc0);
+    rec0 = *alloc0;
+    alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    rec1 = *alloc1;
+
+    // the first allocation sits at offset 0
+    assert_true(mem_alloc_offset(pool, &rec0) == 0);
+    assert_true(mem_alloc_offset(pool, &rec1) == pool_size / 4);
+    assert_true(pool->alloc_size == pool_size / 4 + 100);
+    assert_int_equal(pool->num_allocs, 2);
+    assert_int_equal(pool->num_gaps, 1);
+
+    assert_int_equal(mem_del_alloc(pool, &rec0), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 2);
+    assert_int_equal(mem_del_alloc(pool, &rec1), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_segment_iter(void **state) {
+    (void) state; /* unused */
+
+    const pool_segment_t exp[3] = {
+            {100, 1},
+            {300, 0},
+            {POOL_SIZE - 400, 1}
+    };
+    pool_segment_iter_t iter;
+    pool_segment_t seg;
+    unsigned count = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    alloc_t rec0 = *mem_new_alloc(pool, 100);
+    alloc_t rec1 = *mem_new_alloc(pool, 200);
+    alloc_t rec2 = *mem_new_alloc(pool, 100);
+    alloc_t rec3 = *mem_new_alloc(pool, POOL_SIZE - 400);
+    assert_int_equal(mem_del_alloc(pool, &rec1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &rec2), ALLOC_OK);
+    // segments: 100 alloc, 300 gap (merged), POOL_SIZE - 400 alloc
+
+    // all segments in address order
+    mem_segment_iter_init(pool, &iter, 0, 0);
+    while (mem_segment_iter_next(&iter, &seg)) {
+        assert_true(count < 3);
+        assert_memory_equal(&exp[count], &seg, sizeof(pool_segment_t));
+        count++;
+    }
+    assert_int_equal(count, 3);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 0);
+
+    // gaps only, with a size filter
+    mem_segment_iter_init(pool, &iter, 1, 300);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 1);
+    assert_true(seg.size == 300 && seg.allocated == 0);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 0);
+
+    mem_segment_iter_init(pool, &iter, 1, 301);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 0);
+
+    assert_int_equal(mem_del_alloc(pool, &rec0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &rec3), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_read(void **state) {
+    (void) state; /* unused */
+
+    const pool_segment_t exp[2] = {
+            {100, 1},
+            {POOL_SIZE - 100, 0}
+    };
+    pool_segment_t segs[2];
+    unsigned num_segs = 0;
+    pool_t stats;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    alloc_t rec = *mem_new_alloc(pool, 100);
+
+    assert_int_equal(mem_read_pool(pool, &stats), ALLOC_OK);
+    assert_memory_equal(pool, &stats, sizeof(pool_t));
+
+    assert_int_equal(mem_read_segments(pool, segs, 2, &num_segs), ALLOC_OK);
+    assert_int_equal(num_segs, 2);
+    assert_memory_equal(exp, segs, sizeof(exp));
+
+    // too small a buffer reports the required size
+    assert_int_equal(mem_read_segments(pool, segs, 1, &num_segs), ALLOC_FAIL);
+    assert_int_equal(num_segs, 2);
+
+    assert_int_equal(mem_del_alloc(pool, &rec), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+#define RACE_ALLOC_SIZE 100
+#define RACE_MAX_LIVE   8000
+
+typedef struct _race {
+    pool_pt pool;
+    atomic_int started, done;
+} race_t;
+
+static void *race_writer(void *arg) {
+    race_t *race = (race_t *) arg;
+    static alloc_t live[RACE_MAX_LIVE];
+    unsigned num_live = 0, seed = 1;
+    while (! atomic_load(&race->started))
+        ;
+    // grow to the most live allocations, through node heap resizes, with frees mixed in
+    for (unsigned round = 0; round < 3; round++) {
+        for (unsigned i = 0; i < 4 * RACE_MAX_LIVE; i++) {
+            seed = seed * 1103515245 + 12345;
+            if (num_live < RACE_MAX_LIVE && (num_live == 0 || (seed >> 16) % 4 != 0)) {
+                alloc_pt alloc = mem_new_alloc(race->pool, RACE_ALLOC_SIZE);
+                if (alloc != NULL)
+                    live[num_live++] = *alloc;
+            } else {
+                unsigned k = (seed >> 8) % num_live;
+                mem_del_alloc(race->pool, &live[k]);
+                live[k] = live[--num_live];
+            }
+        }
+        while (num_live > 0)
+            mem_del_alloc(race->pool, &live[--num_live]);
+    }
+    atomic_store(&race->done, 1);
+    return NULL;
+}
+
+static void test_pool_read_race(void **state) {
+    (void) state; /* unused */
+
+    const unsigned capacity = 2 * RACE_MAX_LIVE + 1;
+    pool_segment_pt segs = calloc(capacity, sizeof(pool_segment_t));
+    assert_non_null(segs);
+    race_t race;
+    pthread_t writer;
+    unsigned long pool_reads = 0, segment_reads = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    race.pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(race.pool);
+    atomic_init(&race.started, 0);
+    atomic_init(&race.done, 0);
+    assert_int_equal(pthread_create(&writer, NULL, race_writer, &race), 0);
+    atomic_store(&race.started, 1);
+
+    // every read that succeeds is one state of the pool, where all the
+    // allocations have the same size and no two gaps are adjacent
+    while (! atomic_load(&race.done)) {
+        pool_t stats;
+        unsigned num_segs;
+        if (mem_read_pool(race.pool, &stats) == ALLOC_OK) {
+            assert_true(stats.total_size == POOL_SIZE);
+            assert_true(stats.alloc_size == (size_t) stats.num_allocs * RACE_ALLOC_SIZE);
+            assert_true(stats.num_gaps <= stats.num_allocs + 1);
+            pool_reads++;
+        }
+        if (mem_read_segments(race.pool, segs, capacity, &num_segs) == ALLOC_OK) {
+            size_t total = 0;
+            unsigned num_allocs = 0, num_gaps = 0;
+            for (unsigned i = 0; i < num_segs; i++) {
+                total += segs[i].size;
+                if (segs[i].allocated) {
+                    assert_true(segs[i].size == RACE_ALLOC_SIZE);
+                    num_allocs++;
+                } else {
+                    assert_false(i > 0 && ! segs[i - 1].allocated);
+                    num_gaps++;
+                }
+            }
+            assert_true(total == POOL_SIZE);
+            assert_true(num_allocs + num_gaps == num_segs);
+            assert_true(num_gaps <= num_allocs + 1);
+            segment_reads++;
+        }
+    }
+    assert_int_equal(pthread_join(writer, NULL), 0);
+    assert_true(pool_reads > 0);
+    assert_true(segment_reads > 0);
+
+    free(segs);
+    assert_int_equal(race.pool->num_allocs, 0);
+    assert_int_equal(mem_pool_close(race.pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_stats_export(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    assert_int_equal(mem_stats_export("/mem_pool_test_suite"), ALLOC_OK);
+    assert_int_equal(mem_stats_export("/mem_pool_test_suite"), ALLOC_CALLED_AGAIN);
+    assert_string_equal(mem_stats_name(), "/mem_pool_test_suite");
+
+    // read it back the way mempool-top does
+    int fd = shm_open("/mem_pool_test_suite", O_RDONLY, 0);
+    assert_true(fd >= 0);
+    mem_stats_region_pt region = mmap(NULL, sizeof(mem_stats_region_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    assert_true(region != MAP_FAILED);
+    assert_int_equal(region->magic, MEM_STATS_MAGIC);
+    assert_int_equal(region->version, MEM_STATS_VERSION);
+    assert_int_equal(region->pid, getpid());
+
+    // pools opened before the export are picked up at their next operation
+    mem_stats_slot_pt slot = &region->slots[0];
+    assert_int_equal(slot->in_use, 0);
+    alloc_t rec = *mem_new_alloc(pool, 100);
+    assert_null(mem_new_alloc(pool, POOL_SIZE));
+    assert_int_equal(slot->in_use, 1);
+    assert_int_equal(slot->policy, FIRST_FIT);
+    assert_true(slot->total_size == POOL_SIZE);
+    assert_true(slot->alloc_size == 100);
+    assert_true(slot->num_allocs == 1 && slot->num_gaps == 1);
+    assert_true(slot->allocs == 1 && slot->failed_allocs == 1 && slot->frees == 0);
+
+    assert_int_equal(mem_del_alloc(pool, &rec), ALLOC_OK);
+    assert_true(slot->frees == 1 && slot->alloc_size == 0);
+
+    // the largest gap is rescanned every MEM_STATS_GAP_INTERVAL updates, and raised by frees
+    rec = *mem_new_alloc(pool, POOL_SIZE);
+    while ((slot->allocs + slot->frees + slot->failed_allocs) % MEM_STATS_GAP_INTERVAL != 0)
+        assert_null(mem_new_alloc(pool, 1));
+    assert_true(slot->largest_gap == 0);
+    assert_int_equal(mem_del_alloc(pool, &rec), ALLOC_OK);
+    assert_true(slot->largest_gap == POOL_SIZE);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(slot->in_use, 0);
+
+    munmap(region, sizeof(mem_stats_region_t));
+    // mem_free unexports and removes the object
+    assert_int_equal(mem_free(), ALLOC_OK);
+    assert_null(mem_stats_name());
+    assert_true(shm_open("/mem_pool_test_suite", O_RDONLY, 0) < 0);
+
+    // a running process starts exporting on MEM_STATS_SIGNAL, at its next operation
+    char name[64];
+    snprintf(name, sizeof(name), MEM_STATS_NAME_FORMAT, (int) getpid());
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(raise(MEM_STATS_SIGNAL), 0);
+    assert_null(mem_stats_name());
+    rec = *mem_new_alloc(pool, 100);
+    assert_non_null(mem_stats_name());
+    assert_string_equal(mem_stats_name(), name);
+    assert_int_equal(mem_del_alloc(pool, &rec), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    assert_true(shm_open(name, O_RDONLY, 0) < 0);
+}
+
+static void test_pool_profile(void **state) {
+    (void) state; /* unused */
+
+    const char *path = "mem_pool_test_suite.heap";
+    alloc_t recs[3];
+    char header[128];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_profile_dump(path), ALLOC_FAIL);
+
+    // a 1-byte interval samples every allocation
+    assert_int_equal(mem_profile_start(1), ALLOC_OK);
+    assert_int_equal(mem_profile_start(1), ALLOC_CALLED_AGAIN);
+    for (unsigned i = 0; i < 2; i++)
+        recs[i] = *mem_new_alloc(pool, 100);
+    recs[2] = *mem_new_alloc_tagged(pool, 100, 0);
+    assert_int_equal(mem_del_alloc(pool, &recs[1]), ALLOC_OK);
+
+    assert_int_equal(mem_profile_dump(path), ALLOC_OK);
+    FILE *in = fopen(path, "r");
+    assert_non_null(in);
+    assert_non_null(fgets(header, sizeof(header), in));
+#ifdef __GLIBC__
+    // every stack starts in this function, whichever entry allocated
+    char line[1024];
+    unsigned stacks = 0;
+    while (fgets(line, sizeof(line), in) != NULL && strchr(line, '@') != NULL) {
+        void *pc = NULL;
+        assert_int_equal(sscanf(strchr(line, '@'), "@ %p", &pc), 1);
+        uintptr_t offset = (uintptr_t) pc - (uintptr_t) test_pool_profile;
+        assert_true((uintptr_t) pc > (uintptr_t) test_pool_profile && offset < 4096);
+        stacks++;
+    }
+    assert_int_equal(stacks, 2);
+#endif
+    fclose(in);
+    remove(path);
+    assert_string_equal(header, "heap profile: 2: 200 [3: 300] @ heap_v2/1\n");
+
+    assert_int_equal(mem_del_alloc(pool, &recs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &recs[2]), ALLOC_OK);
+    assert_int_equal(mem_profile_stop(), ALLOC_OK);
+    assert_int_equal(mem_profile_stop(), ALLOC_CALLED_AGAIN);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_tags(void **state) {
+    (void) state; /* unused */
+
+    pool_tag_stats_t stats;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    assert_int_equal(mem_thread_tag(), 0);
+    assert_int_equal(mem_set_thread_tag(MEM_NUM_TAGS), ALLOC_FAIL);
+    assert_null(mem_new_alloc_tagged(pool, 100, MEM_NUM_TAGS));
+
+    alloc_t tagged = *mem_new_alloc_tagged(pool, 100, 3);
+    assert_int_equal(mem_set_thread_tag(5), ALLOC_OK);
+    alloc_t first = *mem_new_alloc(pool, 200);
+    alloc_t second = *mem_new_alloc(pool, 300);
+    assert_int_equal(mem_set_thread_tag(0), ALLOC_OK);
+
+    assert_int_equal(mem_pool_tag_stats(pool, 3, &stats), ALLOC_OK);
+    assert_int_equal(stats.live_bytes, 100);
+    assert_int_equal(stats.live_allocs, 1);
+    assert_int_equal(mem_del_alloc(pool, &first), ALLOC_OK);
+    assert_int_equal(mem_pool_tag_stats(pool, 5, &stats), ALLOC_OK);
+    assert_int_equal(stats.live_bytes, 300);
+    assert_int_equal(stats.live_allocs, 1);
+    assert_int_equal(stats.peak_bytes, 500);
+    assert_int_equal(stats.total_allocs, 2);
+    assert_int_equal(mem_pool_tag_stats(pool, 0, &stats), ALLOC_OK);
+    assert_int_equal(stats.total_allocs, 0);
+    assert_int_equal(mem_pool_tag_stats(pool, MEM_NUM_TAGS, &stats), ALLOC_FAIL);
+
+    assert_int_equal(mem_del_alloc(pool, &tagged), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &second), ALLOC_OK);
+    assert_int_equal(mem_pool_tag_stats(pool, 3, &stats), ALLOC_OK);
+    assert_int_equal(stats.live_bytes, 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/* whether writing to addr kills a forked child with SIGSEGV */
+static int write_faults(char *addr) {
+    int status;
+    pid_t child = fork();
+    if (child == 0) {
+        *(volatile char *) addr = 1;
+        _exit(0);
+    }
+    return waitpid(child, &status, 0) == child && WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+static sigjmp_buf foreign_fault_env;
+static volatile sig_atomic_t num_foreign_faults;
+
+static void on_foreign_fault(int sig) {
+    (void) sig;
+    num_foreign_faults++;
+    siglongjmp(foreign_fault_env, 1);
+}
+
+static void test_pool_guard(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    // a rate of 1 guards every allocation that fits a page
+    assert_int_equal(mem_guard_start(1, 4), ALLOC_OK);
+    assert_int_equal(mem_guard_start(1, 4), ALLOC_CALLED_AGAIN);
+    alloc_t guarded = *mem_new_alloc(pool, 100);
+    assert_int_equal(((uintptr_t) guarded.mem + 100) % (uintptr_t) sysconf(_SC_PAGESIZE), 0);
+    assert_int_equal(mem_alloc_offset(pool, &guarded), 0);
+    memset(guarded.mem, 0xab, 100);
+    assert_true(write_faults(guarded.mem + 100));
+    assert_int_equal(mem_guard_stop(), ALLOC_NOT_FREED);
+
+    assert_int_equal(mem_del_alloc(pool, &guarded), ALLOC_OK);
+    assert_true(write_faults(guarded.mem));
+    assert_int_equal(mem_del_alloc(pool, &guarded), ALLOC_NOT_FREED);
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->num_gaps, 1);
+
+    // pools inside the pool, while it checkpoints: a child's region is never sampled
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(mem_pool_snapshot(pool, fileno(file)), ALLOC_OK);
+    pool_pt child = mem_pool_open_child(pool, 1000, FIRST_FIT);
+    assert_non_null(child);
+    assert_true(child->mem >= pool->mem && child->mem < pool->mem + pool->total_size);
+    assert_non_null(mem_new_alloc(child, 100));
+    // and an in-band pool in a sampled allocation marks no pages outside the pool
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    alloc_t buf = *mem_new_alloc(pool, page_size);
+    assert_int_equal(((uintptr_t) buf.mem + page_size) % page_size, 0);
+    pool_pt in_band = mem_pool_open_in(buf.mem, buf.size, FIRST_FIT);
+    assert_non_null(in_band);
+    assert_ptr_equal(mem_pool_of(in_band->mem), in_band);
+    assert_non_null(mem_new_alloc(in_band, 10));
+    assert_int_equal(mem_pool_checkpoint(pool, fileno(file)), ALLOC_OK);
+    fclose(file);
+    assert_int_equal(mem_pool_reset(in_band), ALLOC_OK);
+    assert_int_equal(mem_pool_close(in_band), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &buf), ALLOC_OK);
+    assert_int_equal(mem_pool_close(child), ALLOC_OK);
+    assert_int_equal(pool->num_allocs, 0);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_guard_stop(), ALLOC_OK);
+
+    // faults elsewhere go to the handler from before, which stays chained
+    struct sigaction action, saved, current;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_foreign_fault;
+    sigemptyset(&action.sa_mask);
+    assert_int_equal(sigaction(SIGSEGV, &action, &saved), 0);
+    assert_int_equal(mem_guard_start(1, 4), ALLOC_OK);
+    char *foreign = mmap(NULL, page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert_true(foreign != MAP_FAILED);
+    num_foreign_faults = 0;
+    for (unsigned i = 0; i < 2; i++)
+        if (sigsetjmp(foreign_fault_env, 1) == 0)
+            *(volatile char *) foreign = 1;
+    assert_int_equal(num_foreign_faults, 2);
+    assert_int_equal(sigaction(SIGSEGV, NULL, &current), 0);
+    assert_true(current.sa_flags & SA_SIGINFO);
+    assert_int_equal(mem_guard_stop(), ALLOC_OK);
+    munmap(foreign, page_size);
+    assert_int_equal(sigaction(SIGSEGV, &saved, NULL), 0);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_ctx(void **state) {
+    (void) state; /* unused */
+
+    // contexts need no mem_init, and are independent of each other
+    mem_ctx_pt ctx1 = mem_ctx_init();
+    mem_ctx_pt ctx2 = mem_ctx_init();
+    assert_non_null(ctx1);
+    assert_non_null(ctx2);
+
+    pool_pt pool1 = mem_ctx_pool_open(ctx1, POOL_SIZE, FIRST_FIT);
+    pool_pt pool2 = mem_ctx_pool_open_sim(ctx2, POOL_SIZE, BEST_FIT);
+    assert_non_null(pool1);
+    assert_non_null(pool2);
+    alloc_t alloc1 = *mem_new_alloc(pool1, 100);
+    alloc_t alloc2 = *mem_new_alloc(pool2, 200);
+    assert_int_equal(pool1->alloc_size, 100);
+    assert_int_equal(pool2->alloc_size, 200);
+
+    assert_int_equal(mem_ctx_free(ctx1), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool1, &alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool1), ALLOC_OK);
+    assert_int_equal(mem_ctx_free(ctx1), ALLOC_OK);
+
+    // every kind of pool opens in a context, and clones go in the source's
+    static char buf[1 << 16];
+    mem_ctx_pt ctx3 = mem_ctx_init();
+    assert_non_null(ctx3);
+    pool_pt in_band = mem_ctx_pool_open_in(ctx3, buf, sizeof(buf), FIRST_FIT);
+    assert_non_null(in_band);
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(mem_pool_snapshot(in_band, fileno(file)), ALLOC_OK);
+    pool_pt restored = mem_ctx_pool_restore(ctx3, fileno(file));
+    fclose(file);
+    assert_non_null(restored);
+    pool_pt clone = mem_pool_clone(restored);
+    assert_non_null(clone);
+    char name[64];
+    snprintf(name, sizeof(name), "/mem_pool.test.ctx.%d", (int) getpid());
+    pool_pt shared = mem_ctx_pool_open_shared(ctx3, name, POOL_SIZE, FIRST_FIT);
+    assert_non_null(shared);
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+    assert_int_equal(mem_ctx_store_size(ctx3), 4);
+    assert_int_equal(mem_ctx_store_size(NULL), 0);
+    assert_int_equal(mem_ctx_free(ctx3), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_close(shared), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone), ALLOC_OK);
+    assert_int_equal(mem_pool_close(restored), ALLOC_OK);
+    assert_int_equal(mem_pool_close(in_band), ALLOC_OK);
+    assert_int_equal(mem_ctx_free(ctx3), ALLOC_OK);
+
+    // the default context is unaffected, and is not freed under open pools either
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_free(), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    assert_int_equal(mem_del_alloc(pool2, &alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool2), ALLOC_OK);
+    assert_int_equal(mem_ctx_free(ctx2), ALLOC_OK);
+}
+
+static void test_pool_node_heap_moves(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_allocs = 500; // well past the initial node heap
+    alloc_t recs[num_allocs];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < num_allocs; i++) {
+        alloc_pt alloc = mem_new_alloc(pool, 100);
+        assert_non_null(alloc);
+        recs[i] = *alloc; // the record itself moves with the node heap
+        snprintf(recs[i].mem, recs[i].size, "allocation %u", i);
+    }
+
+    // the copies free the allocations, as do their addresses
+    for (unsigned i = 0; i < num_allocs; i++) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "allocation %u", i);
+        assert_string_equal(recs[i].mem, expected);
+        if (i % 2)
+            assert_int_equal(mem_del_alloc(pool, &recs[i]), ALLOC_OK);
+        else
+            assert_int_equal(mem_free_any(recs[i].mem), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->num_gaps, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_store_reuse(void **state) {
+    (void) state; /* unused */
+
+    pool_pt pools[4];
+
+    mem_ctx_pt ctx = mem_ctx_init();
+    assert_non_null(ctx);
+    for (unsigned i = 0; i < 4; i++) {
+        pools[i] = mem_ctx_pool_open(ctx, POOL_SIZE, FIRST_FIT);
+        assert_non_null(pools[i]);
+        assert_int_equal(mem_pool_slot(pools[i]), i);
+    }
+    assert_int_equal(mem_ctx_store_size(ctx), 4);
+
+    // the slots of closed pools go to the next pools, last freed first
+    assert_int_equal(mem_pool_close(pools[1]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pools[3]), ALLOC_OK);
+    pools[3] = mem_ctx_pool_open(ctx, POOL_SIZE, BEST_FIT);
+    pools[1] = mem_ctx_pool_open(ctx, POOL_SIZE, BEST_FIT);
+    assert_non_null(pools[3]);
+    assert_non_null(pools[1]);
+    assert_int_equal(mem_pool_slot(pools[3]), 3);
+    assert_int_equal(mem_pool_slot(pools[1]), 1);
+
+    // and churn does not grow the store
+    for (unsigned i = 0; i < 1000; i++) {
+        unsigned k = (i * 7) % 4;
+        unsigned slot = mem_pool_slot(pools[k]);
+        assert_int_equal(mem_pool_close(pools[k]), ALLOC_OK);
+        pools[k] = mem_ctx_pool_open_sim(ctx, POOL_SIZE, FIRST_FIT);
+        assert_non_null(pools[k]);
+        assert_int_equal(mem_pool_slot(pools[k]), slot);
+    }
+    assert_int_equal(mem_ctx_store_size(ctx), 4);
+
+    for (unsigned i = 0; i < 4; i++)
+        assert_int_equal(mem_pool_close(pools[i]), ALLOC_OK);
+    assert_int_equal(mem_ctx_free(ctx), ALLOC_OK);
+}
+
+static void test_pool_of(void **state) {
+    (void) state; /* unused */
+
+    char not_pooled;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    mem_ctx_pt ctx = mem_ctx_init();
+    assert_non_null(ctx);
+    pool_pt pool1 = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    pool_pt pool2 = mem_ctx_pool_open(ctx, POOL_SIZE, BEST_FIT);
+    assert_non_null(pool1);
+    assert_non_null(pool2);
+
+    char *mem1 = mem_new_alloc(pool1, 100)->mem;
+    char *mem2 = mem_new_alloc(pool2, 100)->mem;
+    assert_ptr_equal(mem_pool_of(mem1), pool1);
+    assert_ptr_equal(mem_pool_of(mem2 + 99), pool2);
+    assert_ptr_equal(mem_pool_of(pool1->mem + POOL_SIZE - 1), pool1);
+    assert_null(mem_pool_of(&not_pooled));
+
+    // only the start of an allocation frees it
+    assert_int_equal(mem_free_any(mem1 + 1), ALLOC_NOT_FREED);
+    assert_int_equal(mem_free_any(pool1->mem + 100), ALLOC_NOT_FREED);
+    assert_int_equal(mem_free_any(mem1), ALLOC_OK);
+    assert_int_equal(mem_free_any(mem2), ALLOC_OK);
+    assert_int_equal(mem_free_any(&not_pooled), ALLOC_NOT_FREED);
+    assert_int_equal(pool1->num_allocs, 0);
+    assert_int_equal(pool2->num_allocs, 0);
+
+    assert_int_equal(mem_pool_close(pool1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool2), ALLOC_OK);
+    assert_int_equal(mem_ctx_free(ctx), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_group(void **state) {
+    (void) state; /* unused */
+
+    pool_pt from = NULL;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool1 = mem_pool_open(1000, FIRST_FIT);
+    pool_pt pool2 = mem_pool_open(2000, BEST_FIT);
+    pool_pt pool3 = mem_pool_open(3000, FIRST_FIT);
+    pool_group_pt group = mem_group_open();
+    assert_non_null(group);
+    assert_int_equal(mem_group_add(group, pool1), ALLOC_OK);
+    assert_int_equal(mem_group_add(group, pool2), ALLOC_OK);
+    assert_int_equal(mem_group_add(group, pool3), ALLOC_OK);
+    assert_int_equal(mem_group_add(group, pool3), ALLOC_CALLED_AGAIN);
+
+    // always the member with the largest gap
+    alloc_t alloc3 = *mem_group_alloc(group, 2500, &from);
+    assert_ptr_equal(from, pool3);
+    alloc_t alloc2 = *mem_group_alloc(group, 1800, &from);
+    assert_ptr_equal(from, pool2);
+    assert_null(mem_group_alloc(group, 1500, &from));
+    alloc_t alloc1 = *mem_group_alloc(group, 900, &from);
+    assert_ptr_equal(from, pool1);
+
+    // a deallocation makes its pool the best member again
+    assert_int_equal(mem_del_alloc(pool3, &alloc3), ALLOC_OK);
+    alloc3 = *mem_group_alloc(group, 1500, &from);
+    assert_ptr_equal(from, pool3);
+
+    // closing a member leaves the group
+    assert_int_equal(mem_del_alloc(pool3, &alloc3), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool3), ALLOC_OK);
+    assert_null(mem_group_alloc(group, 1500, &from));
+    assert_int_equal(mem_group_remove(group, pool2), ALLOC_OK);
+    assert_int_equal(mem_group_remove(group, pool2), ALLOC_FAIL);
+    assert_null(mem_group_alloc(group, 150, &from));
+
+    // a member with the largest gap but out of nodes passes to the next
+    static char buf[1 << 16];
+    char *mems[1 << 8];
+    unsigned num_mems = 0;
+    pool_pt in_band = mem_pool_open_in(buf, sizeof(buf), FIRST_FIT);
+    assert_non_null(in_band);
+    for (alloc_pt alloc; num_mems < 1 << 8 && (alloc = mem_new_alloc(in_band, 1)) != NULL; )
+        mems[num_mems++] = alloc->mem;
+    assert_true(num_mems < 1 << 8);
+    assert_int_equal(mem_group_add(group, in_band), ALLOC_OK);
+    alloc_t alloc4 = *mem_group_alloc(group, 50, &from);
+    assert_ptr_equal(from, pool1);
+    // and is back once it has a node again
+    assert_int_equal(mem_free_any(mems[0]), ALLOC_OK);
+    assert_int_equal(mem_free_any(mems[1]), ALLOC_OK);
+    assert_non_null(mem_group_alloc(group, 5000, &from));
+    assert_ptr_equal(from, in_band);
+    assert_int_equal(mem_pool_reset(in_band), ALLOC_OK);
+    assert_int_equal(mem_pool_close(in_band), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool1, &alloc4), ALLOC_OK);
+
+    // a full member is tried once, even for nothing
+    pool_pt full = mem_pool_open(100, FIRST_FIT);
+    alloc_t alloc5 = *mem_new_alloc(full, 100);
+    pool_group_pt full_group = mem_group_open();
+    assert_int_equal(mem_group_add(full_group, full), ALLOC_OK);
+    assert_null(mem_group_alloc(full_group, 0, &from));
+    // and the keys follow the member
+    assert_int_equal(mem_del_alloc(full, &alloc5), ALLOC_OK);
+    assert_non_null(mem_group_alloc(full_group, 100, &from));
+    assert_ptr_equal(from, full);
+    assert_null(mem_group_alloc(full_group, 1, &from));
+    assert_int_equal(mem_group_close(full_group), ALLOC_OK);
+    assert_int_equal(mem_pool_reset(full), ALLOC_OK);
+    assert_int_equal(mem_pool_close(full), ALLOC_OK);
+
+    assert_int_equal(mem_group_close(group), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool1, &alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool2, &alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool2), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_child(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt parent = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(parent);
+
+    pool_pt child = mem_pool_open_child(parent, 1000, BEST_FIT);
+    assert_non_null(child);
+    assert_int_equal(parent->num_allocs, 1);
+    assert_int_equal(parent->alloc_size, 1000);
+    assert_ptr_equal(child->mem, parent->mem);
+    pool_pt grandchild = mem_pool_open_child(child, 400, FIRST_FIT);
+    assert_non_null(grandchild);
+    assert_null(mem_pool_open_child(child, 700, FIRST_FIT));
+
+    // the deepest pool holding an address owns it
+    char *mem = mem_new_alloc(grandchild, 100)->mem;
+    assert_ptr_equal(mem_pool_of(mem), grandchild);
+    assert_ptr_equal(mem_pool_of(child->mem + 500), child);
+    assert_ptr_equal(mem_pool_of(parent->mem + 1500), parent);
+    assert_int_equal(mem_pool_close(parent), ALLOC_NOT_FREED);
+
+    // resetting drops the grandchild with its allocation
+    mem_new_alloc(child, 50);
+    assert_int_equal(mem_pool_reset(child), ALLOC_OK);
+    assert_int_equal(child->num_allocs, 0);
+    assert_int_equal(child->num_gaps, 1);
+    assert_ptr_equal(mem_pool_of(mem), child);
+
+    // closing returns the whole region, whatever it holds
+    mem_new_alloc(child, 200);
+    assert_non_null(mem_pool_open_child(child, 300, FIRST_FIT));
+    assert_int_equal(mem_pool_close(child), ALLOC_OK);
+    assert_int_equal(parent->num_allocs, 0);
+    assert_int_equal(parent->num_gaps, 1);
+
+    assert_int_equal(mem_pool_close(parent), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_open_in(void **state) {
+    (void) state; /* unused */
+
+    static char buf[64 * 1024];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_open_in(buf, 64, FIRST_FIT));
+
+    // the pool, its nodes and its memory all lie in the buffer
+    pool_pt pool = mem_pool_open_in(buf + 1, sizeof(buf) - 1, BEST_FIT);
+    assert_non_null(pool);
+    assert_true((char *) pool >= buf && pool->mem + pool->total_size <= buf + sizeof(buf));
+    assert_true(pool->total_size > sizeof(buf) / 2);
+    assert_ptr_equal(mem_pool_of(pool->mem), pool);
+
+    // the node heap does not grow, so allocation fails once it is full
+    unsigned num_allocs = 0;
+    alloc_pt alloc;
+    while ((alloc = mem_new_alloc(pool, 8)) != NULL)
+        num_allocs++;
+    assert_true(num_allocs > 0);
+    assert_int_equal(pool->num_allocs, num_allocs);
+    assert_true(pool->alloc_size < pool->total_size);
+
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+    alloc_t record = *mem_new_alloc(pool, 100);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, &record), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_null(mem_pool_of(buf + sizeof(buf) / 2));
+
+    // a pool in an allocation of another pool nests in it
+    pool_pt outer = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(outer);
+    record = *mem_new_alloc(outer, POOL_SIZE / 2);
+    pool_pt inner = mem_pool_open_in(record.mem, record.size, FIRST_FIT);
+    assert_non_null(inner);
+    char *mem = mem_new_alloc(inner, 10)->mem;
+    assert_ptr_equal(mem_pool_of(mem), inner);
+    assert_ptr_equal(mem_pool_of(record.mem + record.size), outer);
+    assert_int_equal(mem_free_any(mem), ALLOC_OK);
+    assert_int_equal(mem_pool_close(inner), ALLOC_OK);
+    assert_ptr_equal(mem_pool_of(mem), outer);
+    assert_int_equal(mem_del_alloc(outer, &record), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(outer), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_open_file(void **state) {
+    (void) state; /* unused */
+
+    const char *path = "mem_pool_test_suite.pool";
+    const size_t file_size = 256 * 1024;
+    alloc_t recs[3];
+    size_t offsets[3];
+
+    remove(path);
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_open_file(path, 0, FIRST_FIT));
+    pool_pt pool = mem_pool_open_file(path, file_size, FIRST_FIT);
+    assert_non_null(pool);
+    assert_null(mem_pool_open_file(path, file_size, FIRST_FIT));
+    for (unsigned i = 0; i < 3; i++) {
+        recs[i] = *mem_new_alloc(pool, 100);
+        offsets[i] = mem_alloc_offset(pool, &recs[i]);
+        snprintf(recs[i].mem, recs[i].size, "allocation %u", i);
+    }
+    assert_int_equal(mem_del_alloc(pool, &recs[1]), ALLOC_OK);
+    size_t total_size = pool->total_size;
+    assert_int_equal(mem_pool_sync(pool), ALLOC_OK);
+    // closing keeps the allocations in the file
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // reopened, most likely at another address, everything is where it was
+    void *taken = mmap(NULL, file_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert_true(taken != MAP_FAILED);
+    pool = mem_pool_open_file(path, 0, BEST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(pool->policy, FIRST_FIT);
+    assert_int_equal(pool->total_size, total_size);
+    assert_int_equal(pool->num_allocs, 2);
+    assert_int_equal(pool->num_gaps, 2);
+    assert_int_equal(pool->alloc_size, 200);
+    assert_string_equal(pool->mem + offsets[0], "allocation 0");
+    assert_string_equal(pool->mem + offsets[2], "allocation 2");
+    assert_ptr_equal(mem_pool_of(pool->mem + offsets[2]), pool);
+
+    // and the metadata works from the new address
+    alloc_pt alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    assert_int_equal(mem_alloc_offset(pool, alloc), offsets[1]);
+    assert_int_equal(mem_free_any(pool->mem + offsets[0]), ALLOC_OK);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    munmap(taken, file_size);
+
+    // a file that holds no pool does not open
+    FILE *out = fopen(path, "w");
+    assert_non_null(out);
+    fputs("not a pool", out);
+    fclose(out);
+    assert_null(mem_pool_open_file(path, file_size, FIRST_FIT));
+    remove(path);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_snapshot(void **state) {
+    (void) state; /* unused */
+
+    alloc_t recs[20];
+    pool_segment_pt before, after;
+    unsigned num_before, num_after;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < 20; i++) {
+        recs[i] = *mem_new_alloc(pool, 100 + i);
+        snprintf(recs[i].mem, recs[i].size, "allocation %u", i);
+    }
+    for (unsigned i = 0; i < 20; i += 3)
+        assert_int_equal(mem_del_alloc(pool, &recs[i]), ALLOC_OK);
+
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(mem_pool_snapshot(pool, fileno(file)), ALLOC_OK);
+    // the metadata takes no more room than in the pool
+    struct stat st;
+    assert_int_equal(fstat(fileno(file), &st), 0);
+    assert_true((size_t) st.st_size - pool->total_size < pool->total_size / 100);
+    pool_pt restored = mem_pool_restore(fileno(file));
+    fclose(file);
+    assert_non_null(restored);
+
+    // same segments and contents, at another address
+    assert_true(restored->mem != pool->mem);
+    assert_int_equal(restored->policy, BEST_FIT);
+    assert_int_equal(restored->total_size, pool->total_size);
+    assert_int_equal(restored->alloc_size, pool->alloc_size);
+    assert_int_equal(restored->num_allocs, pool->num_allocs);
+    assert_int_equal(restored->num_gaps, pool->num_gaps);
+    mem_inspect_pool(pool, &before, &num_before);
+    mem_inspect_pool(restored, &after, &num_after);
+    assert_int_equal(num_after, num_before);
+    assert_memory_equal(after, before, num_before * sizeof(pool_segment_t));
+    free(before);
+    free(after);
+    for (unsigned i = 1; i < 20; i += 3)
+        assert_string_equal(restored->mem + (recs[i].mem - pool->mem), recs[i].mem);
+
+    // the two pools go their own ways
+    alloc_t rec = *mem_new_alloc(restored, 100);
+    assert_int_equal(mem_alloc_offset(restored, &rec), mem_alloc_offset(pool, &recs[0]));
+    assert_ptr_equal(mem_pool_of(rec.mem), restored);
+    assert_int_equal(pool->num_allocs + 1, restored->num_allocs);
+    assert_int_equal(mem_pool_close(restored), ALLOC_OK);
+
+    for (unsigned i = 1; i < 20; i++)
+        if (i % 3)
+            assert_int_equal(mem_del_alloc(pool, &recs[i]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_restore_grows(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_allocs = 6000; // more than the nodes of a restored pool
+    pool_segment_pt before, after;
+    unsigned num_before, num_after;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(mem_pool_snapshot(pool, fileno(file)), ALLOC_OK);
+    pool_pt restored = mem_pool_restore(fileno(file));
+    assert_non_null(restored);
+    pool_pt clone = mem_pool_clone(pool);
+    assert_non_null(clone);
+
+    // the node heaps and gap indexes of both move out of their mappings
+    pool_pt grown[] = { restored, clone };
+    for (unsigned p = 0; p < 2; p++) {
+        for (unsigned i = 0; i < num_allocs; i++) {
+            alloc_pt alloc = mem_new_alloc(grown[p], 16);
+            assert_non_null(alloc);
+            memset(alloc->mem, (int) i, 16);
+        }
+        assert_int_equal(grown[p]->num_allocs, num_allocs);
+        // and free every other allocation, for as many gaps
+        mem_inspect_pool(grown[p], &before, &num_before);
+        for (unsigned i = 0; i < num_before; i += 2)
+            if (before[i].allocated) {
+                alloc_t rec = { before[i].size, grown[p]->mem + 16 * i };
+                assert_int_equal(mem_del_alloc(grown[p], &rec), ALLOC_OK);
+            }
+        free(before);
+        assert_int_equal(grown[p]->num_gaps, num_allocs / 2 + 1);
+    }
+
+    // a grown pool snapshots and restores like any other
+    FILE *grown_file = tmpfile();
+    assert_non_null(grown_file);
+    assert_int_equal(mem_pool_snapshot(restored, fileno(grown_file)), ALLOC_OK);
+    pool_pt again = mem_pool_restore(fileno(grown_file));
+    fclose(grown_file);
+    fclose(file);
+    assert_non_null(again);
+    mem_inspect_pool(restored, &before, &num_before);
+    mem_inspect_pool(again, &after, &num_after);
+    assert_int_equal(num_after, num_before);
+    for (unsigned i = 0; i < num_before; i++) {
+        assert_int_equal(after[i].size, before[i].size);
+        assert_int_equal(after[i].allocated, before[i].allocated);
+    }
+    free(before);
+    free(after);
+    assert_int_equal(again->mem[16 * 3], 3);
+    assert_non_null(mem_new_alloc(again, 16));
+
+    assert_int_equal(mem_pool_close(again), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone), ALLOC_OK);
+    assert_int_equal(mem_pool_close(restored), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_checkpoint(void **state) {
+    (void) state; /* unused */
+
+    alloc_t recs[10];
+    pool_segment_pt before, after;
+    unsigned num_before, num_after;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < 5; i++) {
+        recs[i] = *mem_new_alloc(pool, 10000);
+        snprintf(recs[i].mem, recs[i].size, "allocation %u", i);
+    }
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(mem_pool_snapshot(pool, fileno(file)), ALLOC_OK);
+
+    // allocations and marked writes make it into the checkpoint
+    for (unsigned i = 5; i < 10; i++) {
+        recs[i] = *mem_new_alloc(pool, 10000);
+        snprintf(recs[i].mem, recs[i].size, "allocation %u", i);
+    }
+    assert_int_equal(mem_del_alloc(pool, &recs[1]), ALLOC_OK);
+    strcpy(recs[2].mem, "changed 2");
+    assert_int_equal(mem_pool_mark_dirty(pool, recs[2].mem, 10), ALLOC_OK);
+    // and unmarked writes to pages already written do not
+    strcpy(recs[3].mem, "changed 3");
+    assert_int_equal(mem_pool_mark_dirty(pool, pool->mem + pool->total_size, 1), ALLOC_FAIL);
+    assert_int_equal(mem_pool_checkpoint(pool, fileno(file)), ALLOC_OK);
+
+    pool_pt restored = mem_pool_restore(fileno(file));
+    assert_non_null(restored);
+    assert_int_equal(restored->num_allocs, pool->num_allocs);
+    assert_int_equal(restored->num_gaps, pool->num_gaps);
+    mem_inspect_pool(pool, &before, &num_before);
+    mem_inspect_pool(restored, &after, &num_after);
+    assert_int_equal(num_after, num_before);
+    assert_memory_equal(after, before, num_before * sizeof(pool_segment_t));
+    free(before);
+    free(after);
+    for (unsigned i = 5; i < 10; i++)
+        assert_string_equal(restored->mem + (recs[i].mem - pool->mem), recs[i].mem);
+    assert_string_equal(restored->mem + (recs[2].mem - pool->mem), "changed 2");
+    assert_string_equal(restored->mem + (recs[3].mem - pool->mem), "allocation 3");
+    assert_int_equal(mem_pool_close(restored), ALLOC_OK);
+
+    // a checkpoint with nothing changed keeps the file as it is
+    assert_int_equal(mem_pool_checkpoint(pool, fileno(file)), ALLOC_OK);
+    restored = mem_pool_restore(fileno(file));
+    assert_non_null(restored);
+    assert_int_equal(restored->num_allocs, pool->num_allocs);
+    assert_int_equal(mem_pool_close(restored), ALLOC_OK);
+    fclose(file);
+
+    for (unsigned i = 0; i < 10; i++)
+        if (i != 1)
+            assert_int_equal(mem_del_alloc(pool, &recs[i]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_checkpoint_failed(void **state) {
+    (void) state; /* unused */
+
+    struct stat st;
+    struct rlimit limit, saved;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(mem_pool_snapshot(pool, fileno(file)), ALLOC_OK);
+    assert_int_equal(fstat(fileno(file), &st), 0);
+    size_t mem_offset = (size_t) st.st_size - pool->total_size;
+
+    // one run of dirty pages, from the start of the memory to past its middle
+    alloc_pt first = mem_new_alloc(pool, 100);
+    alloc_pt filler = mem_new_alloc(pool, POOL_SIZE / 2);
+    alloc_pt last = mem_new_alloc(pool, 100);
+    assert_non_null(first);
+    assert_non_null(filler);
+    assert_non_null(last);
+    strcpy(first->mem, "first");
+    strcpy(last->mem, "last");
+    size_t last_offset = mem_alloc_offset(pool, last);
+
+    // a file size limit in the middle of the memory cuts the checkpoint short
+    assert_int_equal(getrlimit(RLIMIT_FSIZE, &saved), 0);
+    limit = saved;
+    limit.rlim_cur = mem_offset + POOL_SIZE / 4;
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    assert_int_equal(setrlimit(RLIMIT_FSIZE, &limit), 0);
+    alloc_status status = mem_pool_checkpoint(pool, fileno(file));
+    assert_int_equal(setrlimit(RLIMIT_FSIZE, &saved), 0);
+    signal(SIGXFSZ, handler);
+    assert_int_equal(status, ALLOC_FAIL);
+    assert_null(mem_pool_restore(fileno(file)));
+
+    // and the next one writes what it left out
+    assert_int_equal(mem_pool_checkpoint(pool, fileno(file)), ALLOC_OK);
+    pool_pt restored = mem_pool_restore(fileno(file));
+    assert_non_null(restored);
+    assert_int_equal(restored->num_allocs, 3);
+    assert_string_equal(restored->mem, "first");
+    assert_string_equal(restored->mem + last_offset, "last");
+    assert_int_equal(mem_pool_close(restored), ALLOC_OK);
+    fclose(file);
+
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_clone(void **state) {
+    (void) state; /* unused */
+
+    alloc_t recs[3];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < 3; i++) {
+        recs[i] = *mem_new_alloc(pool, 1000);
+        snprintf(recs[i].mem, recs[i].size, "template %u", i);
+    }
+    size_t offset = mem_alloc_offset(pool, &recs[1]);
+
+    pool_pt clone1 = mem_pool_clone(pool);
+    pool_pt clone2 = mem_pool_clone(pool);
+    assert_non_null(clone1);
+    assert_non_null(clone2);
+    assert_true(clone1->mem != pool->mem && clone2->mem != clone1->mem);
+    assert_int_equal(clone1->num_allocs, 3);
+    assert_int_equal(clone2->alloc_size, 3000);
+    assert_string_equal(clone1->mem + offset, "template 1");
+    assert_ptr_equal(mem_pool_of(clone2->mem + offset), clone2);
+
+    // each copy goes its own way
+    strcpy(clone1->mem + offset, "clone 1");
+    assert_non_null(mem_new_alloc(clone1, 500));
+    assert_string_equal(pool->mem + offset, "template 1");
+    assert_string_equal(clone2->mem + offset, "template 1");
+    assert_int_equal(clone2->num_allocs, 3);
+    alloc_t rec = { 1000, clone2->mem + offset };
+    assert_int_equal(mem_del_alloc(clone2, &rec), ALLOC_OK);
+    assert_int_equal(clone1->num_allocs, 4);
+    assert_int_equal(pool->num_allocs, 3);
+
+    // a clone after the pool changed has the change
+    assert_int_equal(mem_del_alloc(pool, &recs[1]), ALLOC_OK);
+    pool_pt clone3 = mem_pool_clone(pool);
+    assert_non_null(clone3);
+    assert_int_equal(clone3->num_allocs, 2);
+    assert_int_equal(clone3->num_gaps, 2);
+
+    assert_int_equal(mem_pool_close(clone1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &recs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &recs[2]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_clone_changed(void **state) {
+    (void) state; /* unused */
+
+    alloc_t recs[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < 3; i++) {
+        recs[i] = *mem_new_alloc(pool, 10000);
+        snprintf(recs[i].mem, recs[i].size, "template %u", i);
+    }
+    pool_pt clone1 = mem_pool_clone(pool);
+    assert_non_null(clone1);
+
+    // a clone after allocations, deallocations and marked writes has them
+    recs[3] = *mem_new_alloc(pool, 10000);
+    strcpy(recs[3].mem, "new");
+    strcpy(recs[1].mem, "changed");
+    assert_int_equal(mem_pool_mark_dirty(pool, recs[1].mem, 8), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &recs[0]), ALLOC_OK);
+    pool_pt child = mem_pool_open_child(pool, 20000, BEST_FIT);
+    assert_non_null(child);
+    alloc_pt in_child = mem_new_alloc(child, 100);
+    strcpy(in_child->mem, "in the child");
+    size_t child_offset = (size_t) (in_child->mem - pool->mem);
+    pool_pt clone2 = mem_pool_clone(pool);
+    assert_non_null(clone2);
+    assert_int_equal(clone2->num_allocs, 4);
+    assert_int_equal(clone2->num_gaps, 2);
+    assert_string_equal(clone2->mem + mem_alloc_offset(pool, &recs[3]), "new");
+    assert_string_equal(clone2->mem + mem_alloc_offset(pool, &recs[1]), "changed");
+    assert_string_equal(clone2->mem + mem_alloc_offset(pool, &recs[2]), "template 2");
+    assert_string_equal(clone2->mem + child_offset, "in the child");
+    // and the clones before it are unaffected
+    assert_int_equal(clone1->num_allocs, 3);
+    assert_string_equal(clone1->mem + mem_alloc_offset(pool, &recs[1]), "template 1");
+    assert_string_equal(clone1->mem + mem_alloc_offset(pool, &recs[0]), "template 0");
+
+    // nor by changes after them, in the pool or in other clones
+    strcpy(recs[2].mem, "changed again");
+    assert_int_equal(mem_pool_mark_dirty(pool, recs[2].mem, 14), ALLOC_OK);
+    strcpy(clone2->mem + mem_alloc_offset(pool, &recs[3]), "clone 2");
+    pool_pt clone3 = mem_pool_clone(pool);
+    assert_non_null(clone3);
+    assert_string_equal(clone2->mem + mem_alloc_offset(pool, &recs[2]), "template 2");
+    assert_string_equal(clone3->mem + mem_alloc_offset(pool, &recs[2]), "changed again");
+    assert_string_equal(clone3->mem + mem_alloc_offset(pool, &recs[3]), "new");
+
+    // past half the pool changed, the template is written anew
+    memset(pool->mem + mem_alloc_offset(pool, &recs[3]) + 4, 'x', 16);
+    alloc_t big = *mem_new_alloc(pool, POOL_SIZE / 2 + 10000);
+    assert_int_equal(mem_pool_mark_dirty(pool, recs[3].mem, recs[3].size), ALLOC_OK);
+    pool_pt clone4 = mem_pool_clone(pool);
+    assert_non_null(clone4);
+    assert_int_equal(clone4->num_allocs, 5);
+    assert_int_equal(clone4->mem[mem_alloc_offset(pool, &recs[3]) + 4], 'x');
+    assert_string_equal(clone4->mem + mem_alloc_offset(pool, &recs[2]), "changed again");
+    assert_string_equal(clone3->mem + mem_alloc_offset(pool, &recs[3]), "new");
+
+    assert_int_equal(mem_pool_close(clone1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone3), ALLOC_OK);
+    assert_int_equal(mem_pool_close(clone4), ALLOC_OK);
+    assert_int_equal(mem_pool_close(child), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &big), ALLOC_OK);
+    for (unsigned i = 1; i < 4; i++)
+        assert_int_equal(mem_del_alloc(pool, &recs[i]), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_shared(void **state) {
+    (void) state; /* unused */
+
+    char name[64];
+    snprintf(name, sizeof(name), "/mem_pool.test.%d", (int) getpid());
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_shared(name, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_pt alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    strcpy(alloc->mem, "from the parent");
+    size_t offset = mem_alloc_offset(pool, alloc);
+
+    // another process attaches by name, sees the allocation and adds one
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        mem_pool_close(pool);
+        pool_pt other = mem_pool_open_shared(name, 0, FIRST_FIT);
+        if (other == NULL || strcmp(other->mem + offset, "from the parent") != 0)
+            _exit(1);
+        alloc_pt reply = mem_new_alloc(other, 200);
+        if (reply == NULL || mem_alloc_offset(other, reply) != offset + 100)
+            _exit(2);
+        strcpy(reply->mem, "from the child");
+        _exit(mem_pool_close(other) == ALLOC_OK ? 0 : 3);
+    }
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    // the child's allocation is there for the parent, at the same address
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    mem_inspect_pool(pool, &segs, &num_segs);
+    assert_int_equal(num_segs, 3);
+    assert_int_equal(segs[1].size, 200);
+    assert_int_equal(segs[1].allocated, 1);
+    free(segs);
+    assert_int_equal(pool->num_allocs, 2);
+    assert_string_equal(pool->mem + offset + 100, "from the child");
+    alloc_t rec = { 200, pool->mem + offset + 100 };
+    assert_int_equal(mem_del_alloc(pool, &rec), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+
+    // a name that is not there is not created without a size
+    assert_null(mem_pool_open_shared("/mem_pool.test.missing", 0, FIRST_FIT));
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static const char SHARED_EXEC_ENV[] = "MEM_POOL_TEST_SHARED_EXEC";
+
+static int shared_exec_child(const char *arg) {
+    // the other end of test_pool_shared_rebase, in a program of its own
+    char name[64];
+    size_t offset;
+    void *taken;
+    if (sscanf(arg, "%63s %zu %p", name, &offset, &taken) != 3)
+        return 1;
+    // with the address the parent maps the pool at taken, if it is free
+    long page_size = sysconf(_SC_PAGESIZE);
+    void *block = (void *) ((uintptr_t) taken & ~(uintptr_t) (page_size - 1));
+    void *blocked = mmap(block, (size_t) page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_init() != ALLOC_OK)
+        return 2;
+    pool_pt pool = mem_pool_open_shared(name, 0, FIRST_FIT);
+    if (pool == NULL || strcmp(pool->mem + offset, "from the parent") != 0)
+        return 3;
+    if (blocked == block && pool->mem == (char *) taken)
+        return 7;
+    alloc_pt reply = mem_new_alloc(pool, 200);
+    if (reply == NULL || mem_alloc_offset(pool, reply) != offset + 100)
+        return 4;
+    strcpy(reply->mem, "from the exec'd child");
+    pool_t stats;
+    if (mem_read_pool(pool, &stats) != ALLOC_OK || stats.num_allocs != 2 || stats.mem != pool->mem)
+        return 5;
+    if (mem_pool_close(pool) != ALLOC_OK || mem_free() != ALLOC_OK)
+        return 6;
+    return 0;
+}
+
+static void test_pool_shared_rebase(void **state) {
+    (void) state; /* unused */
+
+    char name[64];
+    snprintf(name, sizeof(name), "/mem_pool.test.rebase.%d", (int) getpid());
+    pool_segment_t segs[8];
+    unsigned num_segs;
+    pool_t stats;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_shared(name, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_t first = *mem_new_alloc(pool, 100);
+    strcpy(first.mem, "from the parent");
+    size_t offset = mem_alloc_offset(pool, &first);
+
+    // an unrelated program maps the pool where it can, and the metadata
+    // follows it there and back
+    char arg[128];
+    snprintf(arg, sizeof(arg), "%s %zu %p", name, offset, (void *) pool->mem);
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        setenv(SHARED_EXEC_ENV, arg, 1);
+        execl("/proc/self/exe", "pool_test_suite", (char *) NULL);
+        _exit(127);
+    }
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+    assert_int_equal(mem_read_pool(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 2);
+    assert_int_equal(mem_read_segments(pool, segs, 8, &num_segs), ALLOC_OK);
+    assert_int_equal(num_segs, 3);
+    assert_int_equal(segs[1].size, 200);
+    assert_string_equal(pool->mem + offset + 100, "from the exec'd child");
+    alloc_t reply = { 200, pool->mem + offset + 100 };
+    assert_int_equal(mem_del_alloc(pool, &reply), ALLOC_OK);
+
+    // as it does between two mappings in one process, the first one
+    // taking the address the second would have
+    pool_pt other = mem_pool_open_shared(name, 0, FIRST_FIT);
+    assert_non_null(other);
+    assert_true(other->mem != pool->mem);
+    assert_string_equal(other->mem + offset, "from the parent");
+    alloc_t second = *mem_new_alloc(other, 200);
+    assert_int_equal(mem_alloc_offset(other, &second), offset + 100);
+    alloc_t third = *mem_new_alloc(pool, 300);
+    assert_int_equal(mem_alloc_offset(pool, &third), offset + 300);
+    // the readers go by the pool in the segment, not the last local change
+    assert_int_equal(mem_read_pool(other, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 3);
+    assert_ptr_equal(stats.mem, other->mem);
+    assert_int_equal(mem_read_segments(other, segs, 8, &num_segs), ALLOC_OK);
+    assert_int_equal(num_segs, 4);
+    assert_int_equal(segs[2].size, 300);
+    pool_segment_iter_t iter;
+    pool_segment_t seg;
+    mem_segment_iter_init(other, &iter, 0, 0);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 1);
+    assert_int_equal(seg.size, 100);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 1);
+    assert_int_equal(iter.changed, 0);
+    alloc_t fourth = *mem_new_alloc(pool, 400);
+    assert_int_equal(mem_segment_iter_next(&iter, &seg), 0);
+    assert_int_equal(iter.changed, 1);
+    // and an allocation made in one mapping is freed in the other
+    alloc_t rec = { 200, pool->mem + offset + 100 };
+    assert_int_equal(mem_del_alloc(pool, &rec), ALLOC_OK);
+    rec.size = 300;
+    rec.mem = other->mem + offset + 300;
+    assert_int_equal(mem_del_alloc(other, &rec), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(other, &second), ALLOC_NOT_FREED);
+
+    // a group sees the largest gap as the other mapping left it
+    pool_pt small = mem_pool_open(1000, FIRST_FIT);
+    pool_group_pt group = mem_group_open();
+    assert_non_null(group);
+    assert_int_equal(mem_group_add(group, pool), ALLOC_OK);
+    assert_int_equal(mem_group_add(group, small), ALLOC_OK);
+    alloc_t rest = *mem_new_alloc(other, other->total_size - 1100);
+    pool_pt from = NULL;
+    assert_non_null(mem_group_alloc(group, 600, &from));
+    assert_ptr_equal(from, small);
+    assert_int_equal(mem_group_close(group), ALLOC_OK);
+    assert_int_equal(mem_pool_reset(small), ALLOC_OK);
+    assert_int_equal(mem_pool_close(small), ALLOC_OK);
+
+    // the name goes, the pool stays for those who have it open
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+    assert_null(mem_pool_open_shared(name, 0, FIRST_FIT));
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(other, &rest), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(other, &fourth), ALLOC_NOT_FREED);
+    rec.size = 400;
+    rec.mem = other->mem + mem_alloc_offset(pool, &fourth);
+    assert_int_equal(mem_del_alloc(other, &rec), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &first), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_shared_rebase_crash(void **state) {
+    (void) state; /* unused */
+
+    char name[64];
+    snprintf(name, sizeof(name), "/mem_pool.test.crash.%d", (int) getpid());
+    pool_segment_t segs[8];
+    unsigned num_segs;
+    pool_t stats;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    // large enough for the gap index to start past the first page
+    pool_pt pool = mem_pool_open_shared(name, 1 << 20, FIRST_FIT);
+    assert_non_null(pool);
+    pool_pt other = mem_pool_open_shared(name, 0, FIRST_FIT);
+    assert_non_null(other);
+    assert_true(other->mem != pool->mem);
+    // the metadata points into the first mapping after this
+    alloc_t first = *mem_new_alloc(pool, 100);
+    strcpy(first.mem, "before the crash");
+    size_t offset = mem_alloc_offset(pool, &first);
+
+    // a process dies rebasing the metadata to the second mapping, where
+    // all of it past the first page (the header and the mgr) is read-only
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        signal(SIGSEGV, SIG_DFL);
+        long page_size = sysconf(_SC_PAGESIZE);
+        unsigned long start = 0, end = 0;
+        char line[256];
+        FILE *maps = fopen("/proc/self/maps", "r");
+        while (maps != NULL && fgets(line, sizeof(line), maps) != NULL) {
+            if (sscanf(line, "%lx-%lx", &start, &end) == 2
+                && start <= (uintptr_t) other->mem && (uintptr_t) other->mem < end)
+                break;
+        }
+        uintptr_t mem_page = (uintptr_t) other->mem & ~(uintptr_t) (page_size - 1);
+        if (mprotect((void *) (start + page_size), mem_page - start - page_size, PROT_READ) != 0)
+            _exit(1);
+        mem_new_alloc(other, 200);
+        _exit(2);
+    }
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFSIGNALED(status));
+    assert_int_equal(WTERMSIG(status), SIGSEGV);
+
+    // the next process to take the lock finishes the rebase for it, and
+    // the pool is whole in both mappings
+    alloc_pt alloc = mem_new_alloc(pool, 200);
+    assert_non_null(alloc);
+    alloc_t second = *alloc;
+    assert_int_equal(mem_alloc_offset(pool, &second), offset + 100);
+    assert_string_equal(pool->mem + offset, "before the crash");
+    alloc_t third = *mem_new_alloc(other, 300);
+    assert_int_equal(mem_alloc_offset(other, &third), offset + 300);
+    assert_int_equal(mem_read_pool(other, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 3);
+    assert_int_equal(mem_read_segments(pool, segs, 8, &num_segs), ALLOC_OK);
+    assert_int_equal(num_segs, 4);
+    assert_int_equal(segs[2].size, 300);
+    assert_int_equal(mem_del_alloc(other, &third), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &second), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, &first), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***          6. STRESS TEST             ***/
 /***                                     ***/
 /***         [non-functional]            ***/
 /***         [see NOTE below]            ***/
@@ -2408,10 +3919,13 @@ void test_pool_stresstest(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***         7. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
+    if (getenv(SHARED_EXEC_ENV) != NULL)
+        return shared_exec_child(getenv(SHARED_EXEC_ENV));
+
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_pool_store_smoketest),
             cmocka_unit_test(test_pool_smoketest),
@@ -2443,6 +3957,32 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
+            cmocka_unit_test(test_pool_simulated),
+            cmocka_unit_test(test_pool_segment_iter),
+            cmocka_unit_test(test_pool_read),
+            cmocka_unit_test(test_pool_read_race),
+            cmocka_unit_test(test_pool_stats_export),
+            cmocka_unit_test(test_pool_profile),
+            cmocka_unit_test(test_pool_tags),
+            cmocka_unit_test(test_pool_guard),
+            cmocka_unit_test(test_pool_ctx),
+            cmocka_unit_test(test_pool_store_reuse),
+            cmocka_unit_test(test_pool_node_heap_moves),
+            cmocka_unit_test(test_pool_of),
+            cmocka_unit_test(test_pool_group),
+            cmocka_unit_test(test_pool_child),
+            cmocka_unit_test(test_pool_open_in),
+            cmocka_unit_test(test_pool_open_file),
+            cmocka_unit_test(test_pool_snapshot),
+            cmocka_unit_test(test_pool_restore_grows),
+            cmocka_unit_test(test_pool_checkpoint),
+            cmocka_unit_test(test_pool_checkpoint_failed),
+            cmocka_unit_test(test_pool_clone),
+            cmocka_unit_test(test_pool_clone_changed),
+            cmocka_unit_test(test_pool_shared),
+            cmocka_unit_test(test_pool_shared_rebase),
+            cmocka_unit_test(test_pool_shared_rebase_crash),
+
             // do not uncomment until the project is changed to return the allocation address
 //            cmocka_unit_test(test_pool_stresstest),
     };
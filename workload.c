@@ -0,0 +1,433 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_harness.h"
+#include "workload.h"
+
+
+/*****            constants            *****/
+
+static const unsigned WL_MAX_ZIPF_CLASSES = 4096;
+static const uint64_t WL_IMMORTAL         = UINT64_MAX;
+
+
+/*****        type declarations        *****/
+
+/*
+ * The live set is a binary min-heap ordered by the time each object is
+ * due to be freed. Every lifetime model reduces to a choice of key:
+ * birth order for FIFO, reversed birth order for LIFO, and birth plus a
+ * random lifetime for the exponential models. Freeing is always "pop the
+ * smallest key", either because it expired or because the live set is at
+ * its target.
+ */
+typedef struct _wl_live {
+    uint64_t key;
+    unsigned id;
+} wl_live_t;
+
+struct _workload {
+    workload_config_t config;
+    bench_rng_t rng;
+
+    wl_live_t *heap;            // live objects, min-heap by key
+    unsigned num_live;
+
+    unsigned *free_ids;         // stack of unused slot ids
+    unsigned num_free_ids;
+
+    double *zipf_cdf;           // cumulative probabilities of the size classes
+
+    uint64_t clock;             // number of allocations so far
+    unsigned long ops;
+};
+
+
+/*****         helper routines         *****/
+
+static void heap_swap(wl_live_t *heap, unsigned i, unsigned j) {
+    wl_live_t tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+static void heap_push(workload_pt wl, uint64_t key, unsigned id) {
+    unsigned i = wl->num_live++;
+    wl->heap[i].key = key;
+    wl->heap[i].id = id;
+    while (i > 0 && wl->heap[(i - 1) / 2].key > wl->heap[i].key) {
+        heap_swap(wl->heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static wl_live_t heap_pop(workload_pt wl) {
+    wl_live_t top = wl->heap[0];
+    wl->heap[0] = wl->heap[--wl->num_live];
+    unsigned i = 0;
+    for (;;) {
+        unsigned l = 2 * i + 1, r = l + 1, m = i;
+        if (l < wl->num_live && wl->heap[l].key < wl->heap[m].key) m = l;
+        if (r < wl->num_live && wl->heap[r].key < wl->heap[m].key) m = r;
+        if (m == i) break;
+        heap_swap(wl->heap, i, m);
+        i = m;
+    }
+    return top;
+}
+
+static size_t clamp_size(const workload_config_t *cfg, double size) {
+    if (size < (double) cfg->size_min) return cfg->size_min;
+    if (size > (double) cfg->size_max) return cfg->size_max;
+    return (size_t) size;
+}
+
+static size_t draw_size(workload_pt wl) {
+    const workload_config_t *cfg = &wl->config;
+
+    switch (cfg->size_dist) {
+        case WL_SIZE_FIXED:
+            return cfg->size_min;
+        case WL_SIZE_UNIFORM:
+            return (size_t) bench_rng_range(&wl->rng, cfg->size_min, cfg->size_max);
+        case WL_SIZE_BIMODAL: {
+            // each mode is spread +-25% around its center
+            size_t mode = (bench_rng_unit(&wl->rng) < cfg->large_fraction) ? cfg->size_large : cfg->size_small;
+            return clamp_size(cfg, mode * (0.75 + 0.5 * bench_rng_unit(&wl->rng)));
+        }
+        case WL_SIZE_ZIPF: {
+            double u = bench_rng_unit(&wl->rng);
+            unsigned lo = 0, hi = cfg->zipf_classes - 1;
+            while (lo < hi) {
+                unsigned mid = (lo + hi) / 2;
+                if (wl->zipf_cdf[mid] < u) lo = mid + 1;
+                else hi = mid;
+            }
+            return clamp_size(cfg, (double) cfg->size_min * (lo + 1));
+        }
+        case WL_SIZE_LOGNORMAL:
+            return clamp_size(cfg, cfg->lognormal_median *
+                                   exp(cfg->lognormal_sigma * bench_rng_normal(&wl->rng)));
+    }
+    return cfg->size_min;
+}
+
+static uint64_t draw_key(workload_pt wl) {
+    const workload_config_t *cfg = &wl->config;
+    double mean = cfg->mean_lifetime > 0 ? cfg->mean_lifetime : cfg->live_target;
+
+    switch (cfg->lifetime) {
+        case WL_LIFE_FIFO:
+            return wl->clock;
+        case WL_LIFE_LIFO:
+            return WL_IMMORTAL - 1 - wl->clock;
+        case WL_LIFE_LONG_TAIL:
+            if (bench_rng_unit(&wl->rng) < cfg->long_lived_fraction)
+                return WL_IMMORTAL;
+            // fall through
+        case WL_LIFE_EXPONENTIAL:
+            return wl->clock + 1 + (uint64_t) (-mean * log(bench_rng_unit(&wl->rng)));
+    }
+    return wl->clock;
+}
+
+
+/*****     generator and driver API    *****/
+
+void workload_default_config(workload_config_pt config) {
+    memset(config, 0, sizeof(workload_config_t));
+    config->size_dist = WL_SIZE_LOGNORMAL;
+    config->size_min = 8;
+    config->size_max = 65536;
+    config->size_small = 32;
+    config->size_large = 4096;
+    config->large_fraction = 0.1;
+    config->zipf_s = 1.1;
+    config->zipf_classes = 64;
+    config->lognormal_median = 128;
+    config->lognormal_sigma = 1.0;
+    config->lifetime = WL_LIFE_EXPONENTIAL;
+    config->mean_lifetime = 0;
+    config->long_lived_fraction = 0.05;
+    config->live_target = 1000;
+    config->num_ops = 100000;
+    config->drain = 1;
+    config->seed = 1;
+}
+
+workload_pt workload_open(const workload_config_t *config) {
+    if (config->live_target == 0 || config->size_min == 0 || config->size_min > config->size_max)
+        return NULL;
+
+    workload_pt wl = (workload_pt) calloc(1, sizeof(workload_t));
+    if (wl == NULL)
+        return NULL;
+    wl->config = *config;
+    bench_rng_seed(&wl->rng, config->seed);
+
+    wl->heap = (wl_live_t *) calloc(config->live_target, sizeof(wl_live_t));
+    wl->free_ids = (unsigned *) calloc(config->live_target, sizeof(unsigned));
+    if (wl->heap == NULL || wl->free_ids == NULL) {
+        workload_close(wl);
+        return NULL;
+    }
+    // hand out low ids first
+    for (unsigned i = 0; i < config->live_target; ++i)
+        wl->free_ids[i] = config->live_target - 1 - i;
+    wl->num_free_ids = config->live_target;
+
+    if (config->size_dist == WL_SIZE_ZIPF) {
+        unsigned classes = config->zipf_classes;
+        if (classes == 0 || classes > WL_MAX_ZIPF_CLASSES) {
+            workload_close(wl);
+            return NULL;
+        }
+        wl->zipf_cdf = (double *) calloc(classes, sizeof(double));
+        if (wl->zipf_cdf == NULL) {
+            workload_close(wl);
+            return NULL;
+        }
+        double total = 0;
+        for (unsigned k = 0; k < classes; ++k) {
+            total += 1.0 / pow(k + 1, config->zipf_s);
+            wl->zipf_cdf[k] = total;
+        }
+        for (unsigned k = 0; k < classes; ++k)
+            wl->zipf_cdf[k] /= total;
+    }
+
+    return wl;
+}
+
+int workload_next(workload_pt wl, wl_op_pt op) {
+    const workload_config_t *cfg = &wl->config;
+
+    if (wl->ops >= cfg->num_ops) {
+        if (!cfg->drain || wl->num_live == 0)
+            return 0;
+    } else {
+        // FIFO and LIFO objects only die when the live set is full
+        int timed = cfg->lifetime == WL_LIFE_EXPONENTIAL || cfg->lifetime == WL_LIFE_LONG_TAIL;
+        int expired = timed && wl->num_live > 0 && wl->heap[0].key <= wl->clock;
+        int full = wl->num_live >= cfg->live_target;
+        if (!expired && !full) {
+            unsigned id = wl->free_ids[--wl->num_free_ids];
+            heap_push(wl, draw_key(wl), id);
+            wl->clock++;
+            wl->ops++;
+            op->kind = WL_ALLOC;
+            op->id = id;
+            op->size = draw_size(wl);
+            return 1;
+        }
+        wl->ops++;
+    }
+
+    wl_live_t victim = heap_pop(wl);
+    wl->free_ids[wl->num_free_ids++] = victim.id;
+    op->kind = WL_FREE;
+    op->id = victim.id;
+    op->size = 0;
+    return 1;
+}
+
+void workload_close(workload_pt wl) {
+    if (wl == NULL)
+        return;
+    free(wl->heap);
+    free(wl->free_ids);
+    free(wl->zipf_cdf);
+    free(wl);
+}
+
+/*
+ * Applies one op to the pool. records[] is indexed by op id and holds a
+ * copy of each live allocation record: the alloc_pt returned by
+ * mem_new_alloc moves when the node heap grows. An empty slot has size 0,
+ * not a NULL mem, which is a valid offset in a simulated pool.
+ */
+static void replay_op(pool_pt pool, alloc_t *records, const wl_op_t *op,
+                      unsigned *live, double *gap_sum, workload_stats_pt stats) {
+    if (op->kind == WL_ALLOC) {
+        alloc_pt alloc = op->size ? mem_new_alloc(pool, op->size) : NULL;
+        if (alloc == NULL) {
+            records[op->id].size = 0;
+            stats->failed_allocs++;
+            return;
+        }
+        records[op->id] = *alloc;
+        stats->allocs++;
+        if (++*live > stats->peak_live) stats->peak_live = *live;
+        if (pool->alloc_size > stats->peak_alloc_size) stats->peak_alloc_size = pool->alloc_size;
+    } else {
+        if (records[op->id].size == 0)
+            return;
+        mem_del_alloc(pool, &records[op->id]);
+        records[op->id].size = 0;
+        stats->frees++;
+        --*live;
+    }
+    if (pool->num_gaps > stats->peak_gaps) stats->peak_gaps = pool->num_gaps;
+    *gap_sum += pool->num_gaps;
+}
+
+alloc_status workload_run(pool_pt pool, const workload_config_t *config, workload_stats_pt stats) {
+    workload_pt wl = workload_open(config);
+    alloc_t *records = (alloc_t *) calloc(config->live_target, sizeof(alloc_t));
+    if (wl == NULL || records == NULL) {
+        workload_close(wl);
+        free(records);
+        return ALLOC_FAIL;
+    }
+
+    memset(stats, 0, sizeof(workload_stats_t));
+    unsigned live = 0;
+    double gap_sum = 0;
+    wl_op_t op;
+
+    unsigned long long start = bench_start();
+    while (workload_next(wl, &op))
+        replay_op(pool, records, &op, &live, &gap_sum, stats);
+    stats->elapsed_ns = bench_stop(start);
+    stats->mean_gaps = (stats->allocs + stats->frees) ? gap_sum / (stats->allocs + stats->frees) : 0;
+
+    workload_close(wl);
+    free(records);
+    return ALLOC_OK;
+}
+
+
+/*****              traces             *****/
+
+/*
+ * Trace format, one op per line:
+ *   a ID SIZE      allocate SIZE bytes into slot ID
+ *   f ID           free slot ID
+ * Lines starting with '#' are comments; "# pool_size N" and
+ * "# policy FIRST_FIT|BEST_FIT" are picked up as replay settings.
+ */
+
+int workload_trace_load(FILE *in, wl_trace_pt trace) {
+    char line[256];
+    unsigned long capacity = 1024;
+
+    memset(trace, 0, sizeof(wl_trace_t));
+    trace->policy = -1;
+    trace->ops = (wl_op_pt) calloc(capacity, sizeof(wl_op_t));
+    if (trace->ops == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        unsigned id;
+        unsigned long size;
+        char name[32];
+
+        if (line[0] == '#') {
+            if (sscanf(line, "# pool_size %lu", &size) == 1)
+                trace->pool_size = size;
+            else if (sscanf(line, "# policy %31s", name) == 1)
+                trace->policy = strcmp(name, "BEST_FIT") == 0 ? BEST_FIT
+                              : strcmp(name, "FIRST_FIT") == 0 ? FIRST_FIT : -1;
+            continue;
+        }
+
+        wl_op_t op;
+        if (sscanf(line, "a %u %lu", &id, &size) == 2) {
+            op.kind = WL_ALLOC;
+            op.size = size;
+        } else if (sscanf(line, "f %u", &id) == 1) {
+            op.kind = WL_FREE;
+            op.size = 0;
+        } else {
+            continue;
+        }
+        op.id = id;
+
+        if (trace->num_ops == capacity) {
+            wl_op_pt ops = (wl_op_pt) realloc(trace->ops, 2 * capacity * sizeof(wl_op_t));
+            if (ops == NULL) {
+                workload_trace_free(trace);
+                return 0;
+            }
+            trace->ops = ops;
+            capacity *= 2;
+        }
+        trace->ops[trace->num_ops++] = op;
+        if (id + 1 > trace->num_ids)
+            trace->num_ids = id + 1;
+    }
+    return 1;
+}
+
+void workload_trace_free(wl_trace_pt trace) {
+    free(trace->ops);
+    trace->ops = NULL;
+    trace->num_ops = 0;
+}
+
+void workload_trace_write(FILE *out, const wl_op_t *ops, unsigned long num_ops) {
+    for (unsigned long i = 0; i < num_ops; ++i) {
+        if (ops[i].kind == WL_ALLOC)
+            fprintf(out, "a %u %lu\n", ops[i].id, (unsigned long) ops[i].size);
+        else
+            fprintf(out, "f %u\n", ops[i].id);
+    }
+}
+
+alloc_status workload_trace_run(pool_pt pool, const wl_trace_t *trace, workload_stats_pt stats) {
+    alloc_t *records = (alloc_t *) calloc(trace->num_ids ? trace->num_ids : 1, sizeof(alloc_t));
+    if (records == NULL)
+        return ALLOC_FAIL;
+
+    memset(stats, 0, sizeof(workload_stats_t));
+    unsigned live = 0;
+    double gap_sum = 0;
+
+    unsigned long long start = bench_start();
+    for (unsigned long i = 0; i < trace->num_ops; ++i)
+        replay_op(pool, records, &trace->ops[i], &live, &gap_sum, stats);
+    stats->elapsed_ns = bench_stop(start);
+    stats->mean_gaps = (stats->allocs + stats->frees) ? gap_sum / (stats->allocs + stats->frees) : 0;
+
+    // a trace may end with live allocations; release them so the pool can close
+    for (unsigned i = 0; i < trace->num_ids; ++i)
+        if (records[i].size) mem_del_alloc(pool, &records[i]);
+
+    free(records);
+    return ALLOC_OK;
+}
+
+
+/*****              names              *****/
+
+static const char *SIZE_DIST_NAMES[] = { "fixed", "uniform", "bimodal", "zipf", "lognormal" };
+static const char *LIFETIME_NAMES[]  = { "exponential", "fifo", "lifo", "longtail" };
+
+const char *workload_size_dist_name(wl_size_dist dist) {
+    return (unsigned) dist < COUNT_OF(SIZE_DIST_NAMES) ? SIZE_DIST_NAMES[dist] : "unknown";
+}
+
+const char *workload_lifetime_name(wl_lifetime lifetime) {
+    return (unsigned) lifetime < COUNT_OF(LIFETIME_NAMES) ? LIFETIME_NAMES[lifetime] : "unknown";
+}
+
+int workload_parse_size_dist(const char *name, wl_size_dist *dist) {
+    for (unsigned i = 0; i < COUNT_OF(SIZE_DIST_NAMES); ++i) {
+        if (strcmp(name, SIZE_DIST_NAMES[i]) == 0) {
+            *dist = (wl_size_dist) i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int workload_parse_lifetime(const char *name, wl_lifetime *lifetime) {
+    for (unsigned i = 0; i < COUNT_OF(LIFETIME_NAMES); ++i) {
+        if (strcmp(name, LIFETIME_NAMES[i]) == 0) {
+            *lifetime = (wl_lifetime) i;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+//
+// Synthetic workload generator: alloc/free sequences with
+// configurable size and lifetime distributions, and a driver
+// that replays them against a pool through the public API.
+//
+
+#ifndef DENVER_OS_PA_C_WORKLOAD_H
+#define DENVER_OS_PA_C_WORKLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mem_pool.h"
+
+/* type declarations */
+
+typedef enum _wl_size_dist {
+    WL_SIZE_FIXED,
+    WL_SIZE_UNIFORM,
+    WL_SIZE_BIMODAL,
+    WL_SIZE_ZIPF,
+    WL_SIZE_LOGNORMAL
+} wl_size_dist;
+
+typedef enum _wl_lifetime {
+    WL_LIFE_EXPONENTIAL,    // each object expires after an exponential lifetime
+    WL_LIFE_FIFO,           // oldest object is freed first
+    WL_LIFE_LIFO,           // newest object is freed first
+    WL_LIFE_LONG_TAIL       // exponential, but a fraction of objects is never freed until the end
+} wl_lifetime;
+
+typedef struct _workload_config {
+    wl_size_dist size_dist;
+    size_t size_min;            // fixed size, uniform low end, zipf rank-1 size, clamp for all
+    size_t size_max;            // uniform high end, clamp for all
+    size_t size_small;          // bimodal modes
+    size_t size_large;
+    double large_fraction;      // bimodal share of large objects
+    double zipf_s;              // zipf exponent over size classes size_min * k
+    unsigned zipf_classes;
+    double lognormal_median;
+    double lognormal_sigma;
+
+    wl_lifetime lifetime;
+    double mean_lifetime;       // in allocations; 0 means live_target
+    double long_lived_fraction; // WL_LIFE_LONG_TAIL share of immortal objects
+
+    unsigned live_target;       // the live set ramps up to and is capped at this
+    unsigned long num_ops;      // alloc + free operations before the drain
+    unsigned drain;             // free everything still live at the end
+    uint64_t seed;
+} workload_config_t, *workload_config_pt;
+
+typedef enum _wl_op_kind { WL_ALLOC, WL_FREE } wl_op_kind;
+
+typedef struct _wl_op {
+    wl_op_kind kind;
+    unsigned id;                // slot in [0, live_target), reused after free
+    size_t size;                // allocation size (WL_ALLOC only)
+} wl_op_t, *wl_op_pt;
+
+typedef struct _workload_stats {
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long failed_allocs;
+    unsigned peak_live;
+    size_t peak_alloc_size;     // pool->alloc_size high-water mark
+    unsigned peak_gaps;         // pool->num_gaps high-water mark
+    double mean_gaps;
+    unsigned long long elapsed_ns;
+} workload_stats_t, *workload_stats_pt;
+
+typedef struct _wl_trace {
+    wl_op_pt ops;
+    unsigned long num_ops;
+    unsigned num_ids;           // one past the largest slot id
+    size_t pool_size;           // from "# pool_size", 0 if absent
+    int policy;                 // from "# policy", -1 if absent
+} wl_trace_t, *wl_trace_pt;
+
+typedef struct _workload workload_t, *workload_pt;
+
+/* function declarations */
+
+void
+workload_default_config(workload_config_pt config);
+
+workload_pt
+workload_open(const workload_config_t *config);
+
+int
+workload_next(workload_pt workload, wl_op_pt op);   // 0 when the sequence is over
+
+void
+workload_close(workload_pt workload);
+
+alloc_status
+workload_run(pool_pt pool, const workload_config_t *config, workload_stats_pt stats);
+
+int
+workload_trace_load(FILE *in, wl_trace_pt trace);   // 0 on allocation failure
+
+void
+workload_trace_free(wl_trace_pt trace);
+
+void
+workload_trace_write(FILE *out, const wl_op_t *ops, unsigned long num_ops);
+
+alloc_status
+workload_trace_run(pool_pt pool, const wl_trace_t *trace, workload_stats_pt stats);
+
+const char *
+workload_size_dist_name(wl_size_dist dist);
+
+const char *
+workload_lifetime_name(wl_lifetime lifetime);
+
+int
+workload_parse_size_dist(const char *name, wl_size_dist *dist);
+
+int
+workload_parse_lifetime(const char *name, wl_lifetime *lifetime);
+
+#endif //DENVER_OS_PA_C_WORKLOAD_H
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "bench_harness.h"
+#include "workload.h"
+
+
+/*****            constants            *****/
+
+static const size_t DEFAULT_POOL_SIZE = 256 << 20;
+
+
+/*****         helper routines         *****/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --size fixed|uniform|bimodal|zipf|lognormal   size distribution\n"
+            "  --min BYTES --max BYTES                        size range / clamp\n"
+            "  --small BYTES --large BYTES --large-frac F     bimodal modes\n"
+            "  --zipf-s S --zipf-classes K                    zipf over sizes min * k\n"
+            "  --median BYTES --sigma S                       lognormal parameters\n"
+            "  --lifetime exponential|fifo|lifo|longtail      lifetime distribution\n"
+            "  --mean-life N                                  mean lifetime in allocations\n"
+            "  --long-frac F                                  longtail share of immortal objects\n"
+            "  --live N                                       live-set target\n"
+            "  --ops N                                        operations before the drain\n"
+            "  --no-drain                                     keep the final live set\n"
+            "  --seed N\n"
+            "  --policy first|best|all                        pool policy to drive (default all)\n"
+            "  --pool-size BYTES\n"
+            "  --simulate                                     metadata-only pool, no backing memory\n"
+            "  --heap-profile FILE [--sample BYTES]           write a sampled pprof heap profile\n"
+            "  --trace                                        print the sequence instead of running it\n"
+            "  --replay FILE                                  run a saved trace instead of generating one\n"
+            "results are written to stdout as JSON, traces as 'a ID SIZE' / 'f ID' lines\n", prog);
+}
+
+static void report(const workload_config_t *cfg, alloc_policy policy, size_t pool_size,
+                   int simulate, const workload_stats_t *stats) {
+    bench_result_t result = {
+            "workload", "mem_pool", bench_policy_name(policy), workload_size_dist_name(cfg->size_dist),
+            cfg->live_target, stats->allocs + stats->frees, stats->elapsed_ns
+    };
+    bench_report_begin(&result);
+    bench_field_str("lifetime", workload_lifetime_name(cfg->lifetime));
+    bench_field_u64("seed", cfg->seed);
+    bench_field_u64("pool_size", pool_size);
+    bench_field_u64("simulated", (unsigned) simulate);
+    bench_field_u64("allocs", stats->allocs);
+    bench_field_u64("frees", stats->frees);
+    bench_field_u64("failed_allocs", stats->failed_allocs);
+    bench_field_u64("peak_live", stats->peak_live);
+    bench_field_u64("peak_alloc_size", stats->peak_alloc_size);
+    bench_field_u64("peak_gaps", stats->peak_gaps);
+    bench_field_f64("mean_gaps", stats->mean_gaps);
+    bench_report_end();
+}
+
+static pool_pt open_pool(size_t pool_size, alloc_policy policy, int simulate) {
+    return simulate ? mem_pool_open_sim(pool_size, policy) : mem_pool_open(pool_size, policy);
+}
+
+static int replay(const char *path, int policy, size_t pool_size, int simulate,
+                  const char *profile_path, size_t sample_bytes) {
+    FILE *in = fopen(path, "r");
+    wl_trace_t trace;
+    if (in == NULL) {
+        perror(path);
+        return 1;
+    }
+    if (!workload_trace_load(in, &trace)) {
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+
+    // settings recorded in the trace win, so saved cases reproduce exactly
+    if (trace.pool_size) pool_size = trace.pool_size;
+    if (trace.policy >= 0) policy = trace.policy;
+
+    if (mem_init() != ALLOC_OK)
+        return 1;
+    if (profile_path)
+        mem_profile_start(sample_bytes);
+    bench_counters_init(1);
+    bench_json_open(stdout, "mem_pool_workload");
+    for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p) {
+        if (policy >= 0 && BENCH_POLICIES[p] != (alloc_policy) policy)
+            continue;
+        pool_pt pool = open_pool(pool_size, BENCH_POLICIES[p], simulate);
+        workload_stats_t stats;
+        if (pool == NULL || workload_trace_run(pool, &trace, &stats) != ALLOC_OK) {
+            INFO("cannot replay %s\n", path);
+        } else {
+            bench_result_t result = {
+                    "replay", "mem_pool", bench_policy_name(BENCH_POLICIES[p]), path,
+                    trace.num_ops, stats.allocs + stats.frees, stats.elapsed_ns
+            };
+            bench_report_begin(&result);
+            bench_field_u64("pool_size", pool_size);
+            bench_field_u64("simulated", (unsigned) simulate);
+            bench_field_u64("failed_allocs", stats.failed_allocs);
+            bench_field_u64("peak_live", stats.peak_live);
+            bench_field_u64("peak_alloc_size", stats.peak_alloc_size);
+            bench_field_u64("peak_gaps", stats.peak_gaps);
+            bench_field_f64("mean_gaps", stats.mean_gaps);
+            bench_report_end();
+        }
+        if (pool) mem_pool_close(pool);
+    }
+    bench_json_close();
+    bench_counters_shutdown();
+    if (profile_path && mem_profile_dump(profile_path) != ALLOC_OK)
+        perror(profile_path);
+    mem_free();
+    workload_trace_free(&trace);
+    return 0;
+}
+
+static int trace(const workload_config_t *cfg) {
+    workload_pt wl = workload_open(cfg);
+    if (wl == NULL) {
+        fprintf(stderr, "invalid workload configuration\n");
+        return 1;
+    }
+    wl_op_t op;
+    while (workload_next(wl, &op))
+        workload_trace_write(stdout, &op, 1);
+    workload_close(wl);
+    return 0;
+}
+
+
+/*****              main               *****/
+
+int main(int argc, char *argv[]) {
+    workload_config_t cfg;
+    workload_default_config(&cfg);
+    size_t pool_size = DEFAULT_POOL_SIZE;
+    int policy = -1;   // all
+    int tracing = 0;
+    int simulate = 0;
+    const char *profile_path = NULL;
+    size_t sample_bytes = 0;
+    const char *replay_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int ok = 1;
+
+        if (strcmp(arg, "--trace") == 0) { tracing = 1; continue; }
+        if (strcmp(arg, "--no-drain") == 0) { cfg.drain = 0; continue; }
+        if (strcmp(arg, "--simulate") == 0) { simulate = 1; continue; }
+        if (val == NULL) { usage(argv[0]); return 1; }
+        ++i;
+
+        if      (strcmp(arg, "--size") == 0)         ok = workload_parse_size_dist(val, &cfg.size_dist);
+        else if (strcmp(arg, "--lifetime") == 0)     ok = workload_parse_lifetime(val, &cfg.lifetime);
+        else if (strcmp(arg, "--min") == 0)          cfg.size_min = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--max") == 0)          cfg.size_max = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--small") == 0)        cfg.size_small = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--large") == 0)        cfg.size_large = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--large-frac") == 0)   cfg.large_fraction = strtod(val, NULL);
+        else if (strcmp(arg, "--zipf-s") == 0)       cfg.zipf_s = strtod(val, NULL);
+        else if (strcmp(arg, "--zipf-classes") == 0) cfg.zipf_classes = (unsigned) strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--median") == 0)       cfg.lognormal_median = strtod(val, NULL);
+        else if (strcmp(arg, "--sigma") == 0)        cfg.lognormal_sigma = strtod(val, NULL);
+        else if (strcmp(arg, "--mean-life") == 0)    cfg.mean_lifetime = strtod(val, NULL);
+        else if (strcmp(arg, "--long-frac") == 0)    cfg.long_lived_fraction = strtod(val, NULL);
+        else if (strcmp(arg, "--live") == 0)         cfg.live_target = (unsigned) strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--ops") == 0)          cfg.num_ops = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--seed") == 0)         cfg.seed = strtoull(val, NULL, 10);
+        else if (strcmp(arg, "--pool-size") == 0)    pool_size = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--replay") == 0)       replay_path = val;
+        else if (strcmp(arg, "--heap-profile") == 0) profile_path = val;
+        else if (strcmp(arg, "--sample") == 0)       sample_bytes = strtoul(val, NULL, 10);
+        else if (strcmp(arg, "--policy") == 0) {
+            if      (strcmp(val, "first") == 0) policy = FIRST_FIT;
+            else if (strcmp(val, "best") == 0)  policy = BEST_FIT;
+            else if (strcmp(val, "all") == 0)   policy = -1;
+            else ok = 0;
+        }
+        else ok = 0;
+
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (tracing)
+        return trace(&cfg);
+    if (replay_path)
+        return replay(replay_path, policy, pool_size, simulate, profile_path, sample_bytes);
+
+    if (mem_init() != ALLOC_OK)
+        return 1;
+    if (profile_path)
+        mem_profile_start(sample_bytes);
+
+    bench_counters_init(1);
+    bench_json_open(stdout, "mem_pool_workload");
+    for (unsigned p = 0; p < BENCH_NUM_POLICIES; ++p) {
+        if (policy >= 0 && BENCH_POLICIES[p] != (alloc_policy) policy)
+            continue;
+        pool_pt pool = open_pool(pool_size, BENCH_POLICIES[p], simulate);
+        if (pool == NULL) {
+            INFO("cannot open a pool of %lu bytes\n", (unsigned long) pool_size);
+            continue;
+        }
+        workload_stats_t stats;
+        if (workload_run(pool, &cfg, &stats) == ALLOC_OK)
+            report(&cfg, BENCH_POLICIES[p], pool_size, simulate, &stats);
+        else {
+            INFO("invalid workload configuration\n");
+        }
+        mem_pool_close(pool);
+    }
+    bench_json_close();
+    bench_counters_shutdown();
+
+    if (profile_path && mem_profile_dump(profile_path) != ALLOC_OK)
+        perror(profile_path);
+    mem_free();
+    return 0;
+}